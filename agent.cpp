@@ -0,0 +1,139 @@
+/*
+ * agent.cpp
+ */
+
+#include "agent.hpp"
+
+#include <cstring>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+#include "util.hpp"
+
+#include <err.h>
+#include <errno.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+std::string encode_frame(const std::string& payload) {
+    uint32_t size = payload.size();
+    std::string ret;
+    for (int shift = 24; shift >= 0; shift -= 8) {
+        ret += (char)((size >> shift) & 0xFF);
+    }
+    return ret + payload;
+}
+
+bool frame_decoder::next(std::string& payload) {
+    if (buf.size() < 4) {
+        return false;
+    }
+    uint32_t size = 0;
+    for (int i = 0; i < 4; i++) {
+        size = (size << 8) | (unsigned char)buf[i];
+    }
+    if (size > AGENT_MAX_FRAME) {
+        throw std::runtime_error("frame of " + std::to_string(size) + " bytes exceeds the maximum size");
+    }
+    if (buf.size() < 4 + size) {
+        return false;
+    }
+    payload = buf.substr(4, size);
+    buf.erase(0, 4 + size);
+    return true;
+}
+
+bool write_frame(int fd, const std::string& payload) {
+    std::string frame = encode_frame(payload);
+    size_t done = 0;
+    while (done < frame.size()) {
+        // MSG_NOSIGNAL so a client which went away doesn't kill the agent with SIGPIPE
+        ssize_t n = send(fd, frame.data() + done, frame.size() - done, MSG_NOSIGNAL);
+        if (n < 0 && errno == EINTR) {
+            continue;
+        }
+        if (n <= 0) {
+            return false;
+        }
+        done += n;
+    }
+    return true;
+}
+
+bool read_frame(int fd, frame_decoder& decoder, std::string& payload) {
+    char buf[4096];
+    while (!decoder.next(payload)) {
+        ssize_t n = read(fd, buf, sizeof(buf));
+        if (n < 0 && errno == EINTR) {
+            continue;
+        }
+        if (n <= 0) {
+            return false;
+        }
+        decoder.feed(buf, n);
+    }
+    return true;
+}
+
+agent_request parse_agent_request(const std::string& request) {
+    agent_request ret;
+    for (auto& token : split(request, " ")) {
+        if (token.empty()) {
+            continue;
+        }
+        if (ret.command.empty()) {
+            ret.command = token;
+            continue;
+        }
+        auto eq = token.find('=');
+        if (eq == std::string::npos || eq == 0) {
+            throw std::runtime_error("bad argument '" + token + "', expected key=value");
+        }
+        ret.args[token.substr(0, eq)] = token.substr(eq + 1);
+    }
+    if (ret.command.empty()) {
+        throw std::runtime_error("empty request");
+    }
+    return ret;
+}
+
+namespace {
+
+sockaddr_un unix_addr(const std::string& path) {
+    sockaddr_un addr{};
+    addr.sun_family = AF_UNIX;
+    if (path.size() >= sizeof(addr.sun_path)) {
+        errx(EXIT_FAILURE, "socket path too long: %s", path.c_str());
+    }
+    strcpy(addr.sun_path, path.c_str());
+    return addr;
+}
+
+}
+
+int listen_unix(const std::string& path) {
+    auto addr = unix_addr(path);
+    int fd = socket(AF_UNIX, SOCK_STREAM, 0);
+    if (fd < 0) {
+        err(EXIT_FAILURE, "failed to create socket");
+    }
+    unlink(path.c_str());
+    if (bind(fd, (sockaddr*)&addr, sizeof(addr)) || listen(fd, 8)) {
+        err(EXIT_FAILURE, "failed to listen on %s", path.c_str());
+    }
+    return fd;
+}
+
+int connect_unix(const std::string& path) {
+    auto addr = unix_addr(path);
+    int fd = socket(AF_UNIX, SOCK_STREAM, 0);
+    if (fd < 0) {
+        err(EXIT_FAILURE, "failed to create socket");
+    }
+    if (connect(fd, (sockaddr*)&addr, sizeof(addr))) {
+        err(EXIT_FAILURE, "failed to connect to %s", path.c_str());
+    }
+    return fd;
+}
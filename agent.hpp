@@ -0,0 +1,76 @@
+/*
+ * agent.hpp
+ *
+ * The framing, request parsing and socket plumbing for agent mode, where a long-lived avx-turbo
+ * process keeps its calibration and worker threads and runs experiments requested over a unix
+ * domain socket.
+ *
+ * Each frame is a 4-byte big-endian payload length followed by the payload. A request is a single
+ * frame holding a command followed by space separated key=value arguments, e.g.,
+ * "run spec=avx512_fma_t/2 iters=100000". The response is a sequence of frames, each a CSV line whose
+ * first field is the frame type, ending with a "done" or "error" frame.
+ */
+
+#ifndef AGENT_HPP_
+#define AGENT_HPP_
+
+#include <cstdint>
+#include <map>
+#include <string>
+
+/* frames larger than this are rejected as corrupt */
+constexpr uint32_t AGENT_MAX_FRAME = 1u << 20;
+
+/** the frame (length prefix and payload) for the given payload */
+std::string encode_frame(const std::string& payload);
+
+/**
+ * Incrementally splits a byte stream into frames: feed() it whatever was read, then call next()
+ * until it returns false.
+ */
+class frame_decoder {
+    std::string buf;
+
+public:
+    void feed(const char* data, size_t size) { buf.append(data, size); }
+
+    /** if a complete frame is buffered, remove it, store its payload in payload and return true */
+    bool next(std::string& payload);
+
+    /** true if a partial frame is buffered */
+    bool partial() const { return !buf.empty(); }
+};
+
+/** write the frame for payload to fd, returning false on error (e.g., if the peer went away) */
+bool write_frame(int fd, const std::string& payload);
+
+/**
+ * Read one frame from fd, using decoder to hold any bytes read past the end of the frame. Returns false
+ * on EOF or error.
+ */
+bool read_frame(int fd, frame_decoder& decoder, std::string& payload);
+
+struct agent_request {
+    std::string command;
+    std::map<std::string, std::string> args;
+
+    /** the value of the argument key, or def if it wasn't given */
+    std::string get(const std::string& key, const std::string& def = "") const {
+        auto i = args.find(key);
+        return i == args.end() ? def : i->second;
+    }
+};
+
+/** parse a request, throwing std::runtime_error if it is malformed */
+agent_request parse_agent_request(const std::string& request);
+
+/**
+ * Create a unix domain stream socket listening at path, removing any stale socket file first.
+ * Exits with an error message on failure.
+ */
+int listen_unix(const std::string& path);
+
+/** connect to the unix domain socket at path, exiting with an error message on failure */
+int connect_unix(const std::string& path);
+
+#endif /* AGENT_HPP_ */
@@ -36,6 +36,107 @@ ret
 ; pause
 test_func pause_only,     {},             {pause}, 1
 
+; WAITPKG instructions, encoded by hand since nasm 2.13 doesn't know about them
+%define tpause_ecx   db 0x66, 0x0F, 0xAE, 0xF1  ; tpause ecx  (deadline in edx:eax)
+%define umwait_ecx   db 0xF2, 0x0F, 0xAE, 0xF1  ; umwait ecx  (deadline in edx:eax)
+%define umonitor_rax db 0xF3, 0x0F, 0xAE, 0xF0  ; umonitor rax
+
+; tpause with an already expired deadline (zero), so this measures the fixed cost
+; of the instruction itself
+; %1 - function name
+; %2 - control value: 0 to request C0.2, 1 to request C0.1
+%macro test_func_tpause 2
+define_func %1
+xor eax, eax
+xor edx, edx
+mov ecx, %2
+.top:
+times 100 tpause_ecx
+sub rdi, 100
+jnz .top
+ret
+%endmacro
+
+; umonitor + umwait pair with an expired deadline, monitoring a stack location
+; %1 - function name
+; %2 - control value: 0 to request C0.2, 1 to request C0.1
+%macro test_func_umwait 2
+define_func %1
+mov ecx, %2
+lea r8, [rsp - 64]
+.top:
+%rep 100
+mov rax, r8
+umonitor_rax
+xor eax, eax
+xor edx, edx
+umwait_ecx
+%endrep
+sub rdi, 100
+jnz .top
+ret
+%endmacro
+
+test_func_tpause tpause_c01, 1
+test_func_tpause tpause_c02, 0
+test_func_umwait umwait_c01, 1
+test_func_umwait umwait_c02, 0
+
+; spin-wait helpers for the waker/waiter benchmark: each returns once the qword
+; at [rdi] no longer equals rsi, using a different waiting primitive in the loop
+; rdi - address to watch
+; rsi - the old value
+; edx - control value for tpause/umwait (0 = C0.2, 1 = C0.1), ignored otherwise
+; rcx - tpause/umwait deadline, in TSC ticks from the start of each wait, ignored otherwise
+define_func spin_wait_none
+.top:
+cmp [rdi], rsi
+je .top
+ret
+
+define_func spin_wait_pause
+.top:
+pause
+cmp [rdi], rsi
+je .top
+ret
+
+; put the TSC value plus r8 into edx:eax, as needed for the deadline in tpause and umwait
+%macro deadline_r8 0
+rdtsc
+shl rdx, 32
+or  rax, rdx
+add rax, r8
+mov rdx, rax
+shr rdx, 32
+%endmacro
+
+define_func spin_wait_tpause
+mov r8, rcx
+mov ecx, edx
+.top:
+cmp [rdi], rsi
+jne .done
+deadline_r8
+tpause_ecx
+jmp .top
+.done:
+ret
+
+define_func spin_wait_umwait
+mov r8, rcx
+mov ecx, edx
+.top:
+mov rax, rdi
+umonitor_rax
+cmp [rdi], rsi
+jne .done
+deadline_r8
+umwait_ecx
+jmp .top
+.done:
+ret
+
 ; sha256 xor
 test_func avx128_xor,     {pxor xmm0, xmm0}, {pxor xmm0, xmm0}
 test_func avx256_xor,     {vpxor ymm0, ymm0}, {vpxor ymm0, ymm0}
@@ -75,6 +176,87 @@ test_func avx512_imul_t,  {vpcmpeqd ymm0, ymm0, ymm0}, {vpmuldq zmm0, zmm1, zmm1
 
 ; iadd latency
 test_func scalar_iadd,    {xor eax, eax}, {add rax, rax}
+
+; scalar heavy ops latency
+test_func scalar_imul,    {mov eax, 1}, {imul rax, rax}
+test_func scalar_popcnt,  {mov eax, 1}, {popcnt rax, rax}
+test_func scalar_crc32,   {mov eax, 1}, {crc32 rax, rax}
+test_func scalar_pdep,    {mov rcx, -1}, {pdep rax, rax, rcx}
+test_func scalar_pext,    {mov rcx, -1}, {pext rax, rax, rcx}
+test_func scalar_mulx,    {mov ecx, 3}, {mulx rdx, rax, rcx}
+test_func scalar_adcx,    {mov ecx, 3}, {adcx rax, rcx}
+test_func scalar_adox,    {mov ecx, 3}, {adox rax, rcx}
+
+; like test_func, but the destination register rotates through r8-r11, giving four
+; independent chains, so this measures throughput as long as the latency is <= 4
+; %1 - function name
+; %2 - init instruction
+; %3 - instruction mnemonic
+; %4 - the operands after the destination
+%macro test_func_gp_tput 4
+define_func %1
+%2
+.top:
+%rep 25
+%3 r8,  %4
+%3 r9,  %4
+%3 r10, %4
+%3 r11, %4
+%endrep
+sub rdi, 100
+jnz .top
+ret
+%endmacro
+
+; scalar heavy ops throughput
+test_func_gp_tput scalar_imul_t,   {mov ecx, 3},  imul,   {rcx}
+test_func_gp_tput scalar_popcnt_t, {mov ecx, 3},  popcnt, {rcx}
+test_func_gp_tput scalar_crc32_t,  {mov ecx, 3},  crc32,  {rcx}
+test_func_gp_tput scalar_pdep_t,   {mov rdx, -1}, pdep,   {rcx, rdx}
+test_func_gp_tput scalar_pext_t,   {mov rdx, -1}, pext,   {rcx, rdx}
+test_func_gp_tput scalar_mulx_t,   {mov ecx, 3},  mulx,   {rax, rcx}
+
+; two interleaved carry chains, one through CF (adcx) and one through OF (adox)
+define_func scalar_adcx_adox_t
+mov ecx, 3
+xor eax, eax ; clears CF and OF
+.top:
+%rep 50
+adcx rax, rcx
+adox rdx, rcx
+%endrep
+sub rdi, 100
+jnz .top
+ret
+
+; 64-bit div latency, with a full 64-bit dividend which stays the same (divisor is 1)
+define_func scalar_div64
+mov rax, -1
+mov ecx, 1
+.top:
+%rep 100
+xor edx, edx
+div rcx
+%endrep
+sub rdi, 100
+jnz .top
+ret
+
+; 64-bit div throughput: like test_func_gp_tput, but div always writes rdx:rax, so instead of rotating
+; the destination each div gets a fresh copy of the same dividend, which breaks the dependency chain
+define_func scalar_div64_t
+mov r8, -1
+mov ecx, 1
+.top:
+%rep 100
+mov rax, r8
+xor edx, edx
+div rcx
+%endrep
+sub rdi, 100
+jnz .top
+ret
+
 test_func avx128_iadd,    {vpcmpeqd xmm0, xmm0, xmm0}, {vpaddq  xmm0, xmm0, xmm0}
 test_func avx256_iadd,    {vpcmpeqd ymm0, ymm0, ymm0}, {vpaddq  ymm0, ymm0, ymm0}
 test_func avx512_iadd,    {vpcmpeqd ymm0, ymm0, ymm0}, {vpaddq  zmm0, zmm0, zmm0}
@@ -210,6 +392,197 @@ ud2
 
 
 
+; memcpy and memset strategies, all with the signature:
+; rdi - destination
+; rsi - source (ignored for the memset functions)
+; rdx - size in bytes, a non-zero multiple of 64
+; The non-temporal variants need a 64-byte aligned destination.
+
+define_func copy_rep_movsb
+mov rcx, rdx
+rep movsb
+ret
+
+define_func copy_avx2
+xor eax, eax
+.top:
+vmovdqu ymm0, [rsi + rax]
+vmovdqu ymm1, [rsi + rax + 32]
+vmovdqu [rdi + rax], ymm0
+vmovdqu [rdi + rax + 32], ymm1
+add rax, 64
+cmp rax, rdx
+jb .top
+ret
+
+define_func copy_avx512
+xor eax, eax
+.top:
+vmovdqu64 zmm0, [rsi + rax]
+vmovdqu64 [rdi + rax], zmm0
+add rax, 64
+cmp rax, rdx
+jb .top
+ret
+
+define_func copy_nt_avx2
+xor eax, eax
+.top:
+vmovdqu ymm0, [rsi + rax]
+vmovdqu ymm1, [rsi + rax + 32]
+vmovntdq [rdi + rax], ymm0
+vmovntdq [rdi + rax + 32], ymm1
+add rax, 64
+cmp rax, rdx
+jb .top
+sfence
+ret
+
+define_func copy_nt_avx512
+xor eax, eax
+.top:
+vmovdqu64 zmm0, [rsi + rax]
+vmovntdq [rdi + rax], zmm0
+add rax, 64
+cmp rax, rdx
+jb .top
+sfence
+ret
+
+define_func set_rep_stosb
+mov rcx, rdx
+xor eax, eax
+rep stosb
+ret
+
+define_func set_avx2
+vpxor xmm0, xmm0, xmm0
+xor eax, eax
+.top:
+vmovdqu [rdi + rax], ymm0
+vmovdqu [rdi + rax + 32], ymm0
+add rax, 64
+cmp rax, rdx
+jb .top
+ret
+
+define_func set_avx512
+vpxord zmm0, zmm0, zmm0
+xor eax, eax
+.top:
+vmovdqu64 [rdi + rax], zmm0
+add rax, 64
+cmp rax, rdx
+jb .top
+ret
+
+define_func set_nt_avx512
+vpxord zmm0, zmm0, zmm0
+xor eax, eax
+.top:
+vmovntdq [rdi + rax], zmm0
+add rax, 64
+cmp rax, rdx
+jb .top
+sfence
+ret
+
+; DRAM streaming kernels for the bandwidth noisy-neighbor mode: non-temporal loads or stores over
+; rsi bytes (a multiple of 256) at rdi, at each vector width
+define_func stream_load_128
+xor eax, eax
+.top:
+vmovntdqa xmm0, [rdi + rax]
+vmovntdqa xmm1, [rdi + rax + 16]
+vmovntdqa xmm2, [rdi + rax + 32]
+vmovntdqa xmm3, [rdi + rax + 48]
+add rax, 64
+cmp rax, rsi
+jb .top
+ret
+
+define_func stream_load_256
+xor eax, eax
+.top:
+vmovntdqa ymm0, [rdi + rax]
+vmovntdqa ymm1, [rdi + rax + 32]
+add rax, 64
+cmp rax, rsi
+jb .top
+ret
+
+define_func stream_load_512
+xor eax, eax
+.top:
+vmovntdqa zmm0, [rdi + rax]
+vmovntdqa zmm1, [rdi + rax + 64]
+vmovntdqa zmm2, [rdi + rax + 128]
+vmovntdqa zmm3, [rdi + rax + 192]
+add rax, 256
+cmp rax, rsi
+jb .top
+ret
+
+define_func stream_store_128
+vpxor xmm0, xmm0, xmm0
+xor eax, eax
+.top:
+vmovntdq [rdi + rax], xmm0
+vmovntdq [rdi + rax + 16], xmm0
+vmovntdq [rdi + rax + 32], xmm0
+vmovntdq [rdi + rax + 48], xmm0
+add rax, 64
+cmp rax, rsi
+jb .top
+sfence
+ret
+
+define_func stream_store_256
+vpxor xmm0, xmm0, xmm0
+xor eax, eax
+.top:
+vmovntdq [rdi + rax], ymm0
+vmovntdq [rdi + rax + 32], ymm0
+add rax, 64
+cmp rax, rsi
+jb .top
+sfence
+ret
+
+define_func stream_store_512
+vpxord zmm0, zmm0, zmm0
+xor eax, eax
+.top:
+vmovntdq [rdi + rax], zmm0
+add rax, 64
+cmp rax, rsi
+jb .top
+sfence
+ret
+
+; a burst of %2 serially dependent adds between two lfence-serialized rdtsc, returning the
+; TSC delta in rax, used by the software frequency meter
+%macro freq_burst_func 2
+define_func %1
+lfence
+rdtsc
+shl rdx, 32
+or  rax, rdx
+mov r8, rax
+lfence
+xor ecx, ecx
+times %2 add rcx, rcx
+lfence
+rdtsc
+shl rdx, 32
+or  rax, rdx
+sub rax, r8
+ret
+%endmacro
+
+freq_burst_func freq_burst_256, 256
+freq_burst_func freq_burst_512, 512
+
 GLOBAL zeroupper:function
 zeroupper:
 vzeroupper
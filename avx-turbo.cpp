@@ -2,32 +2,63 @@
  * avx-turbo.cpp
  */
 
+#include "agent.hpp"
 #include "args.hxx"
+#include "bimodal.hpp"
 #include "cpu.h"
+#include "cleanup.hpp"
 #include "cpuid.hpp"
+#include "csv.hpp"
+#include "env-audit.hpp"
+#include "freq-model.hpp"
 #include "msr-access.h"
+#include "noise.hpp"
+#include "perf-attach.hpp"
+#include "phases.hpp"
+#include "prefetch.hpp"
+#include "resctrl.hpp"
+#include "roofline.hpp"
+#include "rt-isolation.hpp"
+#include "run-test.hpp"
 #include "stats.hpp"
 #include "tsc-support.hpp"
 #include "table.hpp"
+#include "topology.hpp"
+#include "vcore.hpp"
 #include "util.hpp"
 
 #include <array>
 #include <atomic>
 #include <deque>
 #include <cassert>
+#include <cerrno>
 #include <cstdlib>
 #include <chrono>
 #include <cinttypes>
+#include <cmath>
+#include <condition_variable>
+#include <cstring>
 #include <exception>
+#include <fstream>
 #include <limits>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <numeric>
 #include <set>
 #include <functional>
+#include <iostream>
 #include <thread>
 #include <vector>
 
 #include <error.h>
 #include <err.h>
+#include <linux/futex.h>
 #include <sched.h>
+#include <sys/eventfd.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <sys/syscall.h>
 #include <sys/types.h>
 #include <sys/sysinfo.h>
 #include <unistd.h>
@@ -41,12 +72,15 @@ using namespace std::chrono;
 
 using namespace Stats;
 
-typedef void (cal_f)(uint64_t iters);
-
 enum ISA {
-    BASE   = 1,
-    AVX2   = 2,
-    AVX512 = 4
+    BASE    = 1,
+    AVX2    = 2,
+    AVX512  = 4,
+    WAITPKG = 8,
+    BMI2    = 16,
+    ADX     = 32,
+    POPCNT  = 64,
+    SSE42   = 128,
 };
 
 struct test_func {
@@ -60,6 +94,10 @@ struct test_func {
 
 #define FUNCS_X(x) \
     x(pause_only          , "pause instruction"              , BASE)   \
+    x(tpause_c01          , "tpause C0.1 (expired deadline)" , WAITPKG)\
+    x(tpause_c02          , "tpause C0.2 (expired deadline)" , WAITPKG)\
+    x(umwait_c01          , "umonitor+umwait C0.1 (expired)" , WAITPKG)\
+    x(umwait_c02          , "umonitor+umwait C0.2 (expired)" , WAITPKG)\
     /* sha256 */ \
     x(avx128_shr_epi32,  "shr", AVX2) \
     x(avx256_shr_epi32,  "shr", AVX2) \
@@ -82,6 +120,26 @@ struct test_func {
                                                                        \
     /* iadd */                                                         \
     x(scalar_iadd         , "Scalar integer adds"            , BASE)   \
+                                                                       \
+    /* scalar heavy ops, which shouldn't need any license */           \
+    x(scalar_imul         , "Scalar 64-bit imul latency"     , BASE)   \
+    x(scalar_imul_t       , "Scalar 64-bit imul throughput"  , BASE)   \
+    x(scalar_popcnt       , "Scalar popcnt latency"          , POPCNT) \
+    x(scalar_popcnt_t     , "Scalar popcnt throughput"       , POPCNT) \
+    x(scalar_crc32        , "Scalar crc32 latency"           , SSE42)  \
+    x(scalar_crc32_t      , "Scalar crc32 throughput"        , SSE42)  \
+    x(scalar_pdep         , "Scalar pdep latency"            , BMI2)   \
+    x(scalar_pdep_t       , "Scalar pdep throughput"         , BMI2)   \
+    x(scalar_pext         , "Scalar pext latency"            , BMI2)   \
+    x(scalar_pext_t       , "Scalar pext throughput"         , BMI2)   \
+    x(scalar_mulx         , "Scalar mulx latency"            , BMI2)   \
+    x(scalar_mulx_t       , "Scalar mulx throughput"         , BMI2)   \
+    x(scalar_adcx         , "Scalar adcx latency"            , ADX)    \
+    x(scalar_adox         , "Scalar adox latency"            , ADX)    \
+    x(scalar_adcx_adox_t  , "Scalar adcx+adox dual chains"   , ADX)    \
+    x(scalar_div64        , "Scalar 64-bit div latency"      , BASE)   \
+    x(scalar_div64_t      , "Scalar 64-bit div throughput"   , BASE)   \
+                                                                       \
     x(avx128_iadd         , "128-bit integer serial adds"    , AVX2  ) \
     x(avx256_iadd         , "256-bit integer serial adds"    , AVX2  ) \
     x(avx512_iadd         , "512-bit integer adds"           , AVX512) \
@@ -140,6 +198,38 @@ FUNCS_X(DECLARE);
 // misc helpers
 void zeroupper();
 
+// spin-wait helpers, return once *addr != old
+typedef void (wait_f)(volatile uint64_t* addr, uint64_t old, uint32_t ctrl, uint64_t ticks);
+wait_f spin_wait_none;
+wait_f spin_wait_pause;
+wait_f spin_wait_tpause;
+wait_f spin_wait_umwait;
+
+// memcpy and memset strategies
+typedef void (mem_f)(void* dst, const void* src, size_t bytes);
+mem_f copy_rep_movsb;
+mem_f copy_avx2;
+mem_f copy_avx512;
+mem_f copy_nt_avx2;
+mem_f copy_nt_avx512;
+mem_f set_rep_stosb;
+mem_f set_avx2;
+mem_f set_avx512;
+mem_f set_nt_avx512;
+
+// DRAM streaming kernels for the bandwidth noisy-neighbor mode
+typedef void (stream_f)(void* buf, size_t bytes);
+stream_f stream_load_128;
+stream_f stream_load_256;
+stream_f stream_load_512;
+stream_f stream_store_128;
+stream_f stream_store_256;
+stream_f stream_store_512;
+
+// software frequency meter bursts, return the TSC ticks taken by 256 or 512 dependent adds
+uint64_t freq_burst_256();
+uint64_t freq_burst_512();
+
 }
 
 #define MAKE_STRUCT(f, d, i) { f, #f, d, i },
@@ -148,11 +238,8 @@ FUNCS_X(MAKE_STRUCT)
 };
 
 void pin_to_cpu(int cpu) {
-    cpu_set_t cpuset;
-    CPU_ZERO(&cpuset);
-    CPU_SET(cpu, &cpuset);
-    if (sched_setaffinity(0, sizeof(cpuset), &cpuset) == -1) {
-        error(EXIT_FAILURE, errno, "could not pin to CPU %d", cpu);
+    if (int e = set_cpu_affinity(cpu)) {
+        error(EXIT_FAILURE, e, "could not pin to CPU %d", cpu);
     }
 }
 
@@ -174,6 +261,127 @@ args::ValueFlag<size_t> arg_iters{parser, "ITERS", "Run the test loop ITERS time
 args::ValueFlag<int> arg_min_threads{parser, "MIN", "The minimum number of threads to use", {"min-threads"}, 1};
 args::ValueFlag<int> arg_max_threads{parser, "MAX", "The maximum number of threads to use", {"max-threads"}};
 args::ValueFlag<uint64_t> arg_warm_ms{parser, "MILLISECONDS", "Warmup milliseconds for each thread after pinning (default 100)", {"warmup-ms"}, 100};
+args::Flag arg_spin_wait{parser, "spin-wait", "Run the waker/waiter benchmark for the spin-wait primitives (pause, tpause, umwait) instead of "
+    "the usual tests", {"spin-wait"}};
+args::ValueFlag<std::string> arg_spin_loads{parser, "TEST-IDS", "Comma separated list of tests to run on the neighbor cores during the "
+    "spin-wait benchmark, 'none' means idle (default none,scalar_iadd,avx256_fma_t,avx512_fma_t)", {"spin-loads"}};
+args::ValueFlag<size_t> arg_spin_rounds{parser, "ROUNDS", "Number of wakeups per primitive in the spin-wait benchmark (default 1000)",
+    {"spin-rounds"}, 1000};
+args::ValueFlag<uint64_t> arg_spin_gap_us{parser, "MICROS", "Microseconds the waker waits before each wakeup in the spin-wait benchmark "
+    "(default 20)", {"spin-gap-us"}, 20};
+args::Flag arg_c2c{parser, "c2c-matrix", "Measure the core-to-core cache line round trip latency for every pair of cores, both with the "
+    "other cores idle and running the --c2c-load test", {"c2c-matrix"}};
+args::ValueFlag<std::string> arg_c2c_load{parser, "TEST-ID", "The test to run on the remaining cores for the loaded core-to-core matrix "
+    "(default avx512_fma_t, or avx256_fma_t without AVX-512)", {"c2c-load"}};
+args::ValueFlag<size_t> arg_c2c_rounds{parser, "ROUNDS", "Number of round trips for each core pair in the core-to-core matrix "
+    "(default 1000)", {"c2c-rounds"}, 1000};
+args::Flag arg_wake{parser, "wake-latency", "Measure futex and eventfd wake-to-run latency of a thread parked after running each of "
+    "the --wake-kernels tests", {"wake-latency"}};
+args::ValueFlag<std::string> arg_wake_kernels{parser, "TEST-IDS", "Comma separated list of tests the parked thread runs before each "
+    "wakeup, 'none' means it parks right away (default none,scalar_iadd,avx256_fma_t,avx512_fma_t)", {"wake-kernels"}};
+args::ValueFlag<uint64_t> arg_wake_kernel_ms{parser, "MILLISECONDS", "How long the parked thread runs the kernel before parking "
+    "(default 5)", {"wake-kernel-ms"}, 5};
+args::ValueFlag<std::string> arg_wake_gaps{parser, "MICROS", "Comma separated list of idle gaps in microseconds between parking and "
+    "the wakeup (default 0,100,1000,10000)", {"wake-gaps-us"}, "0,100,1000,10000"};
+args::ValueFlag<size_t> arg_wake_rounds{parser, "ROUNDS", "Number of wakeups for each kernel, gap and mechanism (default 100)",
+    {"wake-rounds"}, 100};
+args::Flag arg_mem{parser, "memcpy-bench", "Compare memcpy and memset strategies (rep movsb/stosb, AVX2, AVX-512, non-temporal) across "
+    "sizes and thread counts", {"memcpy-bench"}};
+args::ValueFlag<int64_t> arg_noise_budget{parser, "EVENTS", "Re-run any spec where a thread sees more than EVENTS interrupts, "
+    "context switches and SMIs in total during its timed region, and flag it if it's still too noisy", {"noise-budget"}};
+args::ValueFlag<size_t> arg_noise_retries{parser, "COUNT", "Maximum number of re-runs of a spec which exceeds the noise budget "
+    "(default 2)", {"noise-retries"}, 2};
+args::ValueFlag<size_t> arg_ref_every{parser, "SPECS", "Re-run a reference probe (1-thread scalar_iadd) before the first spec "
+    "and after every SPECS specs, to track drift over a long sweep", {"ref-probe"}};
+args::Flag arg_ref_normalize{parser, "ref-normalize", "With --ref-probe, divide each result's Mops by the drift of the latest "
+    "probe relative to the first", {"ref-normalize"}};
+args::ValueFlag<std::string> arg_output{parser, "FILE", "Also write the results, one CSV row per thread, to FILE, along with "
+    "the environment audit", {"output"}};
+args::ValueFlag<unsigned> arg_audit_ms{parser, "MILLISECONDS", "How long to sample the background load on the selected CPUs "
+    "in the environment audit, 0 to skip it (default 100)", {"audit-ms"}, 100};
+args::Flag arg_mitigate{parser, "mitigate", "Set the performance governor and enable turbo on the selected CPUs for the duration "
+    "of the run (needs root), restoring the original settings on exit", {"mitigate"}};
+args::Flag arg_fmeter{parser, "freq-meter", "Trace the frequency of the first CPU with the software frequency meter, which "
+    "needs no MSR access", {"freq-meter"}};
+args::ValueFlag<uint64_t> arg_fmeter_ms{parser, "MILLISECONDS", "Duration of the frequency meter trace (default 100)", {"freq-meter-ms"}, 100};
+args::ValueFlag<uint64_t> arg_fmeter_us{parser, "MICROS", "Interval between frequency meter samples (default 10)", {"freq-meter-us"}, 10};
+args::ValueFlag<std::string> arg_fmeter_kernel{parser, "TEST-ID", "Test to interleave with the frequency meter samples on the measured "
+    "core, by default the meter core just spins between samples (i.e., acts as a probe core)", {"freq-meter-kernel"}};
+args::ValueFlag<std::string> arg_fmeter_load{parser, "TEST-ID", "Test to start on the other CPUs a quarter of the way into the "
+    "frequency meter trace", {"freq-meter-load"}};
+args::ValueFlag<std::string> arg_fmeter_trace{parser, "FILE", "Write the frequency meter trace to FILE as CSV", {"freq-trace"}};
+args::ValueFlag<std::string> arg_phases{parser, "FILE", "Split the frequency trace in FILE (as written by --freq-trace) into "
+    "steady, downclock, halt, relaxation and drift phases (traces over 10000 samples per cpu are searched for phase "
+    "changes in block averages)", {"phases"}};
+args::ValueFlag<double> arg_phase_penalty{parser, "SCALE", "Scale the change-point penalty for phase detection: higher gives "
+    "fewer, longer phases (default 1)", {"phase-penalty"}, 1.0};
+args::Flag arg_pkg_parallel{parser, "parallel-packages", "Run independent specs concurrently, one per package, on the packages "
+    "which don't interfere with each other", {"parallel-packages"}};
+args::ValueFlag<double> arg_pkg_threshold{parser, "PERCENT", "Packages are considered independent if loading one changes the "
+    "throughput of the other by less than PERCENT (default 2)", {"package-threshold"}, 2.0};
+args::ValueFlag<size_t> arg_pkg_control{parser, "N", "With --parallel-packages, re-run every Nth spec serially as a control sample "
+    "(default 10)", {"package-control"}, 10};
+args::ValueFlag<std::string> arg_agent{parser, "SOCKET", "Run as a long-lived agent, accepting experiment requests on the unix "
+    "domain socket SOCKET", {"agent"}};
+args::ValueFlag<std::string> arg_agent_client{parser, "SOCKET", "Send requests to the agent listening on SOCKET and print the "
+    "responses", {"agent-client"}};
+args::ValueFlagList<std::string> arg_agent_request{parser, "REQUEST", "A request for --agent-client, e.g., \"run spec=avx512_fma_t/2\" "
+    "(may be repeated, default: one request per line of stdin)", {"agent-request"}};
+args::ValueFlag<std::string> arg_model_fit{parser, "RESULTS", "Fit a frequency model to the result file RESULTS (written with "
+    "--output) and report its residuals", {"fit-model"}};
+args::ValueFlag<std::string> arg_model_out{parser, "FILE", "Write the fitted frequency model lookup table to FILE", {"model-out"}};
+args::ValueFlag<std::string> arg_model_in{parser, "FILE", "Read the frequency model from FILE, as written by --model-out", {"model-in"}};
+args::ValueFlag<std::string> arg_predict{parser, "N512,N256,NSCALAR", "Predict the frequency of each license class with the given "
+    "number of active AVX-512, AVX2 and scalar cores, using the fitted or loaded model", {"predict"}};
+args::Flag arg_breakeven{parser, "breakeven", "Using the fitted or loaded frequency model, compute the net throughput of "
+    "AVX2 and AVX-512 versions of a workload relative to scalar, and the break-even vector fraction", {"breakeven"}};
+args::ValueFlag<double> arg_be_speedup2{parser, "SPEEDUP", "Speedup of the AVX2 version of the vectorized portion at equal "
+    "frequency (default 2)", {"speedup-avx2"}, 2.0};
+args::ValueFlag<double> arg_be_speedup5{parser, "SPEEDUP", "Speedup of the AVX-512 version of the vectorized portion at equal "
+    "frequency (default 4)", {"speedup-avx512"}, 4.0};
+args::ValueFlag<double> arg_be_fraction{parser, "FRACTION", "Fraction of the scalar runtime which is vectorizable (default 0.5)",
+    {"vector-fraction"}, 0.5};
+args::ValueFlag<double> arg_be_transitions{parser, "RATE", "License transitions per second in the vectorized versions (default 0)",
+    {"transitions-per-sec"}, 0.0};
+args::ValueFlag<double> arg_be_halt_us{parser, "MICROSECONDS", "Halt time per license transition (default 10)", {"transition-us"}, 10.0};
+args::ValueFlag<pid_t> arg_attach{parser, "PID", "Measure the frequency and license residency of the existing threads of process PID "
+    "with perf counters, without running any tests", {"attach"}};
+args::ValueFlag<std::string> arg_attach_cgroup{parser, "PATH", "Like --attach, but measure everything in the cgroup at PATH "
+    "(e.g., /sys/fs/cgroup/myservice), per CPU", {"cgroup"}};
+args::ValueFlag<uint64_t> arg_attach_ms{parser, "MILLISECONDS", "How long to measure with --attach or --cgroup (default 1000)",
+    {"attach-ms"}, 1000};
+args::Flag arg_bw{parser, "bw-neighbor", "Run DRAM streaming kernels on some cores and a compute kernel on the rest, reporting "
+    "bandwidth and frequency with and without the other side running", {"bw-neighbor"}};
+args::ValueFlag<size_t> arg_bw_cores{parser, "N", "Number of cores running the streaming kernels in --bw-neighbor (default half)", {"bw-cores"}};
+args::ValueFlag<std::string> arg_bw_compute{parser, "TEST-ID", "Compute kernel for the other cores in --bw-neighbor (default the widest "
+    "FMA test supported)", {"bw-compute"}};
+args::ValueFlag<size_t> arg_bw_buffer_mb{parser, "MIB", "Buffer size per streaming core in --bw-neighbor (default the larger of the "
+    "L3 size and 4x the L3 size divided by the number of streaming cores)", {"bw-buffer-mb"}};
+args::ValueFlag<int> arg_rt_priority{parser, "PRIORITY", "Real-time isolation: run the test threads SCHED_FIFO at PRIORITY with "
+    "memory locked and stacks prefaulted, and the coordinator on a housekeeping CPU outside the test set (needs root)", {"rt-priority"}};
+args::ValueFlag<int> arg_housekeeping{parser, "CPU", "The housekeeping CPU for --rt-priority (default the first available CPU not "
+    "on a core used by the tests)", {"housekeeping-cpu"}};
+args::ValueFlag<uint64_t> arg_rt_watchdog_ms{parser, "MILLISECONDS", "With --rt-priority, demote any test thread which stays "
+    "real-time for longer than this (default 10000)", {"rt-watchdog-ms"}, 10000};
+args::Flag arg_roofline{parser, "roofline", "Measure the peak FMA throughput at each vector width and the load bandwidth "
+    "from each cache level and DRAM at every active core count, and print the resulting rooflines", {"roofline"}};
+args::ValueFlag<std::string> arg_roofline_svg{parser, "PATH", "Where --roofline writes its SVG plot (default roofline.svg)",
+    {"roofline-svg"}, "roofline.svg"};
+args::ValueFlag<uint64_t> arg_roofline_ms{parser, "MILLISECONDS", "How long --roofline measures each bandwidth (default 200)",
+    {"roofline-ms"}, 200};
+args::Flag arg_prefetch{parser, "prefetch-sweep", "Run the selected tests with each combination of the L2 streamer, L2 "
+    "adjacent-line and DCU prefetchers disabled through MSR 0x1A4, restoring the original setting afterwards (needs root)",
+    {"prefetch-sweep"}};
+args::ValueFlagList<std::string> arg_resctrl{parser, "ALLOC", "Run the selected tests in the default resctrl group and then "
+    "in a temporary group with each given allocation, e.g., l3=0xf,mb=50 for four L3 ways and 50% memory bandwidth (needs root)",
+    {"resctrl"}};
+args::ValueFlag<std::string> arg_resctrl_root{parser, "PATH", "Where resctrl is mounted (default " RESCTRL_ROOT ")",
+    {"resctrl-root"}, RESCTRL_ROOT};
+args::Flag arg_per_thread{parser, "per-thread", "Show every thread's Mops, frequency and noise counts in the results "
+    "table, instead of the aggregate columns", {"per-thread"}};
+args::ValueFlag<size_t> arg_mem_min{parser, "BYTES", "Smallest size for the memcpy benchmark (default 64)", {"memcpy-min-size"}, 64};
+args::ValueFlag<size_t> arg_mem_max{parser, "BYTES", "Largest size for the memcpy benchmark (default 64 MiB)", {"memcpy-max-size"},
+    64 * 1024 * 1024};
 
 
 bool verbose;
@@ -217,17 +425,6 @@ struct RdtscClock {
 
 };
 
-/**
- * We pass an outer_clock to run_test which times outside the iteration of the innermost loop (i.e.,
- * it times around the loop that runs TRIES times), start should reset the state unless you want to
- * time warmup iterations.
- */
-struct outer_timer {
-    virtual void start() = 0;
-    virtual void stop() = 0;
-    virtual ~outer_timer() {}
-};
-
 struct dummy_outer : outer_timer {
     static dummy_outer dummy;
     virtual void start() override {};
@@ -238,6 +435,8 @@ dummy_outer dummy_outer::dummy{};
 /** lets you determine the actual frequency over any interval using the free-running APERF and MPERF counters */
 struct aperf_ghz : outer_timer {
     uint64_t mperf_value, aperf_value, tsc_value;
+    // the IA32_PERF_STATUS voltage sampled at start and stop
+    double vcore_start = std::numeric_limits<double>::quiet_NaN(), vcore_stop = std::numeric_limits<double>::quiet_NaN();
     enum {
         STARTED, STOPPED
     } state;
@@ -271,6 +470,7 @@ struct aperf_ghz : outer_timer {
     virtual void start() override {
         assert(state == STOPPED);
         state = STARTED;
+        vcore_start = read_vcore(); // before the counters, like stop() reads it after them, to keep it out of the window
         mperf_value = mperf();
         aperf_value = aperf();
         tsc_value = rdtsc();
@@ -283,6 +483,7 @@ struct aperf_ghz : outer_timer {
         mperf_value = mperf() - mperf_value;
         aperf_value = aperf() - aperf_value;
         tsc_value   = rdtsc() - tsc_value;
+        vcore_stop  = read_vcore();
         state = STOPPED;
 //        printf("stopped timer m: %lu (delta)\n", mperf_value);
 //        printf("stopped timer a: %lu (delta)\n", aperf_value);
@@ -306,95 +507,72 @@ struct aperf_ghz : outer_timer {
         return (double)mperf_value / tsc_value;
     }
 
+    /** the mean of the voltages sampled at start and stop, or NaN if the part doesn't report it */
+    double vcore() {
+        assert(state == STOPPED);
+        return (vcore_start + vcore_stop) / 2;
+    }
 
 };
 
-/*
- * The result of the run_test method, with only the stuff
- * that can be calculated from within that method.
- */
-struct inner_result {
-    /* calculated Mops value */
-    double mops;
-    uint64_t ostart_ts, oend_ts;
-    uint64_t istart_ts, iend_ts; // start and end timestamps for the "critical" benchmark portion
-};
-
-/*
- * Calculate the frequency of the CPU based on timing a tight loop that we expect to
- * take one iteration per cycle.
- *
- * ITERS is the base number of iterations to use: the calibration routine is actually
- * run twice, once with ITERS iterations and once with 2*ITERS, and a delta is used to
- * remove measurement overhead.
+/**
+ * Like aperf_ghz, but using perf counters on other threads (or a cgroup) rather than the APERF and MPERF
+ * MSRs of the current cpu: cycles and ref-cycles stand in for APERF and MPERF.
  */
-struct hot_barrier {
-    size_t break_count;
-    std::atomic<size_t> current;
-    hot_barrier(size_t count) : break_count(count), current{0} {}
+struct perf_timer : outer_timer {
+    perf_counters counters;
+    perf_values values;
+    uint64_t tsc_value = 0;
 
-    /* increment the arrived count of the barrier (do this once per thread generally) */
-    void increment() {
-        current++;
+    perf_timer(perf_counters&& counters) : counters(std::move(counters)) {
+        values.fill(std::numeric_limits<double>::quiet_NaN());
     }
 
-    /* return true if all the threads have arrived, never blocks */
-    bool is_broken() {
-        return current.load() == break_count;
+    virtual void start() override {
+        counters.start();
+        tsc_value = rdtsc();
     }
 
-    /* increment and hot spin on the waiter count until it hits the break point, returns the spin count in case you care */
-    long wait() {
-        increment();
-        long count = 0;
-        while (!is_broken()) {
-            count++;
-        }
-        return count;
+    virtual void stop() override {
+        counters.stop();
+        tsc_value = rdtsc() - tsc_value;
+        values = counters.read();
     }
-};
-
-template <typename CLOCK, size_t TRIES = 101, size_t WARMUP = 3>
-inner_result run_test(cal_f* func, size_t iters, outer_timer& outer, hot_barrier *barrier) {
-    assert(iters % 100 == 0);
 
-    std::array<typename CLOCK::delta_t, TRIES> results;
-
-    inner_result result;
-
-    result.ostart_ts = RdtscClock::now();
-    for (size_t w = 0; w < WARMUP + 1; w++) {
-        result.istart_ts = RdtscClock::now();
-        outer.start();
-        for (size_t r = 0; r < TRIES; r++) {
-            auto t0 = CLOCK::now();
-            func(iters);
-            auto t1 = CLOCK::now();
-            func(iters * 2);
-            auto t2 = CLOCK::now();
-            results[r] = (t2 - t1) - (t1 - t0);
-        }
-        outer.stop();
-        result.iend_ts = RdtscClock::now();
+    /** cycles / ref-cycles: the equivalent of the APERF/MPERF ratio */
+    double am_ratio() const {
+        return values[PERF_CYCLES] / values[PERF_REF_CYCLES];
     }
 
-    for (barrier->increment(); !barrier->is_broken();) {
-        func(iters);
+    /** ref-cycles / tsc, the equivalent of the MPERF/TSC ratio (summed over cpus for a cgroup) */
+    double mt_ratio() const {
+        return values[PERF_REF_CYCLES] / tsc_value;
     }
-    result.oend_ts = RdtscClock::now();
 
-    std::array<uint64_t, TRIES> nanos = {};
-    std::transform(results.begin(), results.end(), nanos.begin(), CLOCK::to_nanos);
-    DescriptiveStats stats = get_stats(nanos.begin(), nanos.end());
+    /** the fraction of the interval the target was running, from the task clock */
+    double utilization() const {
+        return values[PERF_TASK_CLOCK] / RdtscClock::to_nanos(tsc_value);
+    }
 
-    result.mops = ((double)iters / stats.getMedian());
-    return result;
-}
+    /** the fraction of the licensed cycles spent at the given license level */
+    double license_residency(int level) const {
+        double total = values[PERF_LICENSE0] + values[PERF_LICENSE1] + values[PERF_LICENSE2];
+        return values[PERF_LICENSE0 + level] / total;
+    }
+};
 
 ISA get_isas() {
     int ret = BASE;
     ret |= psnip_cpu_feature_check(PSNIP_CPU_FEATURE_X86_AVX2   ) ? AVX2   : 0;
     ret |= psnip_cpu_feature_check(PSNIP_CPU_FEATURE_X86_AVX512F) ? AVX512 : 0;
+    ret |= psnip_cpu_feature_check(PSNIP_CPU_FEATURE_X86_BMI2   ) ? BMI2   : 0;
+    ret |= psnip_cpu_feature_check(PSNIP_CPU_FEATURE_X86_ADX    ) ? ADX    : 0;
+    ret |= psnip_cpu_feature_check(PSNIP_CPU_FEATURE_X86_POPCNT ) ? POPCNT : 0;
+    ret |= psnip_cpu_feature_check(PSNIP_CPU_FEATURE_X86_SSE4_2 ) ? SSE42  : 0;
+    // psnip doesn't know about WAITPKG: CPUID.(EAX=07H, ECX=0H):ECX.WAITPKG[bit 5]
+    if (cpuid_highest_leaf() >= 7) {
+        ret |= get_bits(cpuid(7, 0).ecx, 5, 5) ? WAITPKG : 0;
+    }
     return (ISA)ret;
 }
 
@@ -473,10 +651,8 @@ const test_func *find_one_test(const std::string id) {
     return nullptr;
 }
 
-std::vector<test_spec> make_from_spec(ISA, std::vector<int> cpus) {
-    std::string str = arg_spec.Get();
-    if (verbose) printf("Making tests from spec string: %s\n", str.c_str());
-
+/* parse a spec string like "avx512_fma_t/2,scalar_iadd", throwing std::runtime_error if it is invalid */
+test_spec parse_spec(const std::string& str) {
     test_spec spec{str, "<multiple descriptions>"};
     for (auto& elem : split(str,",")) {
         if (verbose) printf("Elem: %s\n", elem.c_str());
@@ -493,6 +669,14 @@ std::vector<test_spec> make_from_spec(ISA, std::vector<int> cpus) {
 
         spec.thread_funcs.insert(spec.thread_funcs.end(), count, *test);
     }
+    return spec;
+}
+
+std::vector<test_spec> make_from_spec(ISA, std::vector<int> cpus) {
+    std::string str = arg_spec.Get();
+    if (verbose) printf("Making tests from spec string: %s\n", str.c_str());
+
+    test_spec spec = parse_spec(str);
 
     if (spec.count() > cpus.size()) {
         printf("ERROR: this spec requires %d CPUs but only %d are available.\n", (int)spec.count(), (int)cpus.size());
@@ -520,11 +704,31 @@ struct result {
     /* optional stuff associated with outer_timer */
     double    aperf_am = nan;
     double    aperf_mt = nan;
+    double    vcore    = nan; // volts
+
+    /* a two-mode fit of the per-try Mops, to spot flapping between frequencies */
+    bimodal_fit modes;
+
+    /* interrupts, context switches and SMIs around the timed region */
+    noise_counts noise;
 };
 
 struct result_holder {
     const test_spec* spec;
     std::vector<result> results; // will have spec.count() elements
+    size_t reruns = 0;           // number of times the spec was re-run because it was too noisy
+    bool noisy = false;          // true if the final run was still over the noise budget
+    double ref_drift = std::numeric_limits<double>::quiet_NaN(); // latest reference probe relative to the first
+
+    /** true if any thread saw more noise events than the budget */
+    bool over_budget(int64_t budget) const {
+        for (auto& r : results) {
+            if (r.noise.total() > budget) {
+                return true;
+            }
+        }
+        return false;
+    }
 
     result_holder(const test_spec* spec) : spec(spec) {}
 
@@ -562,12 +766,77 @@ struct warmup {
     }
 };
 
+/* the watchdog for real-time isolation, or null if it isn't enabled */
+rt_watchdog* watchdog = nullptr;
+
+/* the resctrl group the test threads join, or null to leave them where they are */
+resctrl_group* resctrl_target = nullptr;
+
+/**
+ * The body of one thread of a spec, on an already pinned thread: warm up, wait for the other threads
+ * at start_barrier, then run the test, with its samples in slot id of arena.
+ */
+result run_one_thread(size_t id, result_arena& arena, hot_barrier& start_barrier, hot_barrier& stop_barrier, const test_func* test,
+        size_t iters, bool use_aperf, uint64_t warm_ms) {
+    work_scope working; // so a signal's cleanups (e.g., removing the resctrl group) wait for this thread
+    rt_thread_scope rt{watchdog, arg_rt_priority.Get()};
+    if (!rt.ok()) {
+        static std::atomic<bool> warned{false};
+        if (!warned.exchange(true)) {
+            printf("WARNING: couldn't make the test threads SCHED_FIFO: %s\n", strerror(rt.err()));
+        }
+    }
+    if (resctrl_target) {
+        if (int e = resctrl_target->add_task(current_tid())) {
+            printf("ERROR: couldn't move the test thread to %s: %s\n", resctrl_target->path().c_str(), strerror(e));
+            exit(EXIT_FAILURE);
+        }
+    }
+    result res;
+    auto slot = arena.prepare(id);
+    aperf_ghz aperf_timer;
+    outer_timer& outer = use_aperf ? static_cast<outer_timer&>(aperf_timer) : dummy_outer::dummy;
+    warmup w{warm_ms};
+    long warms = w.warm();
+    if (verbose) printf("[%2lu] Warmup iters %lu\n", id, warms);
+    int cpu = sched_getcpu();
+    // the snapshot does I/O which takes a different time on each thread, so it stays out of the synchronized
+    // start: the counts include the (spinning) wait at the barrier
+    auto noise_before = noise_counts::snapshot(cpu);
+    if (!arg_nobarrier) {
+        long count = start_barrier.wait();
+        if (verbose) printf("[%2lu] Thread loop count: %ld\n", id, count);
+    }
+    res.start_ts = RdtscClock::now();
+    run_test<RdtscClock>(test->func, iters, outer, &stop_barrier, slot);
+    res.end_ts = RdtscClock::now();
+    res.noise = noise_counts::snapshot(cpu) - noise_before;
+    res.inner = *slot.result;
+    std::array<double, RUN_TEST_TRIES> try_mops;
+    size_t tries = 0;
+    for (size_t i = 0; i < RUN_TEST_TRIES; i++) {
+        if (auto nanos = RdtscClock::to_nanos(slot.samples[i])) {
+            try_mops[tries++] = (double)iters / nanos * 1000;
+        }
+    }
+    res.modes = fit_two_modes(try_mops.data(), tries);
+    res.aperf_am   = use_aperf ? aperf_timer.am_ratio() : result::nan;
+    res.aperf_mt   = use_aperf ? aperf_timer.mt_ratio() : result::nan;
+    res.vcore      = use_aperf ? aperf_timer.vcore()    : result::nan;
+    if (rt.demoted()) {
+        printf("WARNING: [%2lu] %s was demoted from SCHED_FIFO by the watchdog, its result may be skewed\n", id, test->id);
+    }
+    return res;
+}
+
 struct test_thread {
     size_t id;
+    int cpu; // the cpu to pin to
+    result_arena* arena;
     hot_barrier* start_barrier;
     hot_barrier* stop_barrier;
 
-    /* output */
+    /* output, copied from the arena after the test */
     result res;
 
     /* input */
@@ -577,8 +846,9 @@ struct test_thread {
 
     std::thread thread;
 
-    test_thread(size_t id, hot_barrier& start_barrier, hot_barrier& stop_barrier, const test_func *test, size_t iters, bool use_aperf) :
-        id{id}, start_barrier{&start_barrier}, stop_barrier{&stop_barrier}, test{test},
+    test_thread(size_t id, int cpu, result_arena& arena, hot_barrier& start_barrier, hot_barrier& stop_barrier, const test_func *test,
+            size_t iters, bool use_aperf) :
+        id{id}, cpu{cpu}, arena{&arena}, start_barrier{&start_barrier}, stop_barrier{&stop_barrier}, test{test},
         iters{iters}, use_aperf{use_aperf}, thread{std::ref(*this)}
     {
         // if (verbose) printf("Constructed test in thread %lu, this = %p\n", id, this);
@@ -591,23 +861,188 @@ struct test_thread {
     void operator()() {
         // if (verbose) printf("Running test in thread %lu, this = %p\n", id, this);
         if (!arg_no_pin) {
-            pin_to_cpu(id);
+            pin_to_cpu(cpu);
         }
-        aperf_ghz aperf_timer;
-        outer_timer& outer = use_aperf ? static_cast<outer_timer&>(aperf_timer) : dummy_outer::dummy;
-        warmup w{arg_warm_ms.Get()};
-        long warms = w.warm();
-        if (verbose) printf("[%2lu] Warmup iters %lu\n", id, warms);
-        if (!arg_nobarrier) {
-            long count = start_barrier->wait();
-            if (verbose) printf("[%2lu] Thread loop count: %ld\n", id, count);
+        res = run_one_thread(id, *arena, *start_barrier, *stop_barrier, test, iters, use_aperf, arg_warm_ms.Get());
+    }
+};
+
+/**
+ * A set of long-lived threads, one pinned to each of the given cpus, which run jobs on request. Used
+ * by agent mode so that each experiment doesn't pay for thread creation and pinning.
+ */
+class worker_pool {
+    struct worker {
+        std::thread thread;
+        std::function<void()> job;
+    };
+
+    std::mutex mutex;
+    std::condition_variable job_cv, done_cv;
+    std::deque<worker> workers;
+    size_t generation = 0, running = 0;
+    bool stopping = false;
+
+    void loop(int cpu, worker& w) {
+        if (!arg_no_pin) {
+            pin_to_cpu(cpu);
+        }
+        size_t seen = 0;
+        std::unique_lock<std::mutex> lock(mutex);
+        while (true) {
+            job_cv.wait(lock, [&]{ return stopping || generation != seen; });
+            if (stopping) {
+                return;
+            }
+            seen = generation;
+            if (w.job) {
+                lock.unlock();
+                w.job();
+                lock.lock();
+                w.job = nullptr;
+                if (--running == 0) {
+                    done_cv.notify_one();
+                }
+            }
+        }
+    }
+
+public:
+    worker_pool(const std::vector<int>& cpus) {
+        for (int cpu : cpus) {
+            workers.emplace_back();
+            workers.back().thread = std::thread(&worker_pool::loop, this, cpu, std::ref(workers.back()));
+        }
+    }
+
+    worker_pool(const worker_pool&) = delete;
+    void operator=(const worker_pool&) = delete;
+
+    ~worker_pool() {
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            stopping = true;
+        }
+        job_cv.notify_all();
+        for (auto& w : workers) {
+            w.thread.join();
+        }
+    }
+
+    size_t size() const { return workers.size(); }
+
+    /** run jobs[i] on worker i and wait for all of them to finish */
+    void run(const std::vector<std::function<void()>>& jobs) {
+        assert(jobs.size() <= workers.size());
+        std::unique_lock<std::mutex> lock(mutex);
+        for (size_t i = 0; i < jobs.size(); i++) {
+            workers[i].job = jobs[i];
+        }
+        running = jobs.size();
+        generation++;
+        job_cv.notify_all();
+        done_cv.wait(lock, [&]{ return running == 0; });
+    }
+};
+
+/**
+ * Runs the given test in a loop on each of the given CPUs until stopped, to act as the
+ * load on cores which aren't otherwise part of a measurement. A null test means no load
+ * at all: no threads are started.
+ */
+class background_load {
+    struct worker {
+        int cpu;
+        std::atomic<uint64_t> calls{0};
+        /* paused is the request, idle the acknowledgement that the worker is off its cpu */
+        std::atomic<bool> paused{false}, idle{false};
+        std::thread thread;
+        char pad[64];
+    };
+
+    const test_func* test;
+    size_t iters;
+    std::atomic<bool> stopped{false};
+    std::deque<worker> workers;
+    std::mutex pause_mutex;
+    std::condition_variable pause_cv;
+
+    void run(int cpu, worker& w) {
+        pin_to_cpu(cpu);
+        while (!stopped.load(std::memory_order_relaxed)) {
+            if (w.paused.load(std::memory_order_relaxed)) {
+                std::unique_lock<std::mutex> lock(pause_mutex);
+                w.idle = true;
+                pause_cv.notify_all();
+                pause_cv.wait(lock, [&]{ return !w.paused || stopped; });
+                w.idle = false;
+                continue;
+            }
+            test->func(iters);
+            w.calls.fetch_add(1, std::memory_order_relaxed);
+        }
+    }
+
+public:
+    background_load(const test_func* test, const std::vector<int>& cpus, size_t iters = 10000) : test{test}, iters{iters} {
+        if (test) {
+            for (int cpu : cpus) {
+                workers.emplace_back();
+                auto& w = workers.back();
+                w.cpu = cpu;
+                w.thread = std::thread(&background_load::run, this, cpu, std::ref(w));
+            }
+        }
+    }
+
+    background_load(const background_load&) = delete;
+    void operator=(const background_load&) = delete;
+
+    ~background_load() { stop(); }
+
+    void stop() {
+        {
+            std::lock_guard<std::mutex> lock(pause_mutex);
+            stopped = true;
+        }
+        pause_cv.notify_all();
+        for (auto& w : workers) {
+            if (w.thread.joinable()) {
+                w.thread.join();
+            }
+        }
+    }
+
+    /**
+     * Pause the workers on the given cpus and resume all the others, returning once the paused
+     * workers have left their cpus.
+     */
+    void pause_only(const std::vector<int>& cpus) {
+        std::unique_lock<std::mutex> lock(pause_mutex);
+        for (auto& w : workers) {
+            w.paused = std::find(cpus.begin(), cpus.end(), w.cpu) != cpus.end();
+        }
+        pause_cv.notify_all();
+        pause_cv.wait(lock, [&]{
+            for (auto& w : workers) {
+                if (w.paused && !w.idle) return false;
+            }
+            return true;
+        });
+    }
+
+    /** total number of test iterations (i.e., operations) performed so far across all workers */
+    uint64_t total_ops() const {
+        uint64_t total = 0;
+        for (auto& w : workers) {
+            total += w.calls.load(std::memory_order_relaxed) * iters;
         }
-        res.start_ts = RdtscClock::now();
-        res.inner = run_test<RdtscClock>(test->func, iters, outer, stop_barrier);
-        res.end_ts = RdtscClock::now();
-        res.aperf_am   = use_aperf ? aperf_timer.am_ratio() : 0.0;
-        res.aperf_mt   = use_aperf ? aperf_timer.mt_ratio() : 0.0;
+        return total;
     }
+
+    size_t count() const { return workers.size(); }
+
+    std::string name() const { return test ? test->id : "none"; }
 };
 
 template <typename E>
@@ -615,12 +1050,213 @@ std::string result_string(const std::vector<result>& results, const char* format
     std::string s;
     for (const auto& result : results) {
         if (!s.empty()) s += ", ";
-        s += table::string_format(format, e(result));
+        double v = e(result);
+        s += std::isnan(v) ? "-" : table::string_format(format, v);
+    }
+    return s;
+}
+
+/* the value e(result) for each thread */
+template <typename E>
+std::vector<double> result_values(const std::vector<result>& results, E e) {
+    std::vector<double> ret;
+    for (const auto& result : results) {
+        ret.push_back(e(result));
+    }
+    return ret;
+}
+
+/* min/median/max of the per-thread values, or '-' if any is missing */
+template <typename E>
+std::string aggregate_string(const std::vector<result>& results, const char* format, E e) {
+    auto values = result_values(results, e);
+    if (std::any_of(values.begin(), values.end(), [](double v){ return std::isnan(v); })) {
+        return "-";
+    }
+    auto stats = Stats::get_stats(values.begin(), values.end());
+    return table::string_format(format, stats.getMin()) + "/" + table::string_format(format, stats.getMedian())
+            + "/" + table::string_format(format, stats.getMax());
+}
+
+/* like result_string but for the noise counts, where -1 (unavailable) is shown as '-' */
+template <typename E>
+std::string noise_string(const std::vector<result>& results, E e) {
+    std::string s;
+    for (const auto& result : results) {
+        if (!s.empty()) s += ", ";
+        int64_t v = e(result.noise);
+        s += v == -1 ? "-" : std::to_string(v);
     }
     return s;
 }
 
+/* the sum of a noise count over the threads, or '-' if it's unavailable */
+template <typename E>
+std::string noise_total(const std::vector<result>& results, E e) {
+    int64_t total = 0;
+    for (const auto& result : results) {
+        int64_t v = e(result.noise);
+        if (v == -1) {
+            return "-";
+        }
+        total += v;
+    }
+    return std::to_string(total);
+}
+
+/* the two modes of a flapping thread as "low/high Mops (low% of the time)", or '-' */
+std::string modes_string(const bimodal_fit& modes) {
+    return modes.bimodal ? table::string_format("%.0f/%.0f (%.0f%%)", modes.low, modes.high, modes.low_time * 100) : "-";
+}
+
+/* how many threads flap between two modes, and the modes of the most clearly bimodal one, or '-' */
+std::string flapping_string(const std::vector<result>& results) {
+    const result* worst = nullptr;
+    size_t count = 0;
+    for (auto& r : results) {
+        if (r.modes.bimodal) {
+            count++;
+            if (!worst || r.modes.d > worst->modes.d) {
+                worst = &r;
+            }
+        }
+    }
+    return worst ? table::string_format("%zu/%zu: ", count, results.size()) + modes_string(worst->modes) : "-";
+}
+
+/* the mean voltage over the threads which have one, or '-' */
+std::string vcore_string(const std::vector<result>& results) {
+    double total = 0;
+    size_t count = 0;
+    for (auto& r : results) {
+        if (!std::isnan(r.vcore)) {
+            total += r.vcore;
+            count++;
+        }
+    }
+    return count ? table::string_format("%.3f", total / count) : "-";
+}
+
+/*
+ * The mean voltage and frequency of the threads in each license class, over the results which have a voltage, so
+ * parts which need more voltage for the same license (and so downclock earlier) stand out.
+ */
+void report_vcore(const std::vector<result_holder>& results_list) {
+    struct sums {
+        double volts = 0, mhz = 0;
+        size_t threads = 0;
+    };
+    std::array<sums, LICENSE_COUNT> by_license;
+    for (auto& holder : results_list) {
+        for (size_t t = 0; t < holder.results.size(); t++) {
+            auto& r = holder.results[t];
+            if (std::isnan(r.vcore)) {
+                continue;
+            }
+            auto& s = by_license[license_of(holder.spec->thread_funcs[t].id)];
+            s.volts += r.vcore;
+            s.mhz += r.aperf_am * RdtscClock::tsc_freq() / 1000000.0;
+            s.threads++;
+        }
+    }
+    table::Table table;
+    table.setColColumnSeparator(" | ");
+    table.newRow().add("License").add("Threads").add("Mean Vcore").add("Mean MHz");
+    for (size_t c = 1; c < 4; c++) {
+        table.colInfo(c).justify = table::ColInfo::RIGHT;
+    }
+    bool any = false;
+    for (int c = 0; c < LICENSE_COUNT; c++) {
+        auto& s = by_license[c];
+        if (s.threads) {
+            table.newRow().add(license_name((license_class)c)).add(s.threads)
+                    .addf("%.3f", s.volts / s.threads).addf("%.0f", s.mhz / s.threads);
+            any = true;
+        }
+    }
+    if (any) {
+        printf("Core voltage by license:\n%s\n", table.str().c_str());
+    }
+}
+
+/* the total Mops of the 1-thread run of each test id, the baseline for the scaling efficiency */
+std::map<std::string, double> single_thread_mops;
+
+/* the aggregate columns of the results table: totals and spreads over the threads rather than every value */
+void report_aggregates(const std::vector<result_holder>& results_list, bool use_aperf) {
+    table::Table table;
+    table.setColColumnSeparator(" | ");
+    auto& header = table.newRow().add("Cores").add("ID").add("Description")
+            .add("OVRLP1").add("OVRLP2").add("OVRLP3").add("Total Mops").add("Mops min/med/max").add("CV").add("Scaling");
+    for (size_t col = 3; col < 10; col++) {
+        table.colInfo(col).justify = table::ColInfo::RIGHT;
+    }
+    if (use_aperf) {
+        header.add("MHz min/med/max").add("A/M-ratio").add("M/tsc-ratio").add("Vcore");
+        for (size_t col = 10; col < 14; col++) {
+            table.colInfo(col).justify = table::ColInfo::RIGHT;
+        }
+    }
+    header.add("IRQs").add("vCSW").add("iCSW").add("SMIs").add("Flapping");
+    if (arg_noise_budget) {
+        header.add("Noise");
+    }
+
+    for (const result_holder& holder : results_list) {
+        auto spec = holder.spec;
+        auto& results = holder.results;
+        auto mops = result_values(results, [](const result& r){ return r.inner.mops * 1000; });
+        double total = 0;
+        for (double m : mops) {
+            total += m;
+        }
+        if (spec->count() == 1) {
+            single_thread_mops[spec->name] = total;
+        }
+        // throughput per thread relative to the 1-thread run of the same test
+        auto base = single_thread_mops.find(spec->name);
+        std::string scaling = base == single_thread_mops.end() || base->second == 0 || std::isnan(total) ? "-" :
+                table::string_format("%.0f%%", 100 * total / (spec->count() * base->second));
+
+        auto &row = table.newRow()
+                                .add(spec->count())
+                                .add(spec->name)
+                                .add(spec->description)
+                                .addf("%5.3f", holder.get_overlap1())
+                                .addf("%5.3f", holder.get_overlap2())
+                                .addf("%5.3f", holder.get_overlap3())
+                                .add(std::isnan(total) ? "-" : table::string_format("%.0f", total))
+                                .add(aggregate_string(results, "%.0f", [](const result& r){ return r.inner.mops * 1000; }))
+                                .add(std::isnan(total) ? "-" : table::string_format("%.3f", Stats::coeff_of_variation(mops.begin(), mops.end())))
+                                .add(scaling);
+        if (use_aperf) {
+            auto am = result_values(results, [](const result& r){ return r.aperf_am; });
+            auto mt = result_values(results, [](const result& r){ return r.aperf_mt; });
+            row.add(aggregate_string(results, "%.0f", [](const result& r){ return r.aperf_am / 1000000.0 * RdtscClock::tsc_freq(); }));
+            double am_median = Stats::median(am.begin(), am.end()), mt_median = Stats::median(mt.begin(), mt.end());
+            row.add(std::isnan(am_median) ? "-" : table::string_format("%5.2f", am_median));
+            row.add(std::isnan(mt_median) ? "-" : table::string_format("%4.2f", mt_median));
+            row.add(vcore_string(results));
+        }
+        row.add(noise_total(results, [](const noise_counts& n){ return n.irqs; }));
+        row.add(noise_total(results, [](const noise_counts& n){ return n.vol_csw; }));
+        row.add(noise_total(results, [](const noise_counts& n){ return n.invol_csw; }));
+        row.add(noise_total(results, [](const noise_counts& n){ return n.smis; }));
+        row.add(flapping_string(results));
+        if (arg_noise_budget) {
+            row.add(std::string(holder.noisy ? "NOISY" : "ok") + (holder.reruns ? " (" + std::to_string(holder.reruns) + " reruns)" : ""));
+        }
+    }
+
+    printf("%s\n", table.str().c_str());
+}
+
 void report_results(const std::vector<result_holder>& results_list, bool use_aperf) {
+    if (!arg_per_thread) {
+        report_aggregates(results_list, use_aperf);
+        report_vcore(results_list);
+        return;
+    }
     // report
     table::Table table;
     table.setColColumnSeparator(" | ");
@@ -637,6 +1273,12 @@ void report_results(const std::vector<result_holder>& results_list, bool use_ape
         table.colInfo(col + 1).justify = table::ColInfo::RIGHT;
         header.add("M/tsc-ratio");
         table.colInfo(col + 2).justify = table::ColInfo::RIGHT;
+        header.add("Vcore");
+        table.colInfo(col + 3).justify = table::ColInfo::RIGHT;
+    }
+    header.add("IRQs").add("vCSW").add("iCSW").add("SMIs").add("Modes");
+    if (arg_noise_budget) {
+        header.add("Noise");
     }
 
     for (const result_holder& holder : results_list) {
@@ -655,10 +1297,24 @@ void report_results(const std::vector<result_holder>& results_list, bool use_ape
             row.add(result_string(results, "%5.2f", [](const result& r){ return r.aperf_am; }));
             row.add(result_string(results, "%.0f",  [](const result& r){ return r.aperf_am / 1000000.0 * RdtscClock::tsc_freq(); }));
             row.add(result_string(results, "%4.2f", [](const result& r){ return r.aperf_mt; }));
+            row.add(result_string(results, "%.3f",  [](const result& r){ return r.vcore; }));
+        }
+        row.add(noise_string(results, [](const noise_counts& n){ return n.irqs; }));
+        row.add(noise_string(results, [](const noise_counts& n){ return n.vol_csw; }));
+        row.add(noise_string(results, [](const noise_counts& n){ return n.invol_csw; }));
+        row.add(noise_string(results, [](const noise_counts& n){ return n.smis; }));
+        std::string modes;
+        for (auto& r : results) {
+            modes += (modes.empty() ? "" : ", ") + modes_string(r.modes);
+        }
+        row.add(modes);
+        if (arg_noise_budget) {
+            row.add(std::string(holder.noisy ? "NOISY" : "ok") + (holder.reruns ? " (" + std::to_string(holder.reruns) + " reruns)" : ""));
         }
     }
 
     printf("%s\n", table.str().c_str());
+    report_vcore(results_list);
 }
 
 void list_tests() {
@@ -670,75 +1326,2063 @@ void list_tests() {
     printf("Available tests:\n\n%s\n", table.str().c_str());
 }
 
-std::vector<int> get_cpus() {
-    cpu_set_t cpu_set;
-    if (sched_getaffinity(0, sizeof(cpu_set), &cpu_set)) {
-        err(EXIT_FAILURE, "failed while getting cpu affinity");
-    }
-    std::vector<int> ret;
-    for (int cpu = 0; cpu < CPU_SETSIZE; cpu++) {
-        if (CPU_ISSET(cpu, &cpu_set)) {
-            ret.push_back(cpu);
-        }
-    }
-    return ret;
-}
-
-/* try to filter the CPU list to return only physical CPUs */
+/*
+ * Try to filter the CPU list to return only physical CPUs: from the sysfs sibling lists if we can,
+ * otherwise by probing the x2APIC id of every cpu in parallel.
+ */
 std::vector<int> filter_cpus(std::vector<int> cpus) {
+    auto from_sysfs = first_smt_siblings("/", cpus);
+    if (!from_sysfs.empty()) {
+        return from_sysfs;
+    }
     int shift = get_smt_shift();
     if (shift == -1) {
         printf("Can't use cpuid leaf 0xb to filter out hyperthreads, CPU too old or AMD\n");
         return cpus;
     }
-    cpu_set_t original_set;
-    if (sched_getaffinity(0, sizeof(original_set), &original_set)) {
-        err(EXIT_FAILURE, "failed while getting cpu affinity");
-    }
+    auto apicids = probe_x2apic_ids(cpus);
     std::vector<int> filtered_cpus;
     std::set<uint32_t> coreid_set;
-    for (int cpu : cpus) {
-        cpu_set_t cpuset;
-        CPU_ZERO(&cpuset);
-        CPU_SET(cpu, &cpuset);
-        if (sched_setaffinity(0, sizeof(cpu_set_t), &cpuset)) {
-            err(EXIT_FAILURE, "failed to sched_setaffinity in filter_cpus");
-        }
-        cpuid_result leafb = cpuid(0xb);
-        uint32_t apicid = leafb.edx, coreid = apicid >> shift;
-        if (verbose) printf("cpu %d has x2apic ID %u, coreid %u\n", cpu, apicid, coreid);
+    for (size_t i = 0; i < cpus.size(); i++) {
+        uint32_t apicid = apicids[i], coreid = apicid >> shift;
+        if (verbose) printf("cpu %d has x2apic ID %u, coreid %u\n", cpus[i], apicid, coreid);
         if (coreid_set.insert(coreid).second) {
-            filtered_cpus.push_back(cpu);
+            filtered_cpus.push_back(cpus[i]);
         }
     }
-    // restore original affinity
-    sched_setaffinity(0, sizeof(cpu_set_t), &original_set);
     return filtered_cpus;
 }
 
-int main(int argc, char** argv) {
+/** a spin-wait primitive to evaluate in the waker/waiter benchmark */
+struct wait_primitive {
+    const char* name;
+    wait_f* func;
+    uint32_t ctrl;
+    ISA isa;
+    const char* cost_test; // the test which measures the cost of a single invocation, if any
+    double cost_ops;       // the number of ops cost_test counts for each invocation
+};
 
-    try {
-        parser.ParseCLI(argc, argv);
-        if (arg_iters.Get() % 100 != 0) {
-            printf("ITERS must be a multiple of 100\n");
-            exit(EXIT_FAILURE);
+const wait_primitive ALL_WAITS[] = {
+    { "spin"       , spin_wait_none  , 0, BASE   , nullptr     ,   0 },
+    { "pause"      , spin_wait_pause , 0, BASE   , "pause_only", 100 }, // pause_only counts 100 ops per pause
+    { "tpause-C0.1", spin_wait_tpause, 1, WAITPKG, "tpause_c01",   1 },
+    { "tpause-C0.2", spin_wait_tpause, 0, WAITPKG, "tpause_c02",   1 },
+    { "umwait-C0.1", spin_wait_umwait, 1, WAITPKG, "umwait_c01",   1 },
+    { "umwait-C0.2", spin_wait_umwait, 0, WAITPKG, "umwait_c02",   1 },
+};
+
+/* the tpause/umwait deadline used in the waiter, long enough that the wakeup is normally a store */
+constexpr uint64_t SPIN_WAIT_DEADLINE_TICKS = 100000;
+
+/** the cache line shared between the waker and the waiter */
+struct alignas(64) wake_line {
+    std::atomic<uint64_t> seq;
+    std::atomic<uint64_t> write_ts;
+};
+
+struct spin_wait_result {
+    std::vector<uint64_t> wake_nanos;
+    double cost_ns = result::nan;
+    double am_ratio = result::nan, mt_ratio = result::nan;
+    double neighbor_mops = result::nan;
+};
+
+/*
+ * Run one primitive on the waiter_cpu, woken up repeatedly by a store from the waker_cpu, while
+ * the load is running on the other cores.
+ */
+spin_wait_result run_one_spin_wait(const wait_primitive& prim, int waiter_cpu, int waker_cpu,
+        const background_load& load, bool use_aperf) {
+    spin_wait_result ret;
+    size_t rounds = arg_spin_rounds.Get();
+    wake_line line{};
+    alignas(64) std::atomic<uint64_t> ack{0};
+    std::atomic<bool> waiter_ready{false};
+    ret.wake_nanos.resize(rounds);
+
+    std::thread waiter([&]{
+        pin_to_cpu(waiter_cpu);
+        if (prim.cost_test) {
+            hot_barrier solo{1};
+            ret.cost_ns = prim.cost_ops / run_test<RdtscClock>(find_one_test(prim.cost_test)->func, 10000, dummy_outer::dummy, &solo).mops;
         }
-    } catch (args::Help& help) {
-        printf("%s\n", parser.Help().c_str());
-        exit(EXIT_SUCCESS);
-    } catch (const args::ParseError& e) {
-        printf("ERROR while parsing arguments: %s\n", e.what());
-        printf("\nUsage:\n%s\n", parser.Help().c_str());
+        aperf_ghz aperf_timer;
+        uint64_t load_before = load.total_ops(), tsc_before = RdtscClock::now();
+        if (use_aperf) aperf_timer.start();
+        waiter_ready.store(true, std::memory_order_release);
+        for (uint64_t r = 1; r <= rounds; r++) {
+            prim.func(reinterpret_cast<volatile uint64_t*>(&line.seq), r - 1, prim.ctrl, SPIN_WAIT_DEADLINE_TICKS);
+            uint64_t now = RdtscClock::now();
+            ret.wake_nanos[r - 1] = RdtscClock::to_nanos(now - line.write_ts.load());
+            ack.store(r, std::memory_order_release);
+        }
+        if (use_aperf) {
+            aperf_timer.stop();
+            ret.am_ratio = aperf_timer.am_ratio();
+            ret.mt_ratio = aperf_timer.mt_ratio();
+        }
+        if (load.count()) {
+            uint64_t nanos = RdtscClock::to_nanos(RdtscClock::now() - tsc_before);
+            ret.neighbor_mops = (double)(load.total_ops() - load_before) / load.count() / nanos * 1000.;
+        }
+    });
+
+    std::thread waker([&]{
+        pin_to_cpu(waker_cpu);
+        uint64_t gap_nanos = arg_spin_gap_us.Get() * 1000;
+        // the first gap only starts once the waiter has measured the cost and is about to wait
+        while (!waiter_ready.load(std::memory_order_acquire))
+            _mm_pause();
+        for (uint64_t r = 1; r <= rounds; r++) {
+            // give the waiter time to settle into its wait state
+            uint64_t start = RdtscClock::now();
+            while (RdtscClock::to_nanos(RdtscClock::now() - start) < gap_nanos)
+                ;
+            line.write_ts.store(RdtscClock::now(), std::memory_order_relaxed);
+            line.seq.store(r, std::memory_order_release);
+            while (ack.load(std::memory_order_acquire) != r)
+                _mm_pause();
+        }
+    });
+
+    waker.join();
+    waiter.join();
+    return ret;
+}
+
+/*
+ * The waker/waiter benchmark: for each spin-wait primitive and each neighbor load, measures the cost
+ * of the primitive itself, the latency from a store on another core to the waiter seeing it, and the
+ * frequency and halted fraction of the waiting core along with the throughput of the loaded neighbors.
+ */
+void run_spin_wait(ISA isas_supported, const std::vector<int>& cpus, bool use_aperf) {
+    if (cpus.size() < 2) {
+        printf("ERROR: the spin-wait benchmark needs at least 2 CPUs (%d available)\n", (int)cpus.size());
         exit(EXIT_FAILURE);
     }
-
-    if (arg_list) {
-        list_tests();
-        exit(EXIT_SUCCESS);
+    if (!(isas_supported & WAITPKG)) {
+        printf("CPU doesn't support WAITPKG, only the spin and pause primitives will be tested\n");
     }
 
-    verbose = arg_verbose;
+    std::vector<std::string> loads = split(arg_spin_loads ? arg_spin_loads.Get() : "none,scalar_iadd,avx256_fma_t,avx512_fma_t", ",");
+    int waiter_cpu = cpus[0], waker_cpu = cpus[1];
+    std::vector<int> neighbors(cpus.begin() + 2, cpus.end());
+    printf("Spin-wait benchmark: waiter on CPU %d, waker on CPU %d, %lu neighbor CPUs\n", waiter_cpu, waker_cpu, neighbors.size());
+
+    table::Table table;
+    table.setColColumnSeparator(" | ");
+    table.newRow().add("Load").add("Primitive").add("Cost-ns").add("Wake-min").add("Wake-med").add("Wake-p99").add("A/M-MHz")
+            .add("M/tsc-ratio").add("Nbr-Mops");
+    for (size_t c = 2; c < 9; c++) {
+        table.colInfo(c).justify = table::ColInfo::RIGHT;
+    }
+
+    for (auto& load_id : loads) {
+        const test_func* load_test = nullptr;
+        if (load_id != "none") {
+            load_test = find_one_test(load_id);
+            if (!load_test) {
+                throw std::runtime_error("couldn't find test: '" + load_id + "'");
+            }
+            if (!(load_test->isa & isas_supported)) {
+                printf("Skipping load %s: not supported on this CPU\n", load_id.c_str());
+                continue;
+            }
+        }
+        background_load load{load_test, neighbors};
+        warmup{arg_warm_ms.Get()}.warm();
+
+        for (auto& prim : ALL_WAITS) {
+            if (!(prim.isa & isas_supported)) {
+                continue;
+            }
+            if (verbose) printf("Running primitive %s with load %s\n", prim.name, load.name().c_str());
+            auto res = run_one_spin_wait(prim, waiter_cpu, waker_cpu, load, use_aperf);
+            auto& w = res.wake_nanos;
+            std::sort(w.begin(), w.end());
+            table.newRow().add(load.name()).add(prim.name)
+                    .addf("%.1f", res.cost_ns)
+                    .add(w.front())
+                    .add(w[w.size() / 2])
+                    .add(w[w.size() * 99 / 100])
+                    .addf("%.0f", res.am_ratio * RdtscClock::tsc_freq() / 1000000.0)
+                    .addf("%4.2f", res.mt_ratio)
+                    .addf("%.0f", res.neighbor_mops);
+        }
+    }
+
+    printf("%s\n", table.str().c_str());
+}
+
+/* time to let the background load settle (e.g., reach its license) before measuring each pair */
+constexpr uint64_t C2C_SETTLE_MS = 10;
+
+/**
+ * Median round trip time in nanoseconds for bouncing a cache line between cpu_a and cpu_b.
+ */
+double c2c_round_trip(int cpu_a, int cpu_b, size_t rounds) {
+    alignas(64) std::atomic<uint64_t> line{0};
+    std::vector<uint64_t> samples(rounds);
+
+    std::thread pong([&]{
+        pin_to_cpu(cpu_b);
+        for (uint64_t r = 0; r < rounds; r++) {
+            while (line.load(std::memory_order_acquire) != 2 * r + 1)
+                ;
+            line.store(2 * r + 2, std::memory_order_release);
+        }
+    });
+
+    std::thread ping([&]{
+        pin_to_cpu(cpu_a);
+        for (uint64_t r = 0; r < rounds; r++) {
+            uint64_t start = RdtscClock::now();
+            line.store(2 * r + 1, std::memory_order_release);
+            while (line.load(std::memory_order_acquire) != 2 * r + 2)
+                ;
+            samples[r] = RdtscClock::now() - start;
+        }
+    });
+
+    ping.join();
+    pong.join();
+
+    return RdtscClock::to_nanos(Stats::median(samples.begin(), samples.end()));
+}
+
+/**
+ * A matrix of round trip times, indexed by position in the cpu list (not by cpu number).
+ */
+using c2c_matrix = std::vector<std::vector<double>>;
+
+c2c_matrix measure_c2c(const std::vector<int>& cpus, const test_func* load_test) {
+    size_t n = cpus.size(), rounds = arg_c2c_rounds.Get();
+    c2c_matrix m(n, std::vector<double>(n, result::nan));
+    // one load for the whole matrix, paused on just the pair being measured
+    background_load load{load_test, cpus};
+    for (size_t a = 0; a < n; a++) {
+        for (size_t b = a + 1; b < n; b++) {
+            load.pause_only({cpus[a], cpus[b]});
+            if (load.count() > 2) {
+                warmup{C2C_SETTLE_MS}.warm();
+            }
+            m[a][b] = m[b][a] = c2c_round_trip(cpus[a], cpus[b], rounds);
+            if (verbose) printf("c2c %d <-> %d (%s): %.1f ns\n", cpus[a], cpus[b], load.name().c_str(), m[a][b]);
+        }
+    }
+    return m;
+}
+
+void print_c2c(const char* title, const std::vector<int>& cpus, const c2c_matrix& m) {
+    table::Table table;
+    table.setColColumnSeparator(" ");
+    auto& header = table.newRow().add("CPU");
+    for (size_t c = 0; c < cpus.size(); c++) {
+        header.add(cpus[c]);
+        table.colInfo(c + 1).justify = table::ColInfo::RIGHT;
+    }
+    for (size_t r = 0; r < cpus.size(); r++) {
+        auto& row = table.newRow().add(cpus[r]);
+        for (size_t c = 0; c < cpus.size(); c++) {
+            if (r == c) {
+                row.add("-");
+            } else {
+                row.addf("%.1f", m[r][c]);
+            }
+        }
+    }
+    printf("%s\n%s\n", title, table.str().c_str());
+}
+
+/*
+ * Core-to-core round trip latency matrix, first with all other cores idle, then with the other cores
+ * running the chosen load, which affects both core and uncore frequency.
+ */
+void run_c2c(ISA isas_supported, const std::vector<int>& cpus) {
+    if (cpus.size() < 2) {
+        printf("ERROR: the core-to-core benchmark needs at least 2 CPUs (%d available)\n", (int)cpus.size());
+        exit(EXIT_FAILURE);
+    }
+    std::string load_id = arg_c2c_load ? arg_c2c_load.Get() : (isas_supported & AVX512 ? "avx512_fma_t" : "avx256_fma_t");
+    const test_func* load_test = find_one_test(load_id);
+    if (!load_test) {
+        throw std::runtime_error("couldn't find test: '" + load_id + "'");
+    }
+    if (!(load_test->isa & isas_supported)) {
+        printf("ERROR: load test %s isn't supported on this CPU\n", load_id.c_str());
+        exit(EXIT_FAILURE);
+    }
+
+    auto idle   = measure_c2c(cpus, nullptr);
+    auto loaded = measure_c2c(cpus, load_test);
+    c2c_matrix delta = idle;
+    for (size_t r = 0; r < cpus.size(); r++) {
+        for (size_t c = 0; c < cpus.size(); c++) {
+            delta[r][c] = loaded[r][c] - idle[r][c];
+        }
+    }
+
+    print_c2c("Core-to-core round trip latency (ns), other cores idle:", cpus, idle);
+    print_c2c(("Core-to-core round trip latency (ns), other cores running " + load_id + ":").c_str(), cpus, loaded);
+    print_c2c("Delta (loaded - idle, ns):", cpus, delta);
+}
+
+/**
+ * A way for one thread to block and another to wake it up. Only one waiter at a time.
+ */
+struct wake_mechanism {
+    virtual const char* name() const = 0;
+    /* block until woken */
+    virtual void park() = 0;
+    /* wake the parked (or about to park) thread */
+    virtual void wake() = 0;
+    virtual ~wake_mechanism() {}
+};
+
+struct futex_wake : wake_mechanism {
+    std::atomic<int> word{0};
+
+    const char* name() const override { return "futex"; }
+
+    void park() override {
+        while (word.load() == 0) {
+            syscall(SYS_futex, &word, FUTEX_WAIT_PRIVATE, 0, nullptr, nullptr, 0);
+        }
+        word.store(0);
+    }
+
+    void wake() override {
+        word.store(1);
+        syscall(SYS_futex, &word, FUTEX_WAKE_PRIVATE, 1, nullptr, nullptr, 0);
+    }
+};
+
+struct eventfd_wake : wake_mechanism {
+    int fd;
+
+    eventfd_wake() : fd{eventfd(0, 0)} {
+        if (fd == -1) {
+            err(EXIT_FAILURE, "eventfd failed");
+        }
+    }
+
+    ~eventfd_wake() { close(fd); }
+
+    const char* name() const override { return "eventfd"; }
+
+    void park() override {
+        uint64_t value;
+        if (read(fd, &value, sizeof(value)) != sizeof(value)) {
+            err(EXIT_FAILURE, "eventfd read failed");
+        }
+    }
+
+    void wake() override {
+        uint64_t value = 1;
+        if (write(fd, &value, sizeof(value)) != sizeof(value)) {
+            err(EXIT_FAILURE, "eventfd write failed");
+        }
+    }
+};
+
+/**
+ * Returns the wake-to-run latencies in nanoseconds for the given number of rounds, where each round the waiter
+ * runs the kernel (if any) for kernel_ms, then parks, and the waker wakes it up gap_us after it parked.
+ */
+std::vector<uint64_t> measure_wake(wake_mechanism& mech, const test_func* kernel, int waiter_cpu, int waker_cpu,
+        uint64_t gap_us, size_t rounds) {
+    std::vector<uint64_t> latencies(rounds);
+    alignas(64) std::atomic<uint64_t> parked_round{0}, parked_ts{0}, wake_ts{0};
+    uint64_t kernel_nanos = arg_wake_kernel_ms.Get() * 1000000, gap_nanos = gap_us * 1000;
+
+    std::thread waiter([&]{
+        pin_to_cpu(waiter_cpu);
+        for (uint64_t r = 1; r <= rounds; r++) {
+            if (kernel) {
+                uint64_t start = RdtscClock::now();
+                while (RdtscClock::to_nanos(RdtscClock::now() - start) < kernel_nanos) {
+                    kernel->func(10000);
+                }
+            }
+            parked_ts.store(RdtscClock::now());
+            parked_round.store(r, std::memory_order_release);
+            mech.park();
+            uint64_t now = RdtscClock::now();
+            latencies[r - 1] = RdtscClock::to_nanos(now - wake_ts.load());
+        }
+    });
+
+    std::thread waker([&]{
+        pin_to_cpu(waker_cpu);
+        for (uint64_t r = 1; r <= rounds; r++) {
+            while (parked_round.load(std::memory_order_acquire) != r)
+                _mm_pause();
+            while (RdtscClock::to_nanos(RdtscClock::now() - parked_ts.load()) < gap_nanos)
+                _mm_pause();
+            wake_ts.store(RdtscClock::now());
+            mech.wake();
+        }
+    });
+
+    waker.join();
+    waiter.join();
+    return latencies;
+}
+
+/*
+ * Wakeup latency benchmark: the distribution of the time from a futex or eventfd wakeup issued on one core to the
+ * woken thread running on another, as a function of the kernel the woken thread ran before parking (which determines
+ * its license) and the idle gap before the wakeup (which determines how deep a C-state it may have entered).
+ */
+void run_wake_latency(ISA isas_supported, const std::vector<int>& cpus) {
+    if (cpus.size() < 2) {
+        printf("ERROR: the wake latency benchmark needs at least 2 CPUs (%d available)\n", (int)cpus.size());
+        exit(EXIT_FAILURE);
+    }
+    int waiter_cpu = cpus[0], waker_cpu = cpus[1];
+    printf("Wake latency benchmark: parked thread on CPU %d, waker on CPU %d\n", waiter_cpu, waker_cpu);
+    auto kernels = split(arg_wake_kernels ? arg_wake_kernels.Get() : "none,scalar_iadd,avx256_fma_t,avx512_fma_t", ",");
+    auto gaps = transformv(split(arg_wake_gaps.Get(), ","), [](const std::string& g){ return std::strtoull(g.c_str(), nullptr, 10); });
+
+    futex_wake futex;
+    eventfd_wake efd;
+    std::array<wake_mechanism*, 2> mechs = {{ &futex, &efd }};
+
+    table::Table table;
+    table.setColColumnSeparator(" | ");
+    table.newRow().add("Kernel").add("Gap-us").add("Mechanism").add("Min-ns").add("P50-ns").add("P90-ns").add("P99-ns").add("Max-ns");
+    for (size_t c = 1; c < 8; c++) {
+        table.colInfo(c).justify = table::ColInfo::RIGHT;
+    }
+
+    for (auto& kernel_id : kernels) {
+        const test_func* kernel = nullptr;
+        if (kernel_id != "none") {
+            kernel = find_one_test(kernel_id);
+            if (!kernel) {
+                throw std::runtime_error("couldn't find test: '" + kernel_id + "'");
+            }
+            if (!(kernel->isa & isas_supported)) {
+                printf("Skipping kernel %s: not supported on this CPU\n", kernel_id.c_str());
+                continue;
+            }
+        }
+        for (auto gap : gaps) {
+            for (auto mech : mechs) {
+                auto lat = measure_wake(*mech, kernel, waiter_cpu, waker_cpu, gap, arg_wake_rounds.Get());
+                std::sort(lat.begin(), lat.end());
+                size_t n = lat.size();
+                table.newRow().add(kernel_id).add(gap).add(mech->name()).add(lat.front())
+                        .add(lat[n / 2]).add(lat[n * 9 / 10]).add(lat[n * 99 / 100]).add(lat.back());
+            }
+        }
+    }
+
+    printf("%s\n", table.str().c_str());
+}
+
+/** a memcpy or memset implementation */
+struct mem_strategy {
+    const char* name;
+    mem_f* func;
+    ISA isa;
+    bool is_copy;
+};
+
+const mem_strategy ALL_MEM_STRATEGIES[] = {
+    { "rep_movsb" , copy_rep_movsb, BASE  , true  },
+    { "avx2"      , copy_avx2     , AVX2  , true  },
+    { "avx512"    , copy_avx512   , AVX512, true  },
+    { "nt_avx2"   , copy_nt_avx2  , AVX2  , true  },
+    { "nt_avx512" , copy_nt_avx512, AVX512, true  },
+    { "rep_stosb" , set_rep_stosb , BASE  , false },
+    { "avx2"      , set_avx2      , AVX2  , false },
+    { "avx512"    , set_avx512    , AVX512, false },
+    { "nt_avx512" , set_nt_avx512 , AVX512, false },
+};
+
+/* each measurement moves about this many bytes per thread */
+constexpr size_t MEM_TARGET_BYTES = 256 * 1024 * 1024;
+/* we take the best of this many measurements */
+constexpr size_t MEM_TRIALS = 3;
+
+std::string format_size(size_t bytes) {
+    if (bytes >= 1024 * 1024 && bytes % (1024 * 1024) == 0) return std::to_string(bytes / (1024 * 1024)) + "MiB";
+    if (bytes >= 1024 && bytes % 1024 == 0) return std::to_string(bytes / 1024) + "KiB";
+    return std::to_string(bytes) + "B";
+}
+
+struct mem_result {
+    double gbps = 0;
+    double mhz  = result::nan;
+};
+
+/**
+ * Source and destination buffers for one CPU, allocated (and first touched) by a thread pinned to
+ * that CPU so that they are local to its NUMA node.
+ */
+struct mem_buffers {
+    void *src = nullptr, *dst = nullptr;
+    size_t size;
+
+    mem_buffers(size_t size) : size{size} {
+        if (posix_memalign(&src, 4096, size) || posix_memalign(&dst, 4096, size)) {
+            err(EXIT_FAILURE, "failed to allocate %zu byte buffers", size);
+        }
+        memset(src, 1, size);
+        memset(dst, 2, size);
+    }
+
+    ~mem_buffers() {
+        free(src);
+        free(dst);
+    }
+};
+
+/*
+ * Run strat over size bytes concurrently on the first thread_count cpus, returning the aggregate bandwidth
+ * and mean frequency.
+ */
+mem_result run_mem_one(const mem_strategy& strat, size_t size, size_t thread_count, const std::vector<int>& cpus,
+        std::vector<std::unique_ptr<mem_buffers>>& buffers, bool use_aperf) {
+    std::vector<double> gbps(thread_count), mhz(thread_count);
+    hot_barrier barrier{thread_count};
+    size_t reps = std::max(MEM_TARGET_BYTES / size, (size_t)1);
+    std::vector<std::thread> threads;
+    for (size_t t = 0; t < thread_count; t++) {
+        threads.emplace_back([&, t]{
+            pin_to_cpu(cpus[t]);
+            if (!buffers[t] || buffers[t]->size != size) {
+                buffers[t].reset(); // free the old pair first, so at most one is alive per thread
+                buffers[t].reset(new mem_buffers(size));
+            }
+            auto& buf = *buffers[t];
+            strat.func(buf.dst, buf.src, size); // warm the cache (or not) the same way for every trial
+            barrier.wait();
+            uint64_t best = -1;
+            aperf_ghz aperf_timer;
+            if (use_aperf) aperf_timer.start();
+            for (size_t trial = 0; trial < MEM_TRIALS; trial++) {
+                uint64_t start = RdtscClock::now();
+                for (size_t r = 0; r < reps; r++) {
+                    strat.func(buf.dst, buf.src, size);
+                }
+                best = std::min(best, RdtscClock::now() - start);
+            }
+            if (use_aperf) {
+                aperf_timer.stop();
+                mhz[t] = aperf_timer.am_ratio() * RdtscClock::tsc_freq() / 1000000.0;
+            }
+            gbps[t] = (double)size * reps / RdtscClock::to_nanos(best);
+        });
+    }
+    for (auto& t : threads) {
+        t.join();
+    }
+    mem_result ret;
+    ret.gbps = std::accumulate(gbps.begin(), gbps.end(), 0.0);
+    if (use_aperf) {
+        ret.mhz = std::accumulate(mhz.begin(), mhz.end(), 0.0) / thread_count;
+    }
+    return ret;
+}
+
+/*
+ * The memcpy/memset bake-off: every strategy at every size from --memcpy-min-size to --memcpy-max-size (in steps of
+ * 4x) and every thread count, reporting the aggregate GB/s, the frequency, where the best strategy changes and finally
+ * a recommended size-based dispatch table for each thread count.
+ */
+void run_mem_bench(ISA isas_supported, const std::vector<int>& cpus, bool use_aperf) {
+    size_t min_size = arg_mem_min.Get(), max_size = arg_mem_max.Get();
+    if (min_size == 0 || min_size % 64 != 0 || max_size % 64 != 0 || max_size < min_size) {
+        printf("ERROR: memcpy sizes must be non-zero multiples of 64 with min <= max\n");
+        exit(EXIT_FAILURE);
+    }
+    auto fsrm = cpuid_highest_leaf() >= 7 && get_bits(cpuid(7, 0).edx, 4, 4);
+    printf("CPU supports ERMS    : [%s]\n", psnip_cpu_feature_check(PSNIP_CPU_FEATURE_X86_ERMS) ? "YES" : "NO ");
+    printf("CPU supports FSRM    : [%s]\n", fsrm ? "YES" : "NO ");
+
+    std::vector<size_t> sizes;
+    for (size_t size = min_size; size <= max_size; size *= 4) {
+        sizes.push_back(size);
+    }
+    size_t max_threads = std::min((size_t)(arg_max_threads ? arg_max_threads.Get() : cpus.size()), cpus.size());
+    // every thread has its own source and destination buffer of the current size: keep them all within half of RAM
+    size_t mem_budget = (size_t)sysconf(_SC_PHYS_PAGES) * sysconf(_SC_PAGESIZE) / 2;
+
+    std::string dispatch;
+    for (size_t threads = arg_min_threads.Get(); threads <= max_threads; threads++) {
+        std::vector<size_t> step_sizes;
+        for (auto size : sizes) {
+            if (2 * size * threads <= mem_budget) {
+                step_sizes.push_back(size);
+            }
+        }
+        if (step_sizes.size() < sizes.size()) {
+            printf("Skipping %s at %zu threads: the buffers would take more than half of the memory\n",
+                    step_sizes.empty() ? "every size" : ("sizes above " + format_size(step_sizes.back())).c_str(), threads);
+        }
+        if (step_sizes.empty()) {
+            continue;
+        }
+        for (bool is_copy : {true, false}) {
+            std::vector<std::unique_ptr<mem_buffers>> buffers(threads);
+            std::vector<const mem_strategy*> strats;
+            for (auto& strat : ALL_MEM_STRATEGIES) {
+                if (strat.is_copy == is_copy && (strat.isa & isas_supported)) {
+                    strats.push_back(&strat);
+                }
+            }
+            const char* kind = is_copy ? "memcpy" : "memset";
+
+            table::Table table;
+            table.setColColumnSeparator(" | ");
+            auto& header = table.newRow().add("Size");
+            for (auto strat : strats) {
+                header.add(std::string(strat->name) + " GB/s");
+                if (use_aperf) header.add("MHz");
+            }
+            header.add("Best");
+            for (size_t c = 1; c < strats.size() * (use_aperf ? 2 : 1) + 1; c++) {
+                table.colInfo(c).justify = table::ColInfo::RIGHT;
+            }
+
+            std::vector<const mem_strategy*> best_by_size;
+            for (auto size : step_sizes) {
+                auto& row = table.newRow().add(format_size(size));
+                const mem_strategy* best = nullptr;
+                double best_gbps = 0;
+                for (auto strat : strats) {
+                    auto res = run_mem_one(*strat, size, threads, cpus, buffers, use_aperf);
+                    row.addf("%.1f", res.gbps);
+                    if (use_aperf) row.addf("%.0f", res.mhz);
+                    if (res.gbps > best_gbps) {
+                        best_gbps = res.gbps;
+                        best = strat;
+                    }
+                }
+                row.add(best->name);
+                best_by_size.push_back(best);
+            }
+
+            printf("==== %s, threads: %zu ====\n%s\n", kind, threads, table.str().c_str());
+
+            // crossover points are where the best strategy changes, which also gives the dispatch table
+            std::string crossovers, ranges;
+            for (size_t i = 0; i < step_sizes.size(); i++) {
+                if (i + 1 < step_sizes.size() && best_by_size[i] == best_by_size[i + 1]) {
+                    continue;
+                }
+                if (i + 1 < step_sizes.size()) {
+                    crossovers += (crossovers.empty() ? "" : ", ") + format_size(step_sizes[i]) + " -> " + format_size(step_sizes[i + 1])
+                            + " (" + best_by_size[i]->name + " -> " + best_by_size[i + 1]->name + ")";
+                    ranges += std::string("<= ") + format_size(step_sizes[i]) + ": " + best_by_size[i]->name + ", ";
+                } else {
+                    ranges += std::string("larger: ") + best_by_size[i]->name;
+                }
+            }
+            printf("Crossover points: %s\n\n", crossovers.empty() ? "none" : crossovers.c_str());
+            dispatch += table::string_format("%s threads=%-3zu %s\n", kind, threads, ranges.c_str());
+        }
+    }
+
+    printf("Recommended dispatch table for this host:\n%s", dispatch.c_str());
+}
+
+/**
+ * Writes the results as CSV, one row per thread, for later analysis. Lines starting with '#' hold
+ * metadata such as the environment audit.
+ */
+class csv_writer {
+    FILE* f;
+
+    static std::string num(double d, const char* fmt = "%.4f") {
+        return std::isnan(d) ? "" : table::string_format(fmt, d);
+    }
+
+public:
+    csv_writer(const std::string& path) : f{fopen(path.c_str(), "w")} {
+        if (!f) {
+            err(EXIT_FAILURE, "failed to open output file %s", path.c_str());
+        }
+    }
+
+    csv_writer(const csv_writer&) = delete;
+    void operator=(const csv_writer&) = delete;
+
+    ~csv_writer() { fclose(f); }
+
+    /* a metadata line, which must come before the header */
+    void meta(const std::string& kind, const std::string& key, const std::string& value) {
+        fprintf(f, "# %s\n", csv_line({kind, key, value}).c_str());
+    }
+
+    void audit(const env_audit& audit, const char* kind = "audit") {
+        for (auto& i : audit.items) {
+            meta(kind, i.name, i.value + (i.warning.empty() ? "" : " [WARNING: " + i.warning + "]"));
+        }
+    }
+
+    static std::vector<std::string> header_fields() {
+        return {"spec", "cores", "thread", "test", "mops", "am_ratio", "mhz", "mt_ratio", "vcore",
+                "irqs", "vol_csw", "invol_csw", "smis", "noisy", "flapping", "mode_low", "mode_high", "low_time", "ref_drift"};
+    }
+
+    /** the fields of the row for each thread of the result */
+    static std::vector<std::vector<std::string>> rows(const result_holder& holder) {
+        std::vector<std::vector<std::string>> ret;
+        for (size_t t = 0; t < holder.results.size(); t++) {
+            auto& r = holder.results[t];
+            ret.push_back({holder.spec->name, std::to_string(holder.spec->count()), std::to_string(t),
+                    holder.spec->thread_funcs[t].id, num(r.inner.mops * 1000, "%.2f"), num(r.aperf_am),
+                    num(r.aperf_am * RdtscClock::tsc_freq() / 1000000.0, "%.1f"), num(r.aperf_mt), num(r.vcore),
+                    std::to_string(r.noise.irqs), std::to_string(r.noise.vol_csw), std::to_string(r.noise.invol_csw),
+                    std::to_string(r.noise.smis), holder.noisy ? "1" : "0", r.modes.bimodal ? "1" : "0",
+                    num(r.modes.low, "%.2f"), num(r.modes.high, "%.2f"), num(r.modes.low_time), num(holder.ref_drift)});
+        }
+        return ret;
+    }
+
+    void header() {
+        fprintf(f, "%s\n", csv_line(header_fields()).c_str());
+    }
+
+    void write(const result_holder& holder) {
+        for (auto& row : rows(holder)) {
+            fprintf(f, "%s\n", csv_line(row).c_str());
+        }
+        fflush(f);
+    }
+};
+
+/** run all the threads for one spec, and return their results */
+result_holder run_spec(const test_spec& spec, const std::vector<int>& cpus, size_t iters, bool use_aperf) {
+    assert(cpus.size() >= spec.count());
+    std::deque<test_thread> threads;
+    result_arena arena{spec.count()};
+    hot_barrier start{spec.count()}, stop{spec.count()};
+    for (auto& test : spec.thread_funcs) {
+        threads.emplace_back(threads.size(), cpus[threads.size()], arena, start, stop, &test, iters, use_aperf);
+    }
+
+    result_holder holder(&spec);
+    for (auto& t : threads) {
+        t.thread.join();
+        holder.results.push_back(t.res);
+    }
+    return holder;
+}
+
+/** run the spec on the first spec.count() workers of pool, and return the results */
+result_holder run_spec_on_pool(worker_pool& pool, const test_spec& spec, size_t iters, bool use_aperf, uint64_t warm_ms) {
+    assert(pool.size() >= spec.count());
+    result_arena arena{spec.count()};
+    hot_barrier start{spec.count()}, stop{spec.count()};
+    result_holder holder(&spec);
+    holder.results.resize(spec.count());
+    std::vector<std::function<void()>> jobs;
+    for (size_t i = 0; i < spec.count(); i++) {
+        jobs.push_back([&, i]{
+            holder.results[i] = run_one_thread(i, arena, start, stop, &spec.thread_funcs[i], iters, use_aperf, warm_ms);
+        });
+    }
+    pool.run(jobs);
+    return holder;
+}
+
+/** run the spec, re-running it up to --noise-retries times if it exceeds the noise budget (if any) */
+result_holder run_spec_within_budget(const test_spec& spec, const std::vector<int>& cpus, size_t iters, bool use_aperf) {
+    result_holder holder = run_spec(spec, cpus, iters, use_aperf);
+    if (arg_noise_budget) {
+        auto budget = arg_noise_budget.Get();
+        size_t reruns = 0;
+        while (holder.over_budget(budget) && reruns < arg_noise_retries.Get()) {
+            if (verbose) printf("Spec %s exceeded the noise budget, re-running\n", spec.to_string().c_str());
+            holder = run_spec(spec, cpus, iters, use_aperf);
+            reruns++;
+        }
+        holder.reruns = reruns;
+        holder.noisy = holder.over_budget(budget);
+    }
+    return holder;
+}
+
+/** median per-thread Mops of a result */
+double median_mops(const result_holder& holder) {
+    auto mops = transformv(holder.results, [](const result& r){ return r.inner.mops; });
+    return Stats::median(mops.begin(), mops.end());
+}
+
+/**
+ * A fixed short calibration spec (1-thread scalar_iadd) re-run between the specs of a long sweep: the drift of
+ * its throughput from the first run tracks changes in ambient temperature and background load, and each probe
+ * is recorded in the result file as a ref_probe metadata line (elapsed seconds, Mops and, with APERF/MPERF, MHz).
+ */
+class reference_probe {
+    test_spec spec;
+    std::vector<int> cpus;
+    bool use_aperf;
+    steady_clock::time_point start = steady_clock::now();
+    double baseline = 0, latest = 0, min_drift = 1, max_drift = 1;
+    size_t probes = 0;
+
+public:
+    reference_probe(const std::vector<int>& cpus, bool use_aperf) :
+            spec{"scalar_iadd", "reference probe"}, cpus{cpus.front()}, use_aperf{use_aperf} {
+        spec.thread_funcs.push_back(*find_one_test("scalar_iadd"));
+    }
+
+    /** run the probe, print and record it */
+    void probe(size_t iters, csv_writer* output) {
+        auto holder = run_spec(spec, cpus, iters, use_aperf);
+        latest = median_mops(holder) * 1000;
+        double mhz = holder.results.front().aperf_am * RdtscClock::tsc_freq() / 1000000.0;
+        if (!probes++) {
+            baseline = latest;
+        }
+        min_drift = std::min(min_drift, drift());
+        max_drift = std::max(max_drift, drift());
+        double secs = duration<double>(steady_clock::now() - start).count();
+        printf("Reference probe at %.1f s: %.0f Mops (%+.2f%% vs the first)\n", secs, latest, (drift() - 1) * 100);
+        if (output) {
+            output->meta("ref_probe", table::string_format("%.3f", secs), table::string_format("%.2f", latest)
+                    + (use_aperf ? table::string_format(",%.1f", mhz) : ""));
+        }
+    }
+
+    /** the latest probe relative to the first */
+    double drift() const { return probes ? latest / baseline : 1; }
+
+    void summary() const {
+        printf("Reference drift over %zu probes: %+.2f%% to %+.2f%%\n", probes, (min_drift - 1) * 100, (max_drift - 1) * 100);
+    }
+};
+
+/**
+ * The interference of loading package b on package a: the relative change in throughput of the
+ * probe test running on all the cores of a, when b is fully loaded vs idle.
+ */
+double package_interference(const test_func* probe, const std::vector<int>& a, const std::vector<int>& b, size_t iters, bool use_aperf) {
+    test_spec spec{probe->id, probe->description};
+    spec.thread_funcs.resize(a.size(), *probe);
+    double idle = median_mops(run_spec(spec, a, iters, use_aperf));
+    background_load load{probe, b};
+    warmup{arg_warm_ms.Get()}.warm();
+    double loaded = median_mops(run_spec(spec, a, iters, use_aperf));
+    return (idle - loaded) / idle * 100.0;
+}
+
+/*
+ * Run the specs concurrently on mutually independent packages: first measure the pairwise interference between
+ * packages with the heaviest available test, pick a set of packages which don't affect each other, then run batches
+ * of specs with one spec per package. Specs which don't fit in a single package run serially afterwards on all cpus.
+ * Finally every --package-control'th spec is re-run alone on its package and compared, as a check on the results.
+ *
+ * Returns the results in the same order as specs.
+ */
+std::vector<result_holder> run_specs_on_packages(ISA isas_supported, const std::vector<test_spec>& specs, const std::vector<int>& cpus,
+        size_t iters, bool use_aperf) {
+    auto by_package = cpus_by_package("/", cpus);
+    std::vector<int> packages;
+    for (auto& p : by_package) {
+        packages.push_back(p.first);
+    }
+    printf("Found %zu packages: ", packages.size());
+    for (auto& p : by_package) {
+        printf("[%d: %s] ", p.first, join(p.second, ",").c_str());
+    }
+    printf("\n");
+
+    const test_func* probe = find_one_test(isas_supported & AVX512 ? "avx512_fma_t" : (isas_supported & AVX2 ? "avx256_fma_t" : "scalar_iadd"));
+    std::map<std::pair<int,int>, double> interference;
+    auto independent = [&](int a, int b) {
+        auto key = std::make_pair(a, b);
+        if (!interference.count(key)) {
+            interference[key] = package_interference(probe, by_package[a], by_package[b], iters, use_aperf);
+            printf("Interference of package %d on package %d: %.2f%%\n", b, a, interference[key]);
+        }
+        return std::fabs(interference[key]) < arg_pkg_threshold.Get();
+    };
+    auto chosen = independent_packages(packages, independent);
+    printf("Running specs concurrently on %zu independent package(s): [%s]\n", chosen.size(), join(chosen, ", ").c_str());
+
+    size_t smallest = -1;
+    for (int p : chosen) {
+        smallest = std::min(smallest, by_package[p].size());
+    }
+
+    std::vector<result_holder> results;
+    std::vector<int> placement(specs.size(), -1); // the package each spec ran on, or -1 if it ran serially
+    for (auto& spec : specs) {
+        results.emplace_back(&spec);
+    }
+
+    std::vector<size_t> pending;
+    for (size_t i = 0; i < specs.size(); i++) {
+        if (specs[i].count() <= smallest) {
+            pending.push_back(i);
+        }
+    }
+    for (size_t b = 0; b < pending.size(); b += chosen.size()) {
+        std::vector<std::thread> batch;
+        for (size_t j = 0; j < chosen.size() && b + j < pending.size(); j++) {
+            size_t i = pending[b + j];
+            placement[i] = chosen[j];
+            batch.emplace_back([&, i, j]{
+                results[i] = run_spec_within_budget(specs[i], by_package[chosen[j]], iters, use_aperf);
+            });
+        }
+        for (auto& t : batch) {
+            t.join();
+        }
+    }
+
+    for (size_t i = 0; i < specs.size(); i++) {
+        if (placement[i] == -1) {
+            results[i] = run_spec_within_budget(specs[i], cpus, iters, use_aperf);
+        }
+    }
+
+    // serial control sample
+    double max_dev = 0;
+    size_t controls = 0;
+    for (size_t c = 0; c < pending.size(); c += std::max(arg_pkg_control.Get(), (size_t)1)) {
+        size_t i = pending[c];
+        double concurrent = median_mops(results[i]);
+        double serial = median_mops(run_spec(specs[i], by_package[placement[i]], iters, use_aperf));
+        double dev = (concurrent - serial) / serial * 100.0;
+        if (verbose) printf("Control %s on package %d: concurrent %.0f vs serial %.0f Mops (%+.2f%%)\n",
+                specs[i].to_string().c_str(), placement[i], concurrent * 1000, serial * 1000, dev);
+        max_dev = std::max(max_dev, std::fabs(dev));
+        controls++;
+    }
+    if (controls) {
+        printf("Serial control sample: %zu specs, max deviation %.2f%%%s\n", controls, max_dev,
+                max_dev > arg_pkg_threshold.Get() ? " [WARNING: exceeds the package threshold, concurrent results may be skewed]" : "");
+    }
+
+    return results;
+}
+
+struct stream_kernel {
+    const char* name;
+    stream_f* func;
+    ISA isa;
+};
+
+const stream_kernel ALL_STREAM_KERNELS[] = {
+    { "nt_load_128"  , stream_load_128 , AVX2   },
+    { "nt_load_256"  , stream_load_256 , AVX2   },
+    { "nt_load_512"  , stream_load_512 , AVX512 },
+    { "nt_store_128" , stream_store_128, AVX2   },
+    { "nt_store_256" , stream_store_256, AVX2   },
+    { "nt_store_512" , stream_store_512, AVX512 },
+};
+
+/* streaming cores publish their byte count after each chunk of this size */
+constexpr size_t BW_CHUNK = 1024 * 1024;
+
+/**
+ * Runs a streaming kernel over a private buffer on each of the given cpus until stopped. Each buffer
+ * is allocated and first touched by its pinned thread, so it is local to that cpu's NUMA node.
+ */
+class bandwidth_load {
+    struct worker {
+        std::atomic<uint64_t> bytes{0};
+        std::atomic<bool> ready{false};
+        std::thread thread;
+        char pad[64];
+    };
+
+    stream_f* func;
+    size_t buf_size, chunk;
+    std::atomic<bool> stopped{false};
+    std::deque<worker> workers;
+
+    void run(int cpu, worker& w) {
+        pin_to_cpu(cpu);
+        void* buf;
+        if (posix_memalign(&buf, 4096, buf_size)) {
+            err(EXIT_FAILURE, "failed to allocate a %zu byte streaming buffer", buf_size);
+        }
+        memset(buf, 1, buf_size);
+        w.ready = true;
+        while (!stopped.load(std::memory_order_relaxed)) {
+            for (size_t off = 0; off < buf_size; off += chunk) {
+                func(static_cast<char*>(buf) + off, chunk);
+                w.bytes.fetch_add(chunk, std::memory_order_relaxed);
+            }
+        }
+        free(buf);
+    }
+
+public:
+    /* buf_size must be a multiple of BW_CHUNK, or smaller than it and a multiple of 256 (see bw_buffer_size) */
+    bandwidth_load(stream_f* func, const std::vector<int>& cpus, size_t buf_size) :
+            func{func}, buf_size{buf_size}, chunk{std::min(buf_size, BW_CHUNK)} {
+        assert(buf_size % chunk == 0 && chunk % 256 == 0);
+        for (int cpu : cpus) {
+            workers.emplace_back();
+            auto& w = workers.back();
+            w.thread = std::thread(&bandwidth_load::run, this, cpu, std::ref(w));
+        }
+        for (auto& w : workers) {
+            while (!w.ready.load()) {
+                std::this_thread::yield();
+            }
+        }
+    }
+
+    bandwidth_load(const bandwidth_load&) = delete;
+    void operator=(const bandwidth_load&) = delete;
+
+    ~bandwidth_load() {
+        stopped = true;
+        for (auto& w : workers) {
+            w.thread.join();
+        }
+    }
+
+    /** bytes streamed so far by each worker */
+    std::vector<uint64_t> bytes() const {
+        return transformv(workers, [](const worker& w){ return w.bytes.load(std::memory_order_relaxed); });
+    }
+};
+
+/* per-cpu bandwidth and frequency over an interval, from the streaming byte counts and the APERF/MPERF of each cpu */
+struct bw_window {
+    uint64_t tsc;
+    std::vector<uint64_t> bytes, aperf, mperf;
+
+    static bw_window take(const bandwidth_load* load, const std::vector<int>& cpus, bool use_aperf) {
+        bw_window w;
+        w.tsc = RdtscClock::now();
+        w.bytes = load ? load->bytes() : std::vector<uint64_t>(cpus.size());
+        for (int cpu : cpus) {
+            uint64_t a = 0, m = 0;
+            if (use_aperf) {
+                read_msr(cpu, MSR_IA32_APERF, &a);
+                read_msr(cpu, MSR_IA32_MPERF, &m);
+            }
+            w.aperf.push_back(a);
+            w.mperf.push_back(m);
+        }
+        return w;
+    }
+
+    /* mean GB/s per cpu since earlier */
+    double gbps(const bw_window& earlier) const {
+        double total = 0;
+        for (size_t i = 0; i < bytes.size(); i++) {
+            total += bytes[i] - earlier.bytes[i];
+        }
+        return total / bytes.size() / RdtscClock::to_nanos(tsc - earlier.tsc);
+    }
+
+    /* mean MHz across the cpus since earlier, or NaN without APERF/MPERF */
+    double mhz(const bw_window& earlier, bool use_aperf) const {
+        if (!use_aperf) {
+            return result::nan;
+        }
+        double total = 0;
+        for (size_t i = 0; i < aperf.size(); i++) {
+            total += (double)(aperf[i] - earlier.aperf[i]) / (mperf[i] - earlier.mperf[i]);
+        }
+        return total / aperf.size() * RdtscClock::tsc_freq() / 1000000.0;
+    }
+};
+
+/*
+ * The bandwidth noisy-neighbor scenario: for each streaming kernel, measure the streaming cores alone, the compute cores
+ * alone, and both together. The compute kernels don't touch memory, so a drop in their frequency when the streaming
+ * cores run is power (or license) interference, while a drop in bandwidth with the compute cores running shows the
+ * effect of the compute cores on the streaming cores' frequency.
+ */
+void run_bw_neighbor(ISA isas_supported, const std::vector<int>& cpus, const std::vector<int>& pin_cpus, bool use_aperf) {
+    if (cpus.size() < 2) {
+        printf("ERROR: --bw-neighbor needs at least 2 CPUs\n");
+        exit(EXIT_FAILURE);
+    }
+    size_t bw_count = arg_bw_cores ? arg_bw_cores.Get() : cpus.size() / 2;
+    if (bw_count == 0 || bw_count >= cpus.size()) {
+        printf("ERROR: --bw-cores must be between 1 and %zu\n", cpus.size() - 1);
+        exit(EXIT_FAILURE);
+    }
+    // the compute cores come first, then the streaming cores
+    std::vector<int> compute_cpus(pin_cpus.begin(), pin_cpus.end() - bw_count), bw_cpus(pin_cpus.end() - bw_count, pin_cpus.end());
+
+    std::string compute_id = arg_bw_compute ? arg_bw_compute.Get() :
+            (isas_supported & AVX512 ? "avx512_fma_t" : isas_supported & AVX2 ? "avx256_fma_t" : "scalar_iadd");
+    const test_func* compute = find_one_test(compute_id);
+    if (!compute) {
+        throw std::runtime_error("couldn't find test: '" + compute_id + "'");
+    }
+    test_spec spec{compute->id, compute->description};
+    spec.thread_funcs.resize(compute_cpus.size(), *compute);
+
+    size_t l3 = last_level_cache_bytes("/", cpus.front());
+    if (!l3) {
+        l3 = 32 * 1024 * 1024;
+    }
+    size_t buf_size = arg_bw_buffer_mb ? arg_bw_buffer_mb.Get() * 1024 * 1024 : std::max(l3, 4 * l3 / bw_count);
+    buf_size = (buf_size + BW_CHUNK - 1) / BW_CHUNK * BW_CHUNK;
+    printf("Compute cores: [%s] running %s\nStreaming cores: [%s] with %s buffers each (L3: %s)\n",
+            join(compute_cpus, ", ").c_str(), compute->id, join(bw_cpus, ", ").c_str(),
+            format_size(buf_size).c_str(), format_size(l3).c_str());
+
+    auto iters = arg_iters.Get();
+    auto compute_mhz = [&](const result_holder& h) {
+        if (!use_aperf) return result::nan;
+        double total = 0;
+        for (auto& r : h.results) total += r.aperf_am * RdtscClock::tsc_freq() / 1000000.0;
+        return total / h.results.size();
+    };
+
+    // the TSC range during which all the compute threads were in their timed region
+    auto timed_region = [](const result_holder& h) {
+        uint64_t start = 0, end = -1;
+        for (auto& r : h.results) {
+            start = std::max(start, r.inner.istart_ts);
+            end   = std::min(end, r.inner.iend_ts);
+        }
+        return std::make_pair(start, std::max(start, end));
+    };
+
+    auto baseline = run_spec(spec, compute_cpus, iters, use_aperf);
+    double base_mops = median_mops(baseline), base_mhz = compute_mhz(baseline);
+    auto base_timed = timed_region(baseline);
+    uint64_t timed_ns = std::max(RdtscClock::to_nanos(base_timed.second - base_timed.first), (uint64_t)20 * 1000 * 1000);
+
+    auto fmt = [](double d, const char* f) { return std::isnan(d) ? std::string("-") : table::string_format(f, d); };
+    table::Table table;
+    table.setColColumnSeparator(" | ");
+    table.newRow().add("Streaming kernel").add("GB/s/core alone").add("GB/s/core w/ compute").add("Stream MHz alone")
+            .add("Stream MHz w/ compute").add("Compute Mops").add("Compute MHz").add("Compute MHz change");
+    for (size_t c = 1; c < 8; c++) {
+        table.colInfo(c).justify = table::ColInfo::RIGHT;
+    }
+    table.newRow().add("none").add("-").add("-").add("-").add("-").addf("%.0f", base_mops * 1000).add(fmt(base_mhz, "%.0f")).add("-");
+
+    for (auto& kernel : ALL_STREAM_KERNELS) {
+        if (!(kernel.isa & isas_supported)) {
+            continue;
+        }
+        bandwidth_load load{kernel.func, bw_cpus, buf_size};
+
+        // streaming alone, over a window as long as the timed part of the baseline compute run
+        auto a0 = bw_window::take(&load, bw_cpus, use_aperf);
+        std::this_thread::sleep_for(std::chrono::nanoseconds(timed_ns));
+        auto a1 = bw_window::take(&load, bw_cpus, use_aperf);
+
+        // streaming with the compute cores running: sample the streaming cores every millisecond and use the
+        // samples which fall inside the period when all the compute threads were in their timed region
+        result_holder holder(&spec);
+        std::atomic<bool> done{false};
+        std::thread runner([&]{ holder = run_spec(spec, compute_cpus, iters, use_aperf); done = true; });
+        std::vector<bw_window> windows;
+        while (!done.load()) {
+            windows.push_back(bw_window::take(&load, bw_cpus, use_aperf));
+            std::this_thread::sleep_for(std::chrono::milliseconds(1));
+        }
+        runner.join();
+        windows.push_back(bw_window::take(&load, bw_cpus, use_aperf));
+        auto timed = timed_region(holder);
+        auto w0 = windows.front(), w1 = windows.back();
+        for (auto& w : windows) {
+            if (w.tsc <= timed.first) {
+                w0 = w;
+            }
+        }
+        for (auto i = windows.rbegin(); i != windows.rend(); i++) {
+            if (i->tsc >= timed.second) {
+                w1 = *i;
+            }
+        }
+        if (w1.tsc <= w0.tsc) {
+            w0 = windows.front();
+            w1 = windows.back();
+        }
+
+        double mhz = compute_mhz(holder);
+        table.newRow().add(kernel.name).addf("%.2f", a1.gbps(a0)).addf("%.2f", w1.gbps(w0))
+                .add(fmt(a1.mhz(a0, use_aperf), "%.0f")).add(fmt(w1.mhz(w0, use_aperf), "%.0f"))
+                .addf("%.0f", median_mops(holder) * 1000).add(fmt(mhz, "%.0f"))
+                .add(fmt((mhz - base_mhz) / base_mhz * 100, "%+.1f%%"));
+    }
+    printf("%s\n", table.str().c_str());
+}
+
+/* round a per-thread streaming buffer size down to one bandwidth_load accepts, of at least a page */
+size_t bw_buffer_size(size_t bytes) {
+    size_t unit = bytes >= BW_CHUNK ? BW_CHUNK : 4096;
+    return std::max(bytes / unit * unit, (size_t)4096);
+}
+
+/*
+ * Rooflines for this host: at each vector width and each active core count, the total throughput of the parallel FMA
+ * test, and the total bandwidth of the same width loads from buffers sized to sit in each cache level (half of L1
+ * and L2, half of each core's share of L3) or to spill to DRAM (4x L3 in total). The bandwidth is measured without
+ * the FMA test running, so the loads run at whatever license the load width itself needs.
+ */
+void run_roofline(ISA isas_supported, const std::vector<int>& pin_cpus, bool use_aperf) {
+    if (arg_no_pin) {
+        printf("ERROR: --roofline needs CPU pinning\n");
+        exit(EXIT_FAILURE);
+    }
+    struct width_kernels {
+        int width;
+        const char* fma_id;
+        stream_f* load;
+        ISA isa;
+    };
+    static const width_kernels widths[] = {
+        { 128, "avx128_fma_t", stream_load_128, AVX2   },
+        { 256, "avx256_fma_t", stream_load_256, AVX2   },
+        { 512, "avx512_fma_t", stream_load_512, AVX512 },
+    };
+
+    size_t max_cores = arg_max_threads ? std::min((size_t)arg_max_threads.Get(), pin_cpus.size()) : pin_cpus.size();
+    int cpu0 = pin_cpus.front();
+    size_t l1 = cache_bytes("/", cpu0, 1), l2 = cache_bytes("/", cpu0, 2), l3 = cache_bytes("/", cpu0, 3);
+    printf("Caches of CPU %d: L1 %s, L2 %s, L3 %s\n", cpu0, format_size(l1).c_str(), format_size(l2).c_str(), format_size(l3).c_str());
+
+    auto fmt = [](double d, const char* f) { return std::isnan(d) ? std::string("-") : table::string_format(f, d); };
+    table::Table table;
+    table.setColColumnSeparator(" | ");
+    auto& header = table.newRow().add("Width").add("Cores").add("FMA MHz").add("GFLOP/s");
+    for (int l = 0; l < MEM_LEVEL_COUNT; l++) {
+        header.add(std::string(mem_level_name((mem_level)l)) + " GB/s");
+    }
+    header.add("DRAM ridge");
+    for (size_t c = 1; c < 9; c++) {
+        table.colInfo(c).justify = table::ColInfo::RIGHT;
+    }
+
+    std::vector<roofline> lines;
+    for (auto& w : widths) {
+        if (!(w.isa & isas_supported)) {
+            continue;
+        }
+        const test_func* fma = find_one_test(w.fma_id);
+        assert(fma);
+        for (size_t cores = 1; cores <= max_cores; cores++) {
+            std::vector<int> active(pin_cpus.begin(), pin_cpus.begin() + cores);
+            test_spec spec{fma->id, fma->description};
+            spec.thread_funcs.resize(cores, *fma);
+            auto holder = run_spec(spec, active, arg_iters.Get(), use_aperf);
+
+            roofline r{w.width, cores, use_aperf ? 0 : result::nan, 0, {}};
+            for (auto& res : holder.results) {
+                r.gflops += res.inner.mops * flops_per_fma(w.width);
+                r.mhz += res.aperf_am * RdtscClock::tsc_freq() / 1000000.0 / cores;
+            }
+
+            size_t sizes[MEM_LEVEL_COUNT] = {l1 / 2, l2 / 2, l3 / (2 * cores), std::max(4 * l3 / cores, 4 * l2)};
+            for (int l = 0; l < MEM_LEVEL_COUNT; l++) {
+                r.gbps[l] = result::nan;
+                if (!sizes[l]) {
+                    continue;
+                }
+                bandwidth_load load{w.load, active, bw_buffer_size(sizes[l])};
+                std::this_thread::sleep_for(std::chrono::milliseconds(10));
+                auto b0 = bw_window::take(&load, active, false);
+                std::this_thread::sleep_for(std::chrono::milliseconds(arg_roofline_ms.Get()));
+                auto b1 = bw_window::take(&load, active, false);
+                r.gbps[l] = b1.gbps(b0) * cores;
+            }
+
+            auto& row = table.newRow().add(w.width).add(cores).add(fmt(r.mhz, "%.0f")).addf("%.1f", r.gflops);
+            for (int l = 0; l < MEM_LEVEL_COUNT; l++) {
+                row.add(fmt(r.gbps[l], "%.1f"));
+            }
+            row.add(fmt(ridge_point(r, MEM_DRAM), "%.2f"));
+            lines.push_back(r);
+        }
+    }
+    printf("%s\n", table.str().c_str());
+
+    std::ofstream svg(arg_roofline_svg.Get());
+    svg << roofline_svg(lines, get_brand_string() + ": DP rooflines");
+    if (!svg) {
+        err(EXIT_FAILURE, "failed to write %s", arg_roofline_svg.Get().c_str());
+    }
+    printf("Wrote the roofline plot to %s\n", arg_roofline_svg.Get().c_str());
+}
+
+/*
+ * A table of each spec's total throughput and median frequency under a series of settings (e.g., prefetcher
+ * configurations), relative to the same spec under the first setting.
+ */
+class setting_table {
+    table::Table table;
+    bool use_aperf;
+    /* the total Mops and median MHz under the first setting, by spec index */
+    std::map<size_t, std::pair<double, double>> base;
+
+public:
+    setting_table(const char* setting, const char* first, bool use_aperf) : use_aperf{use_aperf} {
+        table.setColColumnSeparator(" | ");
+        std::string vs = std::string("vs ") + first;
+        table.newRow().add(setting).add("Cores").add("ID").add("Total Mops").add(vs).add("MHz").add(vs);
+        for (size_t col = 3; col < 7; col++) {
+            table.colInfo(col).justify = table::ColInfo::RIGHT;
+        }
+    }
+
+    void add(const std::string& setting, size_t spec_index, const result_holder& holder) {
+        auto fmt = [](double d, const char* f) { return std::isnan(d) ? std::string("-") : table::string_format(f, d); };
+        auto mops = result_values(holder.results, [](const result& r){ return r.inner.mops * 1000; });
+        auto mhz  = result_values(holder.results, [](const result& r){ return r.aperf_am / 1000000.0 * RdtscClock::tsc_freq(); });
+        double total = std::accumulate(mops.begin(), mops.end(), 0.0);
+        double median_mhz = use_aperf ? Stats::median(mhz.begin(), mhz.end()) : result::nan;
+        auto b = base.insert({spec_index, {total, median_mhz}}).first->second;
+        table.newRow().add(setting).add(holder.spec->count()).add(holder.spec->name)
+                .addf("%.0f", total).add(fmt((total / b.first - 1) * 100, "%+.1f%%"))
+                .add(fmt(median_mhz, "%.0f")).add(fmt((median_mhz / b.second - 1) * 100, "%+.1f%%"));
+    }
+
+    std::string str() { return table.str(); }
+};
+
+/*
+ * Run every spec under each prefetcher configuration, with the configuration applied to all the selected cpus,
+ * and report the throughput and frequency relative to the same spec with all prefetchers on.
+ */
+void run_prefetch_sweep(const std::vector<test_spec>& specs, const std::vector<int>& pin_cpus, size_t iters, bool use_aperf) {
+    if (arg_no_pin) {
+        printf("ERROR: --prefetch-sweep needs CPU pinning\n");
+        exit(EXIT_FAILURE);
+    }
+    std::unique_ptr<prefetch_control> control;
+    try {
+        control.reset(new prefetch_control(pin_cpus,
+                [](int cpu, uint64_t* value){ return read_msr(cpu, MSR_MISC_FEATURE_CONTROL, value); },
+                [](int cpu, uint64_t value){ return write_msr(cpu, MSR_MISC_FEATURE_CONTROL, value); }));
+    } catch (const std::runtime_error& e) {
+        printf("ERROR: --prefetch-sweep: %s\n", e.what());
+        exit(EXIT_FAILURE);
+    }
+    printf("Original MSR 0x1a4 of CPU %d: 0x%" PRIx64 "\n", pin_cpus.front(), control->original(0));
+
+    // the baseline is the host's own setting, before anything is written, since the BIOS may disable some prefetchers
+    setting_table table{"Prefetchers", "original", use_aperf};
+    for (size_t i = 0; i < specs.size(); i++) {
+        table.add("original", i, run_spec_within_budget(specs[i], pin_cpus, iters, use_aperf));
+    }
+    for (auto& config : prefetch_configs()) {
+        std::string error = control->apply(config);
+        if (!error.empty()) {
+            printf("ERROR: --prefetch-sweep: %s\n", error.c_str());
+            exit(EXIT_FAILURE);
+        }
+        for (size_t i = 0; i < specs.size(); i++) {
+            table.add(config.name, i, run_spec_within_budget(specs[i], pin_cpus, iters, use_aperf));
+        }
+    }
+    control->restore();
+    printf("%s\n", table.str().c_str());
+    printf("Restored the original prefetcher settings on %zu CPUs\n", pin_cpus.size());
+}
+
+/*
+ * Run every spec in the current (normally the default) resctrl group, then with the test threads in a temporary
+ * group for each --resctrl allocation, which is removed again before the next.
+ */
+void run_resctrl(const std::vector<test_spec>& specs, const std::vector<int>& pin_cpus, size_t iters, bool use_aperf) {
+    std::vector<resctrl_alloc> allocs;
+    try {
+        for (auto& a : arg_resctrl.Get()) {
+            allocs.push_back(parse_resctrl_alloc(a));
+        }
+    } catch (const std::runtime_error& e) {
+        printf("ERROR: --resctrl: %s\n", e.what());
+        exit(EXIT_FAILURE);
+    }
+
+    setting_table table{"resctrl", "none", use_aperf};
+    for (size_t i = 0; i < specs.size(); i++) {
+        table.add("none", i, run_spec_within_budget(specs[i], pin_cpus, iters, use_aperf));
+    }
+    for (size_t a = 0; a < allocs.size(); a++) {
+        std::unique_ptr<resctrl_group> group;
+        try {
+            group.reset(new resctrl_group(arg_resctrl_root.Get(), "avx-turbo-" + std::to_string(getpid()) + "-" + std::to_string(a), allocs[a]));
+        } catch (const std::runtime_error& e) {
+            printf("ERROR: --resctrl: %s\n", e.what());
+            exit(EXIT_FAILURE);
+        }
+        printf("Created resctrl group %s with %s\n", group->path().c_str(), allocs[a].to_string().c_str());
+        resctrl_target = group.get();
+        for (size_t i = 0; i < specs.size(); i++) {
+            table.add(allocs[a].to_string(), i, run_spec_within_budget(specs[i], pin_cpus, iters, use_aperf));
+        }
+        resctrl_target = nullptr;
+    }
+    printf("%s\n", table.str().c_str());
+}
+
+/*
+ * Set up real-time isolation: lock memory, move this (coordinator) thread to the housekeeping cpu and start the
+ * watchdog there. The test threads then make themselves SCHED_FIFO in run_one_thread.
+ */
+std::unique_ptr<rt_watchdog> setup_rt_isolation(const std::vector<int>& used) {
+    int priority = arg_rt_priority.Get();
+    if (priority < sched_get_priority_min(SCHED_FIFO) || priority > sched_get_priority_max(SCHED_FIFO)) {
+        printf("ERROR: --rt-priority must be between %d and %d\n", sched_get_priority_min(SCHED_FIFO), sched_get_priority_max(SCHED_FIFO));
+        exit(EXIT_FAILURE);
+    }
+    if (arg_no_pin) {
+        printf("ERROR: --rt-priority needs CPU pinning\n");
+        exit(EXIT_FAILURE);
+    }
+    // a hyperthread of a tested core isn't isolated from it, so exclude those too
+    std::vector<int> excluded = used;
+    for (int cpu : used) {
+        auto siblings = smt_siblings("/", cpu);
+        excluded.insert(excluded.end(), siblings.begin(), siblings.end());
+    }
+    int hk = arg_housekeeping ? arg_housekeeping.Get() : pick_housekeeping_cpu(get_cpus(), excluded);
+    if (hk == -1) {
+        printf("ERROR: no housekeeping CPU is left outside the cores used by the tests: use --max-threads or --housekeeping-cpu\n");
+        exit(EXIT_FAILURE);
+    }
+    if (std::find(used.begin(), used.end(), hk) != used.end()) {
+        printf("WARNING: housekeeping CPU %d is also used by the tests\n", hk);
+    } else if (std::find(excluded.begin(), excluded.end(), hk) != excluded.end()) {
+        printf("WARNING: housekeeping CPU %d is an SMT sibling of a CPU used by the tests\n", hk);
+    }
+    bool locked = mlockall(MCL_CURRENT | MCL_FUTURE) == 0;
+    if (!locked) {
+        printf("WARNING: couldn't lock memory: %s\n", strerror(errno));
+    }
+    pin_to_cpu(hk);
+    // the watchdog must be able to preempt the test threads, even if they share its cpu
+    int wd_priority = sched_get_priority_max(SCHED_FIFO);
+    std::unique_ptr<rt_watchdog> ret(new rt_watchdog(hk, std::chrono::milliseconds(arg_rt_watchdog_ms.Get()), wd_priority));
+    printf("Real-time isolation: SCHED_FIFO priority %d, coordinator and watchdog on CPU %d, memory locked: %s\n",
+            priority, hk, locked ? "YES" : "NO");
+    return ret;
+}
+
+/**
+ * A root-free frequency meter: each sample is a short burst of dependent adds timed with the TSC, so it gives
+ * the frequency over a few hundred cycles. The fixed overhead of the rdtsc/lfence pair is calibrated away
+ * using the difference between bursts of 256 and 512 adds.
+ */
+class freq_meter {
+    double tsc_hz;
+    double overhead_ticks;
+
+public:
+    static constexpr size_t BURST_ADDS = 256;
+
+    struct sample {
+        uint64_t tsc;
+        double mhz;
+    };
+
+    freq_meter() : tsc_hz(RdtscClock::tsc_freq()) {
+        constexpr size_t CAL_SAMPLES = 1001;
+        std::vector<double> overheads(CAL_SAMPLES);
+        for (auto& o : overheads) {
+            // 2 * t(256) - t(512) = 2 * overhead + 2 * 256 cycles - overhead - 512 cycles = overhead
+            double t256 = freq_burst_256(), t512 = freq_burst_512();
+            o = 2 * t256 - t512;
+        }
+        overhead_ticks = std::max(Stats::median(overheads.begin(), overheads.end()), 0.0);
+    }
+
+    double overhead() const { return overhead_ticks; }
+
+    /** take one sample: the frequency in MHz over one burst */
+    sample take() const {
+        uint64_t tsc = rdtsc();
+        double ticks = freq_burst_256() - overhead_ticks;
+        return { tsc, ticks > 0 ? BURST_ADDS * tsc_hz / ticks / 1000000.0 : result::nan };
+    }
+};
+
+/* print the phases of each cpu's trace, then a summary of the transitions and halts per cpu */
+void print_phases(const std::map<int, std::vector<phase_segment>>& phases) {
+    table::Table table;
+    table.setColColumnSeparator(" | ");
+    table.newRow().add("CPU").add("Start us").add("Duration us").add("Samples").add("Mean MHz").add("MHz/ms").add("Phase");
+    for (size_t c = 1; c < 6; c++) {
+        table.colInfo(c).justify = table::ColInfo::RIGHT;
+    }
+    for (auto& cpu : phases) {
+        for (auto& seg : cpu.second) {
+            table.newRow().add(cpu.first).addf("%.1f", seg.start_us).addf("%.1f", seg.duration_us).add(seg.last - seg.first)
+                    .addf("%.0f", seg.mean_mhz).addf("%+.1f", seg.slope).add(phase_name(seg.kind));
+        }
+    }
+    printf("Phases:\n%s\n", table.str().c_str());
+
+    for (auto& cpu : phases) {
+        std::array<size_t, PHASE_DRIFT + 1> counts{};
+        double halt_us = 0, total_us = 0;
+        for (auto& seg : cpu.second) {
+            counts[seg.kind]++;
+            total_us += seg.duration_us;
+            if (seg.kind == PHASE_HALT) {
+                halt_us += seg.duration_us;
+            }
+        }
+        printf("CPU %d: %zu downclocks, %zu relaxations, %zu drifting phases, %zu halts totalling %.1f us (%.2f%% of %.1f us)\n",
+                cpu.first, counts[PHASE_DOWNCLOCK], counts[PHASE_RELAXATION], counts[PHASE_DRIFT], counts[PHASE_HALT],
+                halt_us, total_us ? halt_us / total_us * 100 : 0.0, total_us);
+    }
+}
+
+/* the --phases mode: segment a saved trace, one cpu per thread */
+void run_phases() {
+    std::ifstream in(arg_phases.Get());
+    if (!in) {
+        err(EXIT_FAILURE, "failed to open trace file %s", arg_phases.Get().c_str());
+    }
+    auto traces = read_trace(in);
+    if (traces.empty()) {
+        printf("ERROR: no samples in %s\n", arg_phases.Get().c_str());
+        exit(EXIT_FAILURE);
+    }
+    print_phases(segment_traces(traces, std::thread::hardware_concurrency(), arg_phase_penalty.Get()));
+}
+
+/*
+ * Samples the frequency meter every --freq-meter-us on the first cpu for --freq-meter-ms, either spinning or running
+ * --freq-meter-kernel between samples, while optionally starting --freq-meter-load on the other cpus part of the way
+ * in. If APERF/MPERF are readable, their average frequency over each 1 ms window is used to validate the meter.
+ */
+void run_freq_meter(ISA isas_supported, const std::vector<int>& cpus, bool use_aperf) {
+    auto lookup = [&](args::ValueFlag<std::string>& arg) -> const test_func* {
+        if (!arg) return nullptr;
+        auto test = find_one_test(arg.Get());
+        if (!test || !(test->isa & isas_supported)) {
+            printf("ERROR: test %s not found or not supported on this CPU\n", arg.Get().c_str());
+            exit(EXIT_FAILURE);
+        }
+        return test;
+    };
+    const test_func* kernel = lookup(arg_fmeter_kernel);
+    const test_func* load_test = lookup(arg_fmeter_load);
+    int cpu = cpus.front();
+    uint64_t duration_ns = arg_fmeter_ms.Get() * 1000000, period_ns = arg_fmeter_us.Get() * 1000;
+    constexpr uint64_t WINDOW_NS = 1000000;
+
+    std::vector<freq_meter::sample> samples;
+    samples.reserve(duration_ns / period_ns + 1);
+    struct window { double sw_mhz, am_mhz; };
+    std::vector<window> windows;
+    std::atomic<bool> started{false};
+    double overhead = 0;
+
+    std::thread meter_thread([&]{
+        pin_to_cpu(cpu);
+        freq_meter meter;
+        overhead = meter.overhead();
+        started = true;
+        uint64_t start = RdtscClock::now(), next = 0, next_window = WINDOW_NS;
+        uint64_t aperf_last = use_aperf ? aperf_ghz::aperf() : 0, mperf_last = use_aperf ? aperf_ghz::mperf() : 0;
+        size_t window_first = 0;
+        for (uint64_t now = 0; now < duration_ns; now = RdtscClock::to_nanos(RdtscClock::now() - start)) {
+            if (now < next) {
+                if (kernel) kernel->func(1000);
+                continue;
+            }
+            samples.push_back(meter.take());
+            next += period_ns;
+            if (use_aperf && now >= next_window) {
+                uint64_t a = aperf_ghz::aperf(), m = aperf_ghz::mperf();
+                double sum = 0;
+                size_t count = 0;
+                for (size_t i = window_first; i < samples.size(); i++) {
+                    if (!std::isnan(samples[i].mhz)) {
+                        sum += samples[i].mhz;
+                        count++;
+                    }
+                }
+                if (count) {
+                    windows.push_back({ sum / count, (double)(a - aperf_last) / (m - mperf_last) * RdtscClock::tsc_freq() / 1000000.0 });
+                }
+                aperf_last = a;
+                mperf_last = m;
+                window_first = samples.size();
+                next_window += WINDOW_NS;
+            }
+        }
+    });
+
+    while (!started)
+        ;
+    std::unique_ptr<background_load> load;
+    if (load_test) {
+        std::this_thread::sleep_for(std::chrono::nanoseconds(duration_ns / 4));
+        load.reset(new background_load(load_test, std::vector<int>(cpus.begin() + 1, cpus.end())));
+    }
+    meter_thread.join();
+    load.reset();
+
+    std::vector<double> mhz;
+    for (auto& s : samples) {
+        if (!std::isnan(s.mhz)) mhz.push_back(s.mhz);
+    }
+    if (mhz.empty()) {
+        printf("ERROR: no valid frequency meter samples\n");
+        exit(EXIT_FAILURE);
+    }
+    auto stats = get_stats(mhz.begin(), mhz.end());
+    printf("Frequency meter on CPU %d: %zu samples every %lu us, burst overhead %.0f ticks\n", cpu, samples.size(),
+            (unsigned long)arg_fmeter_us.Get(), overhead);
+    printf("MHz min/median/avg/max: %s\n", stats.getString4(6, 0).c_str());
+
+    if (!windows.empty()) {
+        double sum_err = 0, max_err = 0;
+        for (auto& w : windows) {
+            double e = std::fabs(w.sw_mhz - w.am_mhz) / w.am_mhz * 100;
+            sum_err += e;
+            max_err = std::max(max_err, e);
+        }
+        printf("Error vs APERF/MPERF over %zu 1 ms windows: mean %.2f%%, max %.2f%%\n", windows.size(),
+                sum_err / windows.size(), max_err);
+    }
+
+    std::map<int, std::vector<trace_point>> trace;
+    for (auto& s : samples) {
+        if (!std::isnan(s.mhz)) {
+            trace[cpu].push_back({RdtscClock::to_nanos(s.tsc - samples.front().tsc) / 1000.0, s.mhz});
+        }
+    }
+    print_phases(segment_traces(trace, 1, arg_phase_penalty.Get()));
+
+    if (arg_fmeter_trace) {
+        FILE* f = fopen(arg_fmeter_trace.Get().c_str(), "w");
+        if (!f) {
+            err(EXIT_FAILURE, "failed to open trace file %s", arg_fmeter_trace.Get().c_str());
+        }
+        fprintf(f, "cpu,time_us,mhz\n");
+        for (auto& s : samples) {
+            fprintf(f, "%d,%.3f,%.1f\n", cpu, RdtscClock::to_nanos(s.tsc - samples.front().tsc) / 1000.0, s.mhz);
+        }
+        fclose(f);
+        printf("Wrote %zu samples to %s\n", samples.size(), arg_fmeter_trace.Get().c_str());
+    }
+}
+
+/* print the break-even table for the workload given by the --breakeven options */
+void print_breakeven(const freq_model& model) {
+    vector_workload avx2{arg_be_speedup2.Get(), arg_be_fraction.Get(), arg_be_transitions.Get(), arg_be_halt_us.Get()};
+    vector_workload avx512 = avx2;
+    avx512.speedup = arg_be_speedup5.Get();
+
+    printf("Workload: vector fraction %.2f, speedup %.1fx (AVX2) %.1fx (AVX-512), %.0f transitions/s of %.1f us\n",
+            avx2.vector_fraction, avx2.speedup, avx512.speedup, avx2.transitions_per_sec, avx2.transition_us);
+
+    std::set<int> actives;
+    for (auto& e : model.table) {
+        actives.insert(total_active(e.first.counts));
+    }
+
+    auto fmt = [](double d, const char* f) { return std::isnan(d) ? std::string("-") : table::string_format(f, d); };
+    auto fraction = [](double d) { return std::isinf(d) ? std::string("never") : std::isnan(d) ? std::string("-") : table::string_format("%.2f", d); };
+
+    table::Table table;
+    table.setColColumnSeparator(" | ");
+    table.colInfo(0).justify = table::ColInfo::RIGHT;
+    table.newRow().add("Cores").add("Scalar MHz").add("AVX2 MHz").add("AVX-512 MHz").add("AVX2 net").add("AVX-512 net")
+            .add("AVX2 break-even").add("AVX-512 break-even").add("Best");
+    for (int n : actives) {
+        auto f2 = freqs_for(model, LICENSE_AVX2, n), f5 = freqs_for(model, LICENSE_AVX512, n);
+        double net2 = net_speedup(f2, avx2), net5 = net_speedup(f5, avx512);
+        const char* best = "scalar";
+        double best_net = 1;
+        if (net2 > best_net)  { best = "AVX2";    best_net = net2; }
+        if (net5 > best_net)  { best = "AVX-512"; best_net = net5; }
+        table.newRow().add(n).add(fmt(f2.scalar, "%.0f")).add(fmt(f2.vector, "%.0f")).add(fmt(f5.vector, "%.0f"))
+                .add(fmt(net2, "%.2fx")).add(fmt(net5, "%.2fx"))
+                .add(fraction(breakeven_fraction(f2, avx2))).add(fraction(breakeven_fraction(f5, avx512)))
+                .add(std::isnan(f2.scalar) ? "-" : best);
+    }
+    printf("%s\n", table.str().c_str());
+}
+
+/*
+ * Attach mode: measure the threads of an existing process (or the cpus of a cgroup) with perf_timer for
+ * --attach-ms and report the frequency and license residency of each, without running any tests.
+ */
+void run_attach(const std::vector<int>& cpus, csv_writer* output) {
+    std::string name;
+    std::deque<std::string> labels; // backing storage for the test ids of the spec
+    std::deque<perf_timer> timers;
+    if (arg_attach) {
+        pid_t pid = arg_attach.Get();
+        name = "attach:" + std::to_string(pid);
+        auto tids = list_threads(pid);
+        if (tids.empty()) {
+            printf("ERROR: no threads found for pid %d\n", (int)pid);
+            exit(EXIT_FAILURE);
+        }
+        for (pid_t tid : tids) {
+            labels.push_back(std::to_string(tid) + " (" + thread_name(tid) + ")");
+            timers.emplace_back(perf_counters::for_thread(tid));
+        }
+    } else {
+        name = "cgroup:" + arg_attach_cgroup.Get();
+        for (int cpu : cpus) {
+            labels.push_back("cpu " + std::to_string(cpu));
+            timers.emplace_back(perf_counters::for_cgroup(arg_attach_cgroup.Get(), {cpu}));
+        }
+    }
+
+    if (!license_events_supported()) {
+        printf("WARNING: license level events aren't known for this CPU model\n");
+    }
+    for (int c = 0; c < PERF_COUNTER_COUNT; c++) {
+        if ((license_events_supported() || c < PERF_LICENSE0) && !timers.front().counters.is_open((perf_counter)c)) {
+            printf("WARNING: the %s counter isn't available\n", perf_counter_name((perf_counter)c));
+        }
+    }
+
+    printf("Measuring %zu %s of %s for %lu ms\n", timers.size(), arg_attach ? "threads" : "cpus", name.c_str(),
+            (unsigned long)arg_attach_ms.Get());
+    uint64_t start_ts = RdtscClock::now();
+    for (auto& t : timers) {
+        t.start();
+    }
+    std::this_thread::sleep_for(std::chrono::milliseconds(arg_attach_ms.Get()));
+    for (auto& t : timers) {
+        t.stop();
+    }
+    uint64_t end_ts = RdtscClock::now();
+
+    test_spec spec{name, "attached"};
+    for (auto& l : labels) {
+        spec.thread_funcs.push_back({nullptr, l.c_str(), "attached", BASE});
+    }
+    result_holder holder(&spec);
+    for (auto& t : timers) {
+        // nothing ran so there are no Mops, and every thread was measured over the same window
+        result r;
+        r.inner.mops = result::nan;
+        r.start_ts = r.inner.istart_ts = r.inner.ostart_ts = start_ts;
+        r.end_ts = r.inner.iend_ts = r.inner.oend_ts = end_ts;
+        r.aperf_am = t.am_ratio();
+        r.aperf_mt = t.mt_ratio();
+        holder.results.push_back(r);
+    }
+    report_results({holder}, true);
+
+    // the attach-only columns: how busy each thread was and where it spent that time by license level
+    auto fmt = [](double d, const char* f) { return std::isnan(d) ? std::string("-") : table::string_format(f, d); };
+    table::Table table;
+    table.setColColumnSeparator(" | ");
+    table.newRow().add(arg_attach ? "Thread" : "CPU").add("Util").add("L0").add("L1").add("L2");
+    for (size_t i = 0; i < timers.size(); i++) {
+        auto& t = timers[i];
+        auto& row = table.newRow().add(labels[i]).add(fmt(t.utilization() * 100, "%.1f%%"));
+        for (int level = 0; level < 3; level++) {
+            row.add(fmt(t.license_residency(level) * 100, "%.1f%%"));
+        }
+    }
+    printf("%s\n", table.str().c_str());
+
+    if (output) {
+        output->write(holder);
+    }
+}
+
+/* fit and/or load a frequency model and answer a prediction query: this needs no measurements on this host */
+void run_freq_model() {
+    freq_model model;
+    if (arg_model_fit) {
+        std::ifstream in(arg_model_fit.Get());
+        if (!in) {
+            err(EXIT_FAILURE, "failed to open result file %s", arg_model_fit.Get().c_str());
+        }
+        auto samples = read_result_samples(in);
+        if (samples.empty()) {
+            printf("ERROR: no samples with a measured frequency in %s (APERF/MPERF are needed)\n", arg_model_fit.Get().c_str());
+            exit(EXIT_FAILURE);
+        }
+        model = freq_model::fit(samples);
+        auto residuals = model.residuals(samples);
+        double sumsq = 0, maxabs = 0;
+        for (double r : residuals) {
+            sumsq += r * r;
+            maxabs = std::max(maxabs, std::fabs(r));
+        }
+        printf("Fit %zu table entries to %zu samples: RMS residual %.1f MHz, max |residual| %.1f MHz\n",
+                model.table.size(), samples.size(), std::sqrt(sumsq / samples.size()), maxabs);
+    } else if (arg_model_in) {
+        std::ifstream in(arg_model_in.Get());
+        if (!in) {
+            err(EXIT_FAILURE, "failed to open model file %s", arg_model_in.Get().c_str());
+        }
+        model = freq_model::read(in);
+    } else {
+        printf("ERROR: --predict, --breakeven and --model-out need a model from --fit-model or --model-in\n");
+        exit(EXIT_FAILURE);
+    }
+
+    table::Table table;
+    table.setColColumnSeparator(" | ");
+    table.newRow().add("Own").add("AVX-512").add("AVX2").add("Scalar").add("MHz").add("Samples").add("RMS resid");
+    for (auto& e : model.table) {
+        auto& counts = e.first.counts;
+        table.newRow().add(license_name(e.first.own)).add(counts[LICENSE_AVX512]).add(counts[LICENSE_AVX2]).add(counts[LICENSE_SCALAR])
+                .addf("%.0f", e.second.mhz).add(e.second.samples).addf("%.1f", e.second.rms_residual);
+    }
+    printf("%s\n", table.str().c_str());
+
+    if (arg_model_out) {
+        std::ofstream out(arg_model_out.Get());
+        model.write(out);
+        if (!out) {
+            err(EXIT_FAILURE, "failed to write model file %s", arg_model_out.Get().c_str());
+        }
+        printf("Wrote the model to %s\n", arg_model_out.Get().c_str());
+    }
+
+    if (arg_predict) {
+        auto counts = split(arg_predict.Get(), ",");
+        if (counts.size() != 3) {
+            printf("ERROR: --predict takes three counts: N512,N256,NSCALAR\n");
+            exit(EXIT_FAILURE);
+        }
+        int n512 = std::atoi(counts[0].c_str()), n256 = std::atoi(counts[1].c_str()), nscalar = std::atoi(counts[2].c_str());
+        auto mhz = model.predict(n512, n256, nscalar);
+        printf("Predicted frequency with %d AVX-512, %d AVX2 and %d scalar cores active:\n", n512, n256, nscalar);
+        license_counts active{};
+        active[LICENSE_AVX512] = n512;
+        active[LICENSE_AVX2]   = n256;
+        active[LICENSE_SCALAR] = nscalar;
+        for (int c = LICENSE_COUNT - 1; c >= 0; c--) {
+            if (!active[c]) {
+                continue;
+            }
+            if (std::isnan(mhz[c])) {
+                printf("  %-6s cores: no data for this license mix\n", license_name((license_class)c));
+            } else {
+                printf("  %-6s cores: %.0f MHz\n", license_name((license_class)c), mhz[c]);
+            }
+        }
+    }
+
+    if (arg_breakeven) {
+        print_breakeven(model);
+    }
+}
+
+/**
+ * Handle one agent request, writing the response frames to fd. Returns false if the agent should exit.
+ */
+bool handle_agent_request(int fd, const std::string& payload, ISA isas_supported, worker_pool& pool, bool use_aperf) {
+    auto start = std::chrono::steady_clock::now();
+    auto send = [fd](const std::vector<std::string>& fields){ write_frame(fd, csv_line(fields)); };
+    bool keep_going = true;
+    try {
+        auto req = parse_agent_request(payload);
+        if (req.command == "info") {
+            send({"info", "brand", get_brand_string()});
+            send({"info", "tsc_mhz", table::string_format("%.1f", RdtscClock::tsc_freq() / 1000000.0)});
+            send({"info", "workers", std::to_string(pool.size())});
+            send({"info", "aperf", use_aperf ? "1" : "0"});
+        } else if (req.command == "list") {
+            for (auto& t : ALL_FUNCS) {
+                if (t.isa & isas_supported) {
+                    send({"test", t.id, t.description});
+                }
+            }
+        } else if (req.command == "run") {
+            auto spec = parse_spec(req.get("spec"));
+            size_t iters = std::stoul(req.get("iters", std::to_string(arg_iters.Get())));
+            uint64_t warm_ms = std::stoul(req.get("warmup-ms", std::to_string(arg_warm_ms.Get())));
+            if (spec.thread_funcs.empty() || iters == 0 || iters % 100 != 0) {
+                throw std::runtime_error("run needs a spec and iters must be a non-zero multiple of 100");
+            }
+            if (spec.count() > pool.size()) {
+                throw std::runtime_error("spec needs " + std::to_string(spec.count()) + " CPUs but only "
+                        + std::to_string(pool.size()) + " are available");
+            }
+            for (auto& t : spec.thread_funcs) {
+                if (!(t.isa & isas_supported)) {
+                    throw std::runtime_error(std::string("test ") + t.id + " isn't supported on this CPU");
+                }
+            }
+            auto holder = run_spec_on_pool(pool, spec, iters, use_aperf, warm_ms);
+            auto header = csv_writer::header_fields();
+            header.insert(header.begin(), "header");
+            send(header);
+            for (auto& row : csv_writer::rows(holder)) {
+                row.insert(row.begin(), "row");
+                send(row);
+            }
+        } else if (req.command == "quit") {
+            keep_going = false;
+        } else {
+            throw std::runtime_error("unknown command '" + req.command + "'");
+        }
+    } catch (const std::exception& e) {
+        send({"error", e.what()});
+        return keep_going;
+    }
+    auto us = std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now() - start).count();
+    send({"done", std::to_string(us)});
+    return keep_going;
+}
+
+/*
+ * Agent mode: after the usual startup (TSC calibration, cpu filtering, audit) keep a pool of pinned worker
+ * threads and serve experiment requests from one client at a time on a unix domain socket, until a client
+ * sends "quit".
+ */
+void run_agent(ISA isas_supported, const std::vector<int>& pin_cpus, bool use_aperf) {
+    std::string path = arg_agent.Get();
+    int lfd = listen_unix(path);
+    register_cleanup([path]{ unlink(path.c_str()); });
+    worker_pool pool{pin_cpus};
+    printf("Agent listening on %s with %zu workers\n", path.c_str(), pool.size());
+    fflush(stdout);
+
+    bool keep_going = true;
+    while (keep_going) {
+        int fd = accept(lfd, nullptr, nullptr);
+        if (fd < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            err(EXIT_FAILURE, "accept failed on %s", path.c_str());
+        }
+        frame_decoder decoder;
+        std::string payload;
+        size_t requests = 0;
+        try {
+            while (keep_going && read_frame(fd, decoder, payload)) {
+                if (verbose) printf("Agent request: %s\n", payload.c_str());
+                keep_going = handle_agent_request(fd, payload, isas_supported, pool, use_aperf);
+                requests++;
+            }
+        } catch (const std::exception& e) {
+            printf("Dropping agent client: %s\n", e.what());
+        }
+        if (verbose) printf("Agent client disconnected after %zu requests\n", requests);
+        close(fd);
+    }
+    close(lfd);
+    unlink(path.c_str());
+}
+
+/* send each request to the agent and print the responses, returning the exit status */
+int run_agent_client() {
+    std::vector<std::string> requests = arg_agent_request.Get();
+    if (requests.empty()) {
+        std::string line;
+        while (std::getline(std::cin, line)) {
+            if (!line.empty()) {
+                requests.push_back(line);
+            }
+        }
+    }
+
+    int fd = connect_unix(arg_agent_client.Get());
+    frame_decoder decoder;
+    int status = EXIT_SUCCESS;
+    for (auto& req : requests) {
+        if (!write_frame(fd, req)) {
+            errx(EXIT_FAILURE, "failed to send request to the agent");
+        }
+        std::string payload;
+        while (true) {
+            if (!read_frame(fd, decoder, payload)) {
+                errx(EXIT_FAILURE, "agent closed the connection");
+            }
+            printf("%s\n", payload.c_str());
+            auto type = parse_csv_line(payload).at(0);
+            if (type == "error") {
+                status = EXIT_FAILURE;
+            }
+            if (type == "done" || type == "error") {
+                break;
+            }
+        }
+    }
+    close(fd);
+    return status;
+}
+
+int main(int argc, char** argv) {
+    auto main_start = std::chrono::steady_clock::now();
+    init_cleanup();
+
+    try {
+        parser.ParseCLI(argc, argv);
+        if (arg_iters.Get() % 100 != 0) {
+            printf("ITERS must be a multiple of 100\n");
+            exit(EXIT_FAILURE);
+        }
+        if (arg_spin_rounds.Get() == 0) {
+            printf("ERROR: --spin-rounds must be at least 1\n");
+            exit(EXIT_FAILURE);
+        }
+        if (arg_c2c_rounds.Get() == 0) {
+            printf("ERROR: --c2c-rounds must be at least 1\n");
+            exit(EXIT_FAILURE);
+        }
+        if (arg_wake_rounds.Get() == 0) {
+            printf("ERROR: --wake-rounds must be at least 1\n");
+            exit(EXIT_FAILURE);
+        }
+        if (arg_fmeter_us.Get() == 0) {
+            printf("ERROR: --freq-meter-us must be at least 1\n");
+            exit(EXIT_FAILURE);
+        }
+        if (arg_ref_normalize && !arg_ref_every) {
+            printf("ERROR: --ref-normalize needs --ref-probe\n");
+            exit(EXIT_FAILURE);
+        }
+        // the probe only runs in the normal sweep of the selected tests, which every other mode replaces
+        bool other_mode = arg_list || arg_agent_client || arg_model_fit || arg_model_in || arg_model_out || arg_predict
+                || arg_breakeven || arg_phases || arg_spin_wait || arg_c2c || arg_wake || arg_mem || arg_fmeter
+                || arg_attach || arg_attach_cgroup || arg_agent || arg_bw || arg_roofline || arg_prefetch || arg_resctrl
+                || arg_pkg_parallel;
+        if (arg_ref_every && other_mode) {
+            printf("ERROR: --ref-probe only works in the normal test sweep, not with another mode\n");
+            exit(EXIT_FAILURE);
+        }
+    } catch (args::Help& help) {
+        printf("%s\n", parser.Help().c_str());
+        exit(EXIT_SUCCESS);
+    } catch (const args::ParseError& e) {
+        printf("ERROR while parsing arguments: %s\n", e.what());
+        printf("\nUsage:\n%s\n", parser.Help().c_str());
+        exit(EXIT_FAILURE);
+    }
+
+    if (arg_list) {
+        list_tests();
+        exit(EXIT_SUCCESS);
+    }
+
+    if (arg_agent_client) {
+        return run_agent_client();
+    }
+
+    if (arg_model_fit || arg_model_in || arg_model_out || arg_predict || arg_breakeven) {
+        run_freq_model();
+        exit(EXIT_SUCCESS);
+    }
+
+    if (arg_phases) {
+        try {
+            run_phases();
+        } catch (const std::runtime_error& e) {
+            printf("ERROR: %s: %s\n", arg_phases.Get().c_str(), e.what());
+            exit(EXIT_FAILURE);
+        }
+        exit(EXIT_SUCCESS);
+    }
+
+    verbose = arg_verbose;
     bool is_root = (geteuid() == 0);
     bool use_aperf = aperf_ghz::is_supported();
     printf("CPUID highest leaf  : [%2xh]\n", cpuid_highest_leaf());
@@ -749,7 +3393,9 @@ int main(int argc, char** argv) {
     ISA isas_supported = get_isas();
     printf("CPU supports AVX2   : [%s]\n", isas_supported & AVX2   ? "YES" : "NO ");
     printf("CPU supports AVX-512: [%s]\n", isas_supported & AVX512 ? "YES" : "NO ");
+    printf("CPU supports WAITPKG: [%s]\n", isas_supported & WAITPKG ? "YES" : "NO ");
     printf("tsc_freq = %.1f MHz (%s)\n", RdtscClock::tsc_freq() / 1000000.0, get_tsc_cal_info(arg_force_tsc_cal));
+    auto probe_start = std::chrono::steady_clock::now();
     std::vector<int> cpus = get_cpus();
     printf("CPU brand string: %s\n", get_brand_string().c_str());
     printf("%lu available CPUs: [%s]\n", cpus.size(), join(cpus, ", ").c_str());
@@ -757,36 +3403,165 @@ int main(int argc, char** argv) {
         cpus = filter_cpus(cpus);
         printf("%lu physical cores: [%s]\n", cpus.size(), join(cpus, ", ").c_str());
     }
+    double probe_ms = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - probe_start).count();
+
+    auto audit = audit_environment("/", cpus, arg_audit_ms.Get());
+    printf("Environment audit:\n%s", audit.to_string().c_str());
+    std::vector<std::string> mitigations;
+    if (arg_mitigate) {
+        mitigations = mitigate_environment("/", cpus);
+        for (auto& m : mitigations) {
+            printf("Mitigation: %s\n", m.c_str());
+        }
+        if (!mitigations.empty()) {
+            audit = audit_environment("/", cpus, 0);
+            printf("Environment after mitigation:\n%s", audit.to_string().c_str());
+        }
+    }
+
+    std::unique_ptr<csv_writer> output;
+    if (arg_output) {
+        output.reset(new csv_writer(arg_output.Get()));
+        output->meta("info", "brand", get_brand_string());
+        output->meta("info", "tsc_mhz", table::string_format("%.1f", RdtscClock::tsc_freq() / 1000000.0));
+        output->audit(audit);
+        for (auto& m : mitigations) {
+            output->meta("mitigation", "change", m);
+        }
+        output->header();
+    }
 
     auto iters = arg_iters.Get();
     zeroupper();
+
+    if (arg_spin_wait) {
+        run_spin_wait(isas_supported, cpus, use_aperf);
+        return EXIT_SUCCESS;
+    }
+
+    if (arg_c2c) {
+        run_c2c(isas_supported, cpus);
+        return EXIT_SUCCESS;
+    }
+
+    if (arg_wake) {
+        run_wake_latency(isas_supported, cpus);
+        return EXIT_SUCCESS;
+    }
+
+    if (arg_mem) {
+        run_mem_bench(isas_supported, cpus, use_aperf);
+        return EXIT_SUCCESS;
+    }
+
+    if (arg_fmeter) {
+        run_freq_meter(isas_supported, cpus, use_aperf);
+        return EXIT_SUCCESS;
+    }
+
+    if (arg_attach || arg_attach_cgroup) {
+        run_attach(cpus, output.get());
+        return EXIT_SUCCESS;
+    }
+
+    // thread i of a spec is pinned to the i-th selected cpu
+    const std::vector<int>& pin_cpus = cpus;
+
+    std::unique_ptr<rt_watchdog> rt_holder;
+    if (arg_rt_priority) {
+        size_t used = arg_max_threads ? std::min((size_t)arg_max_threads.Get(), pin_cpus.size()) : pin_cpus.size();
+        rt_holder = setup_rt_isolation(std::vector<int>(pin_cpus.begin(), pin_cpus.begin() + used));
+        watchdog = rt_holder.get();
+    }
+
+    double startup_ms = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - main_start).count();
+    printf("Startup: %.1f ms to the first measurement (%.1f ms getting the CPU topology)\n", startup_ms, probe_ms);
+    if (output) {
+        output->meta("info", "startup_ms", table::string_format("%.1f", startup_ms));
+        output->meta("info", "topology_ms", table::string_format("%.1f", probe_ms));
+    }
+
+    if (arg_agent) {
+        run_agent(isas_supported, pin_cpus, use_aperf);
+        return EXIT_SUCCESS;
+    }
+
     auto specs = filter_tests(isas_supported, cpus);
 
     size_t last_thread_count = -1u;
     std::vector<result_holder> results_list;
-    for (auto& spec : specs) {
+    auto emit = [&](const result_holder& holder) {
         // if we changed the number of threads, spit out the accumulated output
-        if (last_thread_count != -1u && last_thread_count != spec.count()) {
+        if (last_thread_count != -1u && last_thread_count != holder.spec->count()) {
             // time to print results
             report_results(results_list, use_aperf);
             results_list.clear();
         }
-        last_thread_count = spec.count();
+        last_thread_count = holder.spec->count();
+        results_list.push_back(holder);
+        if (output) {
+            output->write(holder);
+        }
+    };
 
-        assert(!spec.thread_funcs.empty());
-        if (verbose) printf("Running test spec: %s\n", spec.to_string().c_str());
+    if (arg_bw) {
+        run_bw_neighbor(isas_supported, cpus, pin_cpus, use_aperf);
+        return EXIT_SUCCESS;
+    }
 
-        // run
-        std::deque<test_thread> threads;
-        hot_barrier start{spec.count()}, stop{spec.count()};
-        for (auto& test : spec.thread_funcs) {
-            threads.emplace_back(threads.size(), start, stop, &test, iters, use_aperf);
-        }
+    if (arg_roofline) {
+        run_roofline(isas_supported, pin_cpus, use_aperf);
+        return EXIT_SUCCESS;
+    }
+
+    if (arg_prefetch) {
+        run_prefetch_sweep(specs, pin_cpus, iters, use_aperf);
+        return EXIT_SUCCESS;
+    }
+
+    if (arg_resctrl) {
+        run_resctrl(specs, pin_cpus, iters, use_aperf);
+        return EXIT_SUCCESS;
+    }
 
-        results_list.emplace_back(&spec);
-        for (auto& t : threads) {
-            t.thread.join();
-            results_list.back().results.push_back(t.res);
+    if (arg_pkg_parallel) {
+        if (arg_no_pin) {
+            printf("ERROR: --parallel-packages needs CPU pinning\n");
+            exit(EXIT_FAILURE);
+        }
+        for (auto& holder : run_specs_on_packages(isas_supported, specs, cpus, iters, use_aperf)) {
+            emit(holder);
+        }
+    } else {
+        std::unique_ptr<reference_probe> ref;
+        if (arg_ref_every) {
+            if (arg_no_pin || arg_ref_every.Get() == 0) {
+                printf("ERROR: --ref-probe needs CPU pinning and a non-zero spec count\n");
+                exit(EXIT_FAILURE);
+            }
+            ref.reset(new reference_probe(pin_cpus, use_aperf));
+            ref->probe(iters, output.get());
+        }
+        for (size_t i = 0; i < specs.size(); i++) {
+            auto& spec = specs[i];
+            assert(!spec.thread_funcs.empty());
+            if (verbose) printf("Running test spec: %s\n", spec.to_string().c_str());
+            auto holder = run_spec_within_budget(spec, pin_cpus, iters, use_aperf);
+            if (ref) {
+                holder.ref_drift = ref->drift();
+                if (arg_ref_normalize) {
+                    for (auto& r : holder.results) {
+                        r.inner.mops /= holder.ref_drift;
+                    }
+                }
+            }
+            emit(holder);
+            if (ref && (i + 1) % arg_ref_every.Get() == 0) {
+                ref->probe(iters, output.get());
+            }
+        }
+        if (ref) {
+            ref->summary();
         }
     }
 
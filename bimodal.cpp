@@ -0,0 +1,60 @@
+/*
+ * bimodal.cpp
+ */
+
+#include "bimodal.hpp"
+
+#include <algorithm>
+#include <cmath>
+
+bimodal_fit fit_two_modes(double* values, size_t n) {
+    bimodal_fit ret;
+    size_t min_count = std::max((size_t)2, (size_t)std::ceil(n * BIMODAL_MIN_WEIGHT));
+    if (n < 2 * min_count) {
+        return ret;
+    }
+    std::sort(values, values + n);
+
+    double total = 0, total_sq = 0;
+    for (size_t i = 0; i < n; i++) {
+        total += values[i];
+        total_sq += values[i] * values[i];
+    }
+
+    // scan the split points, keeping running sums for the low side
+    double best_sse = std::numeric_limits<double>::infinity(), low_sum = 0, low_sq = 0;
+    size_t best = 0;
+    for (size_t k = 1; k < n; k++) {
+        low_sum += values[k - 1];
+        low_sq += values[k - 1] * values[k - 1];
+        if (k < min_count || n - k < min_count) {
+            continue;
+        }
+        double high_sum = total - low_sum, high_sq = total_sq - low_sq;
+        double sse = (low_sq - low_sum * low_sum / k) + (high_sq - high_sum * high_sum / (n - k));
+        if (sse < best_sse) {
+            best_sse = sse;
+            best = k;
+        }
+    }
+
+    double low_sum_b = 0, low_sq_b = 0, low_time = 0, all_time = 0;
+    for (size_t i = 0; i < n; i++) {
+        if (i < best) {
+            low_sum_b += values[i];
+            low_sq_b += values[i] * values[i];
+            low_time += values[i] > 0 ? 1 / values[i] : 0;
+        }
+        all_time += values[i] > 0 ? 1 / values[i] : 0;
+    }
+    size_t nl = best, nh = n - best;
+    ret.low = low_sum_b / nl;
+    ret.high = (total - low_sum_b) / nh;
+    double var_low = std::max(low_sq_b / nl - ret.low * ret.low, 0.0);
+    double var_high = std::max((total_sq - low_sq_b) / nh - ret.high * ret.high, 0.0);
+    double spread = std::sqrt(var_low + var_high);
+    ret.d = spread > 0 ? std::sqrt(2.0) * (ret.high - ret.low) / spread : std::numeric_limits<double>::infinity();
+    ret.low_time = all_time > 0 ? low_time / all_time : bimodal_fit::nan;
+    ret.bimodal = ret.d > BIMODAL_MIN_D && ret.high > 0 && (ret.high - ret.low) / ret.high > BIMODAL_MIN_GAP;
+    return ret;
+}
@@ -0,0 +1,46 @@
+/*
+ * bimodal.hpp
+ *
+ * Detecting specs that flap between two frequencies (e.g., near a turbo bin or license boundary) from
+ * the per-try samples of run_test, which the median hides by picking one of the modes.
+ */
+
+#ifndef BIMODAL_HPP_
+#define BIMODAL_HPP_
+
+#include <cstddef>
+#include <limits>
+
+/*
+ * Ashman's D above which two fitted components count as separate modes. The usual threshold is 2 for a proper
+ * mixture fit, but splitting unimodal samples in two already gives about 2.7 for a normal and 3.5 for a uniform
+ * distribution, so we need more.
+ */
+constexpr double BIMODAL_MIN_D = 4.0;
+
+/* the smallest share of the samples the lesser mode must have */
+constexpr double BIMODAL_MIN_WEIGHT = 0.1;
+
+/* the smallest gap between the modes, relative to the higher one, so that very tight distributions aren't flagged */
+constexpr double BIMODAL_MIN_GAP = 0.02;
+
+/** a two-component fit of a set of samples */
+struct bimodal_fit {
+    static constexpr double nan = std::numeric_limits<double>::quiet_NaN();
+
+    bool bimodal = false;
+    double low = nan, high = nan;  // the mean of each mode
+    double low_time = nan;         // the fraction of the time spent in the low mode
+    double d = 0;                  // Ashman's D: the separation of the modes relative to their spread
+};
+
+/**
+ * Fit two components to the n samples by the split of the sorted samples which minimizes the within-component
+ * variance (a 1-D two-means fit), and decide whether they are distinct modes from Ashman's D, the weight of the
+ * smaller component and the gap between the means. The samples are rates for a fixed amount of work (e.g., Mops
+ * per try), so each one's time is taken to be proportional to its inverse. values is sorted in place, and nothing
+ * is allocated.
+ */
+bimodal_fit fit_two_modes(double* values, size_t n);
+
+#endif /* BIMODAL_HPP_ */
@@ -0,0 +1,128 @@
+/*
+ * cleanup.cpp
+ */
+
+#include "cleanup.hpp"
+
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstdlib>
+#include <mutex>
+#include <thread>
+#include <utility>
+#include <vector>
+
+#include <pthread.h>
+#include <signal.h>
+
+namespace {
+
+std::vector<std::pair<size_t, std::function<void()>>> actions;
+std::recursive_mutex actions_mutex;
+size_t next_id = 0;
+
+/* set by the signal thread, under work_mutex, before it runs the actions */
+std::atomic<bool> exiting{false};
+std::mutex work_mutex;
+std::condition_variable work_cv;
+size_t open_scopes = 0;
+
+/* how long the signal thread waits for the open work_scopes before running the actions anyway */
+constexpr std::chrono::seconds DRAIN_TIMEOUT{5};
+
+/* the signal mask from before init_cleanup, restored in forked children */
+sigset_t original_mask;
+
+/*
+ * SIGABRT isn't included: abort() unblocks and raises it synchronously in the aborting thread, so it can't
+ * be waited for, and nothing is safe to run at that point anyway.
+ */
+const int FATAL_SIGNALS[] = { SIGINT, SIGTERM, SIGHUP, SIGQUIT };
+
+sigset_t fatal_set() {
+    sigset_t set;
+    sigemptyset(&set);
+    for (int sig : FATAL_SIGNALS) {
+        sigaddset(&set, sig);
+    }
+    return set;
+}
+
+/* wait for a fatal signal, let the running work finish, run the actions, then die from the same signal */
+void signal_thread() {
+    sigset_t set = fatal_set();
+    int sig;
+    while (sigwait(&set, &sig)) {}
+    {
+        std::unique_lock<std::mutex> lock(work_mutex);
+        exiting = true;
+        work_cv.wait_for(lock, DRAIN_TIMEOUT, []{ return open_scopes == 0; });
+    }
+    run_cleanups();
+    struct sigaction dfl{};
+    dfl.sa_handler = SIG_DFL;
+    sigaction(sig, &dfl, nullptr);
+    sigset_t one;
+    sigemptyset(&one);
+    sigaddset(&one, sig);
+    pthread_sigmask(SIG_UNBLOCK, &one, nullptr);
+    raise(sig);
+}
+
+void restore_mask_in_child() {
+    pthread_sigmask(SIG_SETMASK, &original_mask, nullptr);
+}
+
+}
+
+void init_cleanup() {
+    sigset_t set = fatal_set();
+    pthread_sigmask(SIG_BLOCK, &set, &original_mask);
+    pthread_atfork(nullptr, nullptr, restore_mask_in_child);
+    std::thread(signal_thread).detach();
+    std::atexit(run_cleanups);
+}
+
+size_t register_cleanup(std::function<void()> action) {
+    std::lock_guard<std::recursive_mutex> lock(actions_mutex);
+    if (exiting) {
+        // the signal thread may have run the other actions already, so don't leave this one behind
+        action();
+        return next_id++;
+    }
+    actions.emplace_back(next_id, std::move(action));
+    return next_id++;
+}
+
+void unregister_cleanup(size_t id) {
+    std::lock_guard<std::recursive_mutex> lock(actions_mutex);
+    for (auto i = actions.begin(); i != actions.end(); i++) {
+        if (i->first == id) {
+            actions.erase(i);
+            return;
+        }
+    }
+}
+
+void run_cleanups() {
+    std::lock_guard<std::recursive_mutex> lock(actions_mutex);
+    while (!actions.empty()) {
+        auto action = std::move(actions.back().second);
+        actions.pop_back();
+        action();
+    }
+}
+
+work_scope::work_scope() {
+    std::unique_lock<std::mutex> lock(work_mutex);
+    // after a signal no new work starts: this waits until the signal thread kills the process
+    work_cv.wait(lock, []{ return !exiting; });
+    open_scopes++;
+}
+
+work_scope::~work_scope() {
+    std::lock_guard<std::mutex> lock(work_mutex);
+    open_scopes--;
+    work_cv.notify_all();
+}
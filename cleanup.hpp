@@ -0,0 +1,49 @@
+/*
+ * cleanup.hpp
+ *
+ * Actions which must run before the process exits, e.g., to restore system settings we changed,
+ * even if we exit via exit() or are killed by a signal.
+ */
+
+#ifndef CLEANUP_HPP_
+#define CLEANUP_HPP_
+
+#include <cstddef>
+#include <functional>
+
+/**
+ * Install the signal handling for the cleanups: call this at the start of main, before any other thread is
+ * created. The common termination signals (SIGINT, SIGTERM, SIGHUP, SIGQUIT) are then blocked in every
+ * thread, and a dedicated thread waits for them with sigwait. On a signal it stops new work_scopes from
+ * starting, waits (for a few seconds at most) for the running ones to finish, runs the actions and then
+ * re-raises the signal. So the actions run in an ordinary thread, not in signal context, and may take locks
+ * and do I/O. The actions also run at a normal exit. Forked children get the original signal mask back.
+ */
+void init_cleanup();
+
+/**
+ * Register an action to run at exit, returning an id for unregister_cleanup. Actions run in reverse order
+ * of registration, and each runs at most once. An action registered after a signal has already run the
+ * others runs immediately.
+ */
+size_t register_cleanup(std::function<void()> action);
+
+/** forget the action with the given id without running it, if it hasn't run yet */
+void unregister_cleanup(size_t id);
+
+/** run (and forget) all the registered actions now */
+void run_cleanups();
+
+/**
+ * Marks a thread as doing work which the cleanups could break, such as measuring inside a resctrl group:
+ * after a signal, the cleanups wait for the open scopes to close, and opening a new one blocks until the
+ * process dies.
+ */
+struct work_scope {
+    work_scope();
+    ~work_scope();
+    work_scope(const work_scope&) = delete;
+    void operator=(const work_scope&) = delete;
+};
+
+#endif /* CLEANUP_HPP_ */
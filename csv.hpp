@@ -0,0 +1,68 @@
+/*
+ * csv.hpp
+ *
+ * Minimal CSV writing and reading for the structured result files.
+ */
+
+#ifndef CSV_HPP_
+#define CSV_HPP_
+
+#include <string>
+#include <vector>
+
+/**
+ * Quote the field if it contains a comma, quote or newline, doubling any embedded quotes.
+ */
+static inline std::string csv_escape(const std::string& field) {
+    if (field.find_first_of(",\"\n") == std::string::npos) {
+        return field;
+    }
+    std::string ret = "\"";
+    for (char c : field) {
+        if (c == '"') ret += '"';
+        ret += c;
+    }
+    return ret + '"';
+}
+
+/**
+ * Join the fields into one CSV line (without the trailing newline), escaping as needed.
+ */
+static inline std::string csv_line(const std::vector<std::string>& fields) {
+    std::string ret;
+    for (auto& f : fields) {
+        if (&f != &fields.front()) ret += ',';
+        ret += csv_escape(f);
+    }
+    return ret;
+}
+
+/**
+ * Split one CSV line into fields, handling the quoting produced by csv_escape.
+ */
+static inline std::vector<std::string> parse_csv_line(const std::string& line) {
+    std::vector<std::string> fields(1);
+    bool quoted = false;
+    for (size_t i = 0; i < line.size(); i++) {
+        char c = line[i];
+        if (quoted) {
+            if (c == '"' && i + 1 < line.size() && line[i + 1] == '"') {
+                fields.back() += '"';
+                i++;
+            } else if (c == '"') {
+                quoted = false;
+            } else {
+                fields.back() += c;
+            }
+        } else if (c == '"') {
+            quoted = true;
+        } else if (c == ',') {
+            fields.emplace_back();
+        } else if (c != '\r') {
+            fields.back() += c;
+        }
+    }
+    return fields;
+}
+
+#endif /* CSV_HPP_ */
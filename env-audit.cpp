@@ -0,0 +1,273 @@
+/*
+ * env-audit.cpp
+ */
+
+#include "env-audit.hpp"
+#include "cleanup.hpp"
+#include "util.hpp"
+
+#include <algorithm>
+#include <cctype>
+#include <chrono>
+#include <cstring>
+#include <fstream>
+#include <map>
+#include <mutex>
+#include <sstream>
+#include <thread>
+#include <utility>
+
+#include <errno.h>
+
+/* a cpu busier than this percent during the load sample gets a warning */
+constexpr double BUSY_WARN_PCT = 5.0;
+
+std::vector<int> parse_cpu_list(const std::string& list) {
+    std::vector<int> ret;
+    for (auto& elem : split(list, ",")) {
+        if (elem.find_first_not_of(" \t\n") == std::string::npos) {
+            continue;
+        }
+        auto range = split(elem, "-");
+        int first = std::atoi(range[0].c_str()), last = range.size() > 1 ? std::atoi(range[1].c_str()) : first;
+        for (int cpu = first; cpu <= last; cpu++) {
+            ret.push_back(cpu);
+        }
+    }
+    return ret;
+}
+
+std::string selected_choice(const std::string& choices) {
+    auto open = choices.find('['), close = choices.find(']');
+    if (open == std::string::npos || close == std::string::npos || close < open) {
+        return choices;
+    }
+    return choices.substr(open + 1, close - open - 1);
+}
+
+std::string env_audit::to_string() const {
+    size_t width = 0;
+    for (auto& i : items) {
+        width = std::max(width, i.name.size());
+    }
+    std::string ret;
+    for (auto& i : items) {
+        ret += i.name + std::string(width - i.name.size(), ' ') + " : " + i.value;
+        if (!i.warning.empty()) {
+            ret += "  [WARNING: " + i.warning + "]";
+        }
+        ret += '\n';
+    }
+    return ret;
+}
+
+namespace {
+
+bool exists(const std::string& path) {
+    return std::ifstream(path).good();
+}
+
+std::string cpu_path(const std::string& root, int cpu, const std::string& rest) {
+    return root + "sys/devices/system/cpu/cpu" + std::to_string(cpu) + "/" + rest;
+}
+
+std::string list_string(const std::vector<int>& cpus) {
+    return cpus.empty() ? "none" : join(cpus, ",");
+}
+
+struct cpu_times {
+    uint64_t busy = 0, total = 0;
+};
+
+std::map<int, cpu_times> read_proc_stat(const std::string& root) {
+    std::map<int, cpu_times> ret;
+    std::ifstream in(root + "proc/stat");
+    std::string line;
+    while (std::getline(in, line)) {
+        if (line.compare(0, 3, "cpu") != 0 || line.size() < 4 || !isdigit(line[3])) {
+            continue;
+        }
+        std::istringstream fields(line.substr(3));
+        int cpu;
+        fields >> cpu;
+        cpu_times t;
+        uint64_t v;
+        for (int i = 0; fields >> v; i++) {
+            t.total += v;
+            // fields 3 and 4 are idle and iowait
+            if (i != 3 && i != 4) {
+                t.busy += v;
+            }
+        }
+        ret[cpu] = t;
+    }
+    return ret;
+}
+
+/* summarize per-cpu values as "value" if they are all the same, otherwise as "v1 (cpus a,b), v2 (cpus c)" */
+std::string group_values(const std::vector<std::pair<int, std::string>>& values) {
+    std::map<std::string, std::vector<int>> groups;
+    for (auto& v : values) {
+        groups[v.second].push_back(v.first);
+    }
+    if (groups.size() == 1) {
+        return groups.begin()->first;
+    }
+    std::string ret;
+    for (auto& g : groups) {
+        ret += (ret.empty() ? "" : ", ") + g.first + " (cpus " + join(g.second, ",") + ")";
+    }
+    return ret;
+}
+
+/* the original values of files changed by mitigate_environment */
+std::vector<std::pair<std::string, std::string>> saved_values;
+std::mutex saved_mutex;
+
+}
+
+env_audit audit_environment(const std::string& root, const std::vector<int>& cpus, unsigned load_sample_ms) {
+    env_audit audit;
+
+    std::vector<std::pair<int, std::string>> governors;
+    for (int cpu : cpus) {
+        auto gov = read_line(cpu_path(root, cpu, "cpufreq/scaling_governor"));
+        governors.emplace_back(cpu, gov.empty() ? "n/a" : gov);
+    }
+    auto& gov = audit.add("cpufreq governor", group_values(governors));
+    if (gov.value != "performance" && gov.value != "n/a") {
+        gov.warning = "not using the performance governor on all cpus";
+    }
+
+    if (!cpus.empty()) {
+        auto driver = read_line(cpu_path(root, cpus.front(), "cpufreq/scaling_driver"));
+        audit.add("cpufreq driver", driver.empty() ? "n/a" : driver);
+    }
+
+    auto no_turbo = read_line(root + "sys/devices/system/cpu/intel_pstate/no_turbo");
+    auto& nt = audit.add("intel_pstate no_turbo", no_turbo.empty() ? "n/a" : no_turbo);
+    if (no_turbo == "1") {
+        nt.warning = "turbo is disabled";
+    }
+
+    auto boost = read_line(root + "sys/devices/system/cpu/cpufreq/boost");
+    auto& b = audit.add("cpufreq boost", boost.empty() ? "n/a" : boost);
+    if (boost == "0") {
+        b.warning = "boost is disabled";
+    }
+
+    auto smt_control = read_line(root + "sys/devices/system/cpu/smt/control");
+    auto smt_active  = read_line(root + "sys/devices/system/cpu/smt/active");
+    audit.add("SMT control/active", (smt_control.empty() ? "n/a" : smt_control) + "/" + (smt_active.empty() ? "n/a" : smt_active));
+
+    for (const char* name : {"isolated", "nohz_full"}) {
+        auto listed = parse_cpu_list(read_line(root + "sys/devices/system/cpu/" + name));
+        std::vector<int> missing;
+        for (int cpu : cpus) {
+            if (std::find(listed.begin(), listed.end(), cpu) == listed.end()) {
+                missing.push_back(cpu);
+            }
+        }
+        auto& i = audit.add(name, list_string(listed));
+        if (!listed.empty() && !missing.empty()) {
+            i.warning = "selected cpus " + list_string(missing) + " are not in the " + name + " list";
+        }
+    }
+
+    auto thp = read_line(root + "sys/kernel/mm/transparent_hugepage/enabled");
+    audit.add("transparent hugepages", thp.empty() ? "n/a" : selected_choice(thp));
+
+    if (load_sample_ms) {
+        auto before = read_proc_stat(root);
+        std::this_thread::sleep_for(std::chrono::milliseconds(load_sample_ms));
+        auto after = read_proc_stat(root);
+        double max_busy = 0;
+        int max_cpu = -1;
+        std::vector<int> busy_cpus;
+        for (int cpu : cpus) {
+            if (!before.count(cpu) || !after.count(cpu)) {
+                continue;
+            }
+            auto total = after[cpu].total - before[cpu].total, busy = after[cpu].busy - before[cpu].busy;
+            double pct = total ? 100.0 * busy / total : 0.0;
+            if (pct > max_busy || max_cpu == -1) {
+                max_busy = pct;
+                max_cpu = cpu;
+            }
+            if (pct > BUSY_WARN_PCT) {
+                busy_cpus.push_back(cpu);
+            }
+        }
+        if (max_cpu == -1) {
+            audit.add("background load", "n/a");
+        } else {
+            char buf[64];
+            snprintf(buf, sizeof(buf), "max %.1f%% busy (cpu %d)", max_busy, max_cpu);
+            auto& l = audit.add("background load", buf);
+            if (!busy_cpus.empty()) {
+                l.warning = "cpus " + list_string(busy_cpus) + " are busy with other work";
+            }
+        }
+    }
+
+    return audit;
+}
+
+namespace {
+
+/* write value to path, saving the original value for restore_environment, and describe what happened */
+std::string change_value(const std::string& path, const std::string& value) {
+    auto old = read_line(path);
+    if (old == value) {
+        return "";
+    }
+    if (int e = write_value(path, value)) {
+        return "failed to set " + path + " to " + value + ": " + strerror(e);
+    }
+    bool first;
+    {
+        std::lock_guard<std::mutex> lock(saved_mutex);
+        first = saved_values.empty();
+        saved_values.emplace_back(path, old);
+    }
+    if (first) {
+        register_cleanup(restore_environment);
+    }
+    return "set " + path + " to " + value + " (was " + old + ")";
+}
+
+}
+
+std::vector<std::string> mitigate_environment(const std::string& root, const std::vector<int>& cpus) {
+    std::vector<std::string> changes;
+    auto record = [&](std::string change){ if (!change.empty()) changes.push_back(change); };
+
+    for (int cpu : cpus) {
+        auto path = cpu_path(root, cpu, "cpufreq/scaling_governor");
+        if (exists(path)) {
+            record(change_value(path, "performance"));
+        }
+    }
+
+    auto no_turbo = root + "sys/devices/system/cpu/intel_pstate/no_turbo";
+    if (exists(no_turbo)) {
+        record(change_value(no_turbo, "0"));
+    }
+
+    auto boost = root + "sys/devices/system/cpu/cpufreq/boost";
+    if (exists(boost)) {
+        record(change_value(boost, "1"));
+    }
+
+    return changes;
+}
+
+void restore_environment() {
+    std::lock_guard<std::mutex> lock(saved_mutex);
+    // restore in reverse order in case the same file was changed more than once
+    while (!saved_values.empty()) {
+        auto& saved = saved_values.back();
+        write_value(saved.first, saved.second);
+        saved_values.pop_back();
+    }
+}
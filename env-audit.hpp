@@ -0,0 +1,66 @@
+/*
+ * env-audit.hpp
+ *
+ * Checks the system settings which affect the stability of frequency measurements (governor, turbo,
+ * SMT, isolation, THP and background load) and optionally changes some of them for the duration of
+ * the run.
+ */
+
+#ifndef ENV_AUDIT_HPP_
+#define ENV_AUDIT_HPP_
+
+#include <string>
+#include <vector>
+
+/**
+ * Parse a linux cpu list like "0-3,8,10-11" (as found in /sys/devices/system/cpu/isolated and
+ * friends) into the list of cpus. An empty string gives an empty list.
+ */
+std::vector<int> parse_cpu_list(const std::string& list);
+
+/**
+ * Given a sysfs "choice" string like "always [madvise] never", return the selected (bracketed)
+ * value, or the whole string if nothing is bracketed.
+ */
+std::string selected_choice(const std::string& choices);
+
+struct env_audit {
+    struct item {
+        std::string name;
+        std::string value;
+        std::string warning; // empty if the value looks fine for benchmarking
+    };
+
+    std::vector<item> items;
+
+    /** add an item, returning it so a warning can be attached */
+    item& add(const std::string& name, const std::string& value) {
+        items.push_back({name, value, ""});
+        return items.back();
+    }
+
+    /** human readable, one item per line */
+    std::string to_string() const;
+};
+
+/**
+ * Audit the environment for the given cpus. All paths are relative to root ("/" in normal use) so that
+ * the logic can run against a fake directory tree. If load_sample_ms is non-zero, the busy percentage of
+ * each cpu is sampled from proc/stat for that long.
+ */
+env_audit audit_environment(const std::string& root, const std::vector<int>& cpus, unsigned load_sample_ms);
+
+/**
+ * Set the performance governor on the given cpus and enable turbo, recording the original values so that
+ * they are restored when the process exits (normally or via a fatal signal). Returns a description
+ * of each change made. Paths are relative to root, as in audit_environment.
+ */
+std::vector<std::string> mitigate_environment(const std::string& root, const std::vector<int>& cpus);
+
+/**
+ * Restore the values changed by mitigate_environment. This is called automatically at exit, but can be called
+ * earlier. Calling it more than once is harmless.
+ */
+void restore_environment();
+
+#endif /* ENV_AUDIT_HPP_ */
@@ -0,0 +1,303 @@
+/*
+ * freq-model.cpp
+ */
+
+#include "freq-model.hpp"
+#include "csv.hpp"
+
+#include <algorithm>
+#include <cmath>
+#include <cstdio>
+#include <iterator>
+#include <istream>
+#include <limits>
+#include <ostream>
+#include <stdexcept>
+
+license_class license_of(const std::string& test_id) {
+    if (test_id.compare(0, 7, "avx512_") == 0) {
+        return LICENSE_AVX512;
+    }
+    if (test_id.compare(0, 7, "avx256_") == 0) {
+        return LICENSE_AVX2;
+    }
+    return LICENSE_SCALAR;
+}
+
+const char* license_name(license_class c) {
+    switch (c) {
+    case LICENSE_SCALAR: return "scalar";
+    case LICENSE_AVX2:   return "avx2";
+    case LICENSE_AVX512: return "avx512";
+    default:             return "unknown";
+    }
+}
+
+license_class parse_license(const std::string& name) {
+    for (int c = 0; c < LICENSE_COUNT; c++) {
+        if (name == license_name((license_class)c)) {
+            return (license_class)c;
+        }
+    }
+    throw std::runtime_error("unknown license class: '" + name + "'");
+}
+
+namespace {
+
+/* the index of each of the named columns in header, throwing if any is missing */
+std::vector<size_t> find_columns(const std::vector<std::string>& header, const std::vector<std::string>& names) {
+    std::vector<size_t> ret;
+    for (auto& name : names) {
+        auto i = std::find(header.begin(), header.end(), name);
+        if (i == header.end()) {
+            throw std::runtime_error("missing column: " + name);
+        }
+        ret.push_back(i - header.begin());
+    }
+    return ret;
+}
+
+}
+
+std::vector<model_sample> read_result_samples(std::istream& in) {
+    std::vector<model_sample> ret;
+    std::vector<size_t> cols;
+    std::string line;
+
+    // the threads of the current spec: class and mhz (NaN if not measured)
+    std::vector<std::pair<license_class, double>> spec;
+    auto flush = [&]{
+        license_counts counts{};
+        for (auto& t : spec) {
+            counts[t.first]++;
+        }
+        for (auto& t : spec) {
+            if (!std::isnan(t.second)) {
+                ret.push_back({counts, t.first, t.second});
+            }
+        }
+        spec.clear();
+    };
+
+    while (std::getline(in, line)) {
+        if (line.empty() || line[0] == '#') {
+            continue;
+        }
+        auto fields = parse_csv_line(line);
+        if (cols.empty()) {
+            cols = find_columns(fields, {"thread", "test", "mhz"});
+            continue;
+        }
+        if (fields.size() <= *std::max_element(cols.begin(), cols.end())) {
+            throw std::runtime_error("short row: " + line);
+        }
+        if (fields[cols[0]] == "0") {
+            flush();
+        }
+        auto& mhz = fields[cols[2]];
+        spec.emplace_back(license_of(fields[cols[1]]), mhz.empty() ? std::numeric_limits<double>::quiet_NaN() : std::stod(mhz));
+    }
+    flush();
+    return ret;
+}
+
+int total_active(const license_counts& counts) {
+    int total = 0;
+    for (int c : counts) {
+        total += c;
+    }
+    return total;
+}
+
+license_class max_active(const license_counts& counts) {
+    int max = LICENSE_SCALAR;
+    for (int c = 0; c < LICENSE_COUNT; c++) {
+        if (counts[c]) {
+            max = c;
+        }
+    }
+    return (license_class)max;
+}
+
+freq_model freq_model::fit(const std::vector<model_sample>& samples) {
+    freq_model model;
+    for (auto& s : samples) {
+        auto& e = model.table[{s.own, s.counts}];
+        e.mhz += s.mhz;
+        e.samples++;
+    }
+    for (auto& e : model.table) {
+        e.second.mhz /= e.second.samples;
+    }
+    for (auto& s : samples) {
+        auto& e = model.table[{s.own, s.counts}];
+        e.rms_residual += (s.mhz - e.mhz) * (s.mhz - e.mhz);
+    }
+    for (auto& e : model.table) {
+        e.second.rms_residual = std::sqrt(e.second.rms_residual / e.second.samples);
+    }
+    return model;
+}
+
+namespace {
+
+/* linearly interpolate points (x -> y) at x, clamping outside them, or NaN if there are none */
+double interpolate(const std::map<int, double>& points, int x) {
+    if (points.empty()) {
+        return std::numeric_limits<double>::quiet_NaN();
+    }
+    auto hi = points.lower_bound(x);
+    if (hi == points.end()) {
+        return std::prev(hi)->second;
+    }
+    if (hi->first == x || hi == points.begin()) {
+        return hi->second;
+    }
+    auto lo = std::prev(hi);
+    double t = double(x - lo->first) / (hi->first - lo->first);
+    return lo->second + t * (hi->second - lo->second);
+}
+
+}
+
+double freq_model::predict(license_class own, const license_counts& counts) const {
+    auto exact = table.find({own, counts});
+    if (exact != table.end()) {
+        return exact->second.mhz;
+    }
+
+    // along the count of one class, the others held fixed, but not to or from zero cores in the class
+    for (int c = LICENSE_COUNT - 1; c >= 0; c--) {
+        std::map<int, double> points;
+        for (auto& e : table) {
+            auto other = e.first.counts;
+            other[c] = counts[c];
+            if (e.first.own == own && other == counts && (e.first.counts[c] > 0) == (counts[c] > 0)) {
+                points[e.first.counts[c]] = e.second.mhz;
+            }
+        }
+        if (!points.empty()) {
+            return interpolate(points, counts[c]);
+        }
+    }
+
+    // along the total, over the mixes with the same own and highest class (sample-weighted at each total)
+    std::map<int, std::pair<double, size_t>> sums;
+    for (auto& e : table) {
+        if (e.first.own == own && max_active(e.first.counts) == max_active(counts)) {
+            auto& sum = sums[total_active(e.first.counts)];
+            sum.first += e.second.mhz * e.second.samples;
+            sum.second += e.second.samples;
+        }
+    }
+    std::map<int, double> points;
+    for (auto& s : sums) {
+        points[s.first] = s.second.first / s.second.second;
+    }
+    return interpolate(points, total_active(counts));
+}
+
+std::array<double, LICENSE_COUNT> freq_model::predict(int ncores_avx512, int ncores_avx2, int ncores_scalar) const {
+    license_counts counts{};
+    counts[LICENSE_AVX512] = ncores_avx512;
+    counts[LICENSE_AVX2]   = ncores_avx2;
+    counts[LICENSE_SCALAR] = ncores_scalar;
+    std::array<double, LICENSE_COUNT> ret;
+    for (int c = 0; c < LICENSE_COUNT; c++) {
+        ret[c] = counts[c] ? predict((license_class)c, counts) : std::numeric_limits<double>::quiet_NaN();
+    }
+    return ret;
+}
+
+std::vector<double> freq_model::residuals(const std::vector<model_sample>& samples) const {
+    std::vector<double> ret;
+    for (auto& s : samples) {
+        ret.push_back(s.mhz - predict(s.own, s.counts));
+    }
+    return ret;
+}
+
+void freq_model::write(std::ostream& out) const {
+    out << csv_line({"own", "n_avx512", "n_avx2", "n_scalar", "mhz", "samples", "rms_residual"}) << '\n';
+    for (auto& e : table) {
+        char mhz[32], rms[32];
+        snprintf(mhz, sizeof(mhz), "%.1f", e.second.mhz);
+        snprintf(rms, sizeof(rms), "%.1f", e.second.rms_residual);
+        auto& counts = e.first.counts;
+        out << csv_line({license_name(e.first.own), std::to_string(counts[LICENSE_AVX512]), std::to_string(counts[LICENSE_AVX2]),
+                std::to_string(counts[LICENSE_SCALAR]), mhz, std::to_string(e.second.samples), rms}) << '\n';
+    }
+}
+
+freq_model freq_model::read(std::istream& in) {
+    freq_model model;
+    std::string line;
+    std::vector<size_t> cols;
+    while (std::getline(in, line)) {
+        if (line.empty() || line[0] == '#') {
+            continue;
+        }
+        auto fields = parse_csv_line(line);
+        if (cols.empty()) {
+            cols = find_columns(fields, {"own", "n_avx512", "n_avx2", "n_scalar", "mhz", "samples", "rms_residual"});
+            continue;
+        }
+        if (fields.size() <= *std::max_element(cols.begin(), cols.end())) {
+            throw std::runtime_error("short row: " + line);
+        }
+        key k{parse_license(fields[cols[0]]), {}};
+        k.counts[LICENSE_AVX512] = std::stoi(fields[cols[1]]);
+        k.counts[LICENSE_AVX2]   = std::stoi(fields[cols[2]]);
+        k.counts[LICENSE_SCALAR] = std::stoi(fields[cols[3]]);
+        model.table[k] = {std::stod(fields[cols[4]]), (size_t)std::stoul(fields[cols[5]]), std::stod(fields[cols[6]])};
+    }
+    if (cols.empty()) {
+        throw std::runtime_error("no model header found");
+    }
+    return model;
+}
+
+vector_freqs freqs_for(const freq_model& model, license_class vector, int active) {
+    license_counts scalar{}, vectors{}, mixed{};
+    scalar[LICENSE_SCALAR] = active;
+    vectors[vector] = active;
+    // one core in its scalar portion while the rest run vector code
+    mixed[LICENSE_SCALAR] = 1;
+    mixed[vector] = active - 1;
+    vector_freqs ret;
+    ret.scalar = model.predict(LICENSE_SCALAR, scalar);
+    ret.vector = model.predict(vector, vectors);
+    ret.scalar_mixed = active > 1 ? model.predict(LICENSE_SCALAR, mixed) : std::numeric_limits<double>::quiet_NaN();
+    if (std::isnan(ret.scalar_mixed)) {
+        // no mixed-license measurements: assume the scalar portion runs at the vector license frequency
+        ret.scalar_mixed = ret.vector;
+    }
+    return ret;
+}
+
+namespace {
+
+/* the fraction of time which isn't lost to transition halts */
+double unhalted(const vector_workload& w) {
+    return std::max(0.0, 1.0 - w.transitions_per_sec * w.transition_us / 1e6);
+}
+
+}
+
+double net_speedup(const vector_freqs& f, const vector_workload& w) {
+    // time per unit of work, normalized so the scalar version takes 1
+    double time = (1 - w.vector_fraction) * f.scalar / f.scalar_mixed + w.vector_fraction * f.scalar / (w.speedup * f.vector);
+    return unhalted(w) / time;
+}
+
+double breakeven_fraction(const vector_freqs& f, const vector_workload& w) {
+    // solve unhalted / ((1 - F) * a + F * b) = 1 for F
+    double a = f.scalar / f.scalar_mixed, b = f.scalar / (w.speedup * f.vector), target = unhalted(w);
+    if (a <= target) {
+        return 0;
+    }
+    if (b >= target) {
+        return std::numeric_limits<double>::infinity();
+    }
+    return (a - target) / (a - b);
+}
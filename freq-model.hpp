@@ -0,0 +1,137 @@
+/*
+ * freq-model.hpp
+ *
+ * A compact model of the frequency of a core as a function of its own license class and the mix of
+ * license classes running on the other active cores, fit from the CSV result files written with
+ * --output.
+ */
+
+#ifndef FREQ_MODEL_HPP_
+#define FREQ_MODEL_HPP_
+
+#include <array>
+#include <cstddef>
+#include <iosfwd>
+#include <map>
+#include <string>
+#include <tuple>
+#include <vector>
+
+/*
+ * The license classes, in increasing order of their frequency impact. Only the 256-bit and 512-bit tests
+ * are assumed to need a higher license: 128-bit and scalar tests run at the scalar license.
+ */
+enum license_class { LICENSE_SCALAR, LICENSE_AVX2, LICENSE_AVX512, LICENSE_COUNT };
+
+/** the license class of a test, from its id prefix */
+license_class license_of(const std::string& test_id);
+
+/** short name of a license class: scalar, avx2 or avx512 */
+const char* license_name(license_class c);
+
+/** the class with the given name, throwing std::runtime_error if there isn't one */
+license_class parse_license(const std::string& name);
+
+/* the number of active cores in each license class */
+using license_counts = std::array<int, LICENSE_COUNT>;
+
+/** one thread's measured frequency, along with the license mix of the spec it ran in */
+struct model_sample {
+    license_counts counts;
+    license_class own;
+    double mhz;
+};
+
+/**
+ * Read the samples from a result file written with --output: the '#' metadata lines are skipped, and each
+ * run of rows starting at thread 0 is one spec. Rows without a frequency (i.e., without APERF/MPERF) are
+ * skipped. Throws std::runtime_error if the required columns are missing.
+ */
+std::vector<model_sample> read_result_samples(std::istream& in);
+
+/**
+ * A piecewise linear model keyed on a core's own class and the full count of active cores in each class, so
+ * that, e.g., one AVX-512 core among three scalar ones is distinct from four AVX-512 cores. A mix which wasn't
+ * measured is predicted by linear interpolation (clamped at the ends) along the count of a single class,
+ * holding the others at their requested counts and never crossing zero cores in that class, trying the
+ * classes from the highest. If no measured mix
+ * differs in just one class, it falls back to interpolating along the total number of active cores among the
+ * mixes with the same own and highest active class.
+ */
+struct freq_model {
+    struct key {
+        license_class own;
+        license_counts counts; // including the core itself
+        bool operator<(const key& k) const { return std::tie(own, counts) < std::tie(k.own, k.counts); }
+    };
+
+    struct entry {
+        double mhz;          // mean of the samples
+        size_t samples;
+        double rms_residual; // of the samples around the fitted value
+    };
+
+    std::map<key, entry> table;
+
+    /** fit the model to the samples */
+    static freq_model fit(const std::vector<model_sample>& samples);
+
+    /** the modeled frequency of a core of class own alongside counts, or NaN if nothing comparable was measured */
+    double predict(license_class own, const license_counts& counts) const;
+
+    /**
+     * The predicted frequency of a core in each license class, given the number of active cores in each
+     * class. Classes with no active cores get NaN.
+     */
+    std::array<double, LICENSE_COUNT> predict(int ncores_avx512, int ncores_avx2, int ncores_scalar) const;
+
+    /** the residual (measured - modeled MHz) of each sample */
+    std::vector<double> residuals(const std::vector<model_sample>& samples) const;
+
+    /** write the lookup table as CSV, which read() accepts */
+    void write(std::ostream& out) const;
+
+    /** read a lookup table written by write(), throwing std::runtime_error on bad input */
+    static freq_model read(std::istream& in);
+};
+
+/** the total active cores in counts */
+int total_active(const license_counts& counts);
+
+/** the highest class with an active core in counts */
+license_class max_active(const license_counts& counts);
+
+/* the parameters of a workload for the vectorization break-even calculation */
+struct vector_workload {
+    double speedup;             // speedup of the vectorized portion at equal frequency, e.g., 4 for a 4x wider kernel
+    double vector_fraction;     // fraction of the scalar version's time spent in the vectorizable portion
+    double transitions_per_sec; // license transitions (each halting the core) per second
+    double transition_us;       // length of the halt at each transition
+};
+
+/**
+ * The frequencies seen by a vectorized workload: the scalar baseline, its vector portion, and its scalar
+ * portion while the vector license is active on the cores (which includes the effect of neighbors).
+ */
+struct vector_freqs {
+    double scalar;
+    double vector;
+    double scalar_mixed;
+};
+
+/** the vector_freqs for code of class vector on active cores, from model (NaN members if not modeled) */
+vector_freqs freqs_for(const freq_model& model, license_class vector, int active);
+
+/**
+ * The throughput of the vectorized workload relative to its scalar version, accounting for the lower
+ * frequencies and the transition halts. Above 1 means vectorizing helps.
+ */
+double net_speedup(const vector_freqs& f, const vector_workload& w);
+
+/**
+ * The vector fraction at which net_speedup is exactly 1, holding the other parameters constant: vectorizing
+ * helps for fractions above it. Returns 0 if it always helps and infinity if it never does.
+ */
+double breakeven_fraction(const vector_freqs& f, const vector_workload& w);
+
+#endif /* FREQ_MODEL_HPP_ */
@@ -43,47 +43,57 @@ void unlock(){}
 
 
 
-/* size of the rfile array */
-int  rfile_static[STATIC_ARRAY_SIZE] = {};
-int  rfile_size  = STATIC_ARRAY_SIZE;
-int *rfile_array = rfile_static;
-//int rfile_error;
-
-/** get the read-only file associated with the given cpu */
-int get_rfile(int cpu) {
+/* the read-only and read-write files, indexed by cpu */
+struct file_array {
+    int  statik[STATIC_ARRAY_SIZE];
+    int  size;
+    int *array;
+    int  flags;
+};
+
+struct file_array rfiles = { {0}, STATIC_ARRAY_SIZE, rfiles.statik, O_RDONLY };
+struct file_array wfiles = { {0}, STATIC_ARRAY_SIZE, wfiles.statik, O_RDWR };
+
+/** get the file associated with the given cpu in files, opening it if necessary */
+int get_file(struct file_array* files, int cpu) {
     assert(cpu >= 0);
 
     lock();
 
-    if (cpu >= rfile_size) {
+    if (cpu >= files->size) {
         // expand array
-        size_t new_size = rfile_size * 2 > cpu ? rfile_size * 2 : cpu;
+        size_t new_size = files->size * 2 > cpu ? files->size * 2 : cpu + 1;
         int *new_array = calloc(new_size, sizeof(int));
-        memcpy(new_array, rfile_array, rfile_size  * sizeof(int));
-        if (rfile_array != rfile_static) {
-            free(rfile_array);
+        memcpy(new_array, files->array, files->size * sizeof(int));
+        if (files->array != files->statik) {
+            free(files->array);
         }
-        rfile_array = new_array;
-        rfile_size  = new_size;
+        files->array = new_array;
+        files->size  = new_size;
     }
 
-    if (rfile_array[cpu] == 0) {
+    if (files->array[cpu] == 0) {
         char filename[64] = {};
         int ret = snprintf(filename, 64, "/dev/cpu/%d/msr", cpu);
         assert(ret > 0);
-        rfile_array[cpu] = open(filename, O_RDONLY);
-        if (rfile_array[cpu] == -1) {
-            rfile_array[cpu] = -errno;
+        files->array[cpu] = open(filename, files->flags);
+        if (files->array[cpu] == -1) {
+            files->array[cpu] = -errno;
         }
     }
 
-    int ret = rfile_array[cpu];
+    int ret = files->array[cpu];
 
     unlock();
 
     return ret;
 }
 
+/** get the read-only file associated with the given cpu */
+int get_rfile(int cpu) {
+    return get_file(&rfiles, cpu);
+}
+
 int read_msr(int cpu, uint32_t msr_index, uint64_t* value) {
     int file = get_rfile(cpu);
     assert(file);
@@ -99,6 +109,16 @@ int read_msr_cur_cpu(uint32_t msr_index, uint64_t* value) {
     return read_msr(sched_getcpu(), msr_index, value);
 }
 
+int write_msr(int cpu, uint32_t msr_index, uint64_t value) {
+    int file = get_file(&wfiles, cpu);
+    assert(file);
+    if (file < 0) {
+        return file;
+    }
+    int written = pwrite(file, &value, 8, msr_index);
+    return written == -1 ? errno : 0;
+}
+
 
 // rename this to main to build an exe that can be run as ./a.out CPU MSR
 // to read MSR from CPU (like a really simple rdmsr)
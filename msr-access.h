@@ -49,6 +49,15 @@ int read_msr(int cpu, uint32_t msr_index, uint64_t* value);
  */
 int read_msr_cur_cpu(uint32_t msr_index, uint64_t* value);
 
+/**
+ * Write value to the MSR given by msr_index on the given cpu. The MSR files are opened read-write
+ * separately from the read-only ones used by read_msr, so reads still work where writes aren't allowed.
+ *
+ * Returns zero on success, and otherwise a negative or positive errno value as for read_msr. Writing
+ * a read-only or reserved MSR, or reserved bits, usually fails with EIO.
+ */
+int write_msr(int cpu, uint32_t msr_index, uint64_t value);
+
 
 #ifdef __cplusplus
 } // extern "C" {
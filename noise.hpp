@@ -0,0 +1,123 @@
+/*
+ * noise.hpp
+ *
+ * Counting the events which steal time from a benchmark thread: interrupts, context switches
+ * and SMIs.
+ */
+
+#ifndef NOISE_HPP_
+#define NOISE_HPP_
+
+#include "msr-access.h"
+
+#include <cinttypes>
+#include <fstream>
+#include <sstream>
+#include <string>
+#include <vector>
+
+#include <sys/resource.h>
+
+#define MSR_SMI_COUNT 0x00000034
+#define SMI_COUNT_MASK 0xffffffffull // only the low 32 bits of MSR_SMI_COUNT are the count
+
+/**
+ * Given the contents of /proc/interrupts, return the total number of interrupts of all types
+ * delivered to the given cpu, or -1 if the cpu doesn't appear in the header.
+ */
+static inline int64_t parse_interrupts_for_cpu(std::istream& in, int cpu) {
+    std::string line;
+    if (!std::getline(in, line)) {
+        return -1;
+    }
+    // the header has one CPUn column for each online cpu
+    std::istringstream header(line);
+    std::string col, want = "CPU" + std::to_string(cpu);
+    int ncols = 0, index = -1;
+    while (header >> col) {
+        if (col == want) {
+            index = ncols;
+        }
+        ncols++;
+    }
+    if (index == -1) {
+        return -1;
+    }
+
+    int64_t total = 0;
+    while (std::getline(in, line)) {
+        std::istringstream row(line);
+        std::string label;
+        row >> label;
+        // after the label come the per-cpu counts, then a description: rows with fewer counts
+        // (e.g., ERR and MIS) aren't per-cpu and are skipped
+        std::vector<int64_t> counts;
+        int64_t count;
+        while ((int)counts.size() < ncols && row >> count) {
+            counts.push_back(count);
+        }
+        if ((int)counts.size() == ncols) {
+            total += counts[index];
+        }
+    }
+    return total;
+}
+
+static inline int64_t read_interrupts_for_cpu(int cpu) {
+    std::ifstream in("/proc/interrupts");
+    return in ? parse_interrupts_for_cpu(in, cpu) : -1;
+}
+
+/**
+ * A snapshot of the counts of the noise events for the current thread and cpu, or the difference
+ * between two snapshots. Values of -1 mean the count isn't available.
+ */
+struct noise_counts {
+    int64_t irqs      = -1;
+    int64_t vol_csw   = -1;
+    int64_t invol_csw = -1;
+    int64_t smis      = -1;
+
+    /** take a snapshot for the calling thread, which should be pinned to cpu */
+    static noise_counts snapshot(int cpu) {
+        noise_counts ret;
+        ret.irqs = read_interrupts_for_cpu(cpu);
+        struct rusage usage;
+        if (getrusage(RUSAGE_THREAD, &usage) == 0) {
+            ret.vol_csw   = usage.ru_nvcsw;
+            ret.invol_csw = usage.ru_nivcsw;
+        }
+        uint64_t smi;
+        if (read_msr(cpu, MSR_SMI_COUNT, &smi) == 0) {
+            ret.smis = smi & SMI_COUNT_MASK;
+        }
+        return ret;
+    }
+
+    /** the events which occurred between earlier and this snapshot */
+    noise_counts operator-(const noise_counts& earlier) const {
+        noise_counts ret;
+        ret.irqs      = delta(irqs,      earlier.irqs);
+        ret.vol_csw   = delta(vol_csw,   earlier.vol_csw);
+        ret.invol_csw = delta(invol_csw, earlier.invol_csw);
+        ret.smis      = delta(smis,      earlier.smis, SMI_COUNT_MASK);
+        return ret;
+    }
+
+    /** the total of all the available counts */
+    int64_t total() const {
+        int64_t ret = 0;
+        for (auto v : {irqs, vol_csw, invol_csw, smis}) {
+            ret += v > 0 ? v : 0;
+        }
+        return ret;
+    }
+
+private:
+    /* the difference of two counts which are unavailable (-1) or wrap around at mask + 1 */
+    static int64_t delta(int64_t later, int64_t earlier, uint64_t mask = UINT64_MAX) {
+        return later == -1 || earlier == -1 ? -1 : (int64_t)(((uint64_t)later - (uint64_t)earlier) & mask);
+    }
+};
+
+#endif /* NOISE_HPP_ */
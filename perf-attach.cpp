@@ -0,0 +1,191 @@
+/*
+ * perf-attach.cpp
+ */
+
+#include "perf-attach.hpp"
+#include "cpuid.hpp"
+
+#include <algorithm>
+#include <cstring>
+#include <fstream>
+#include <limits>
+#include <stdexcept>
+
+#include <dirent.h>
+#include <err.h>
+#include <fcntl.h>
+#include <linux/perf_event.h>
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+const char* perf_counter_name(perf_counter c) {
+    switch (c) {
+    case PERF_TASK_CLOCK: return "task-clock";
+    case PERF_CYCLES:     return "cycles";
+    case PERF_REF_CYCLES: return "ref-cycles";
+    case PERF_LICENSE0:   return "license0";
+    case PERF_LICENSE1:   return "license1";
+    case PERF_LICENSE2:   return "license2";
+    default:              return "unknown";
+    }
+}
+
+bool license_events_supported() {
+    auto fm = get_family_model();
+    // Skylake-SP/Cascade Lake, Ice Lake client and server
+    static const int models[] = {0x55, 0x6A, 0x6C, 0x7D, 0x7E};
+    return fm.family == 6 && std::find(std::begin(models), std::end(models), fm.model) != std::end(models);
+}
+
+namespace {
+
+perf_event_attr make_attr(perf_counter c) {
+    perf_event_attr attr;
+    memset(&attr, 0, sizeof(attr));
+    attr.size = sizeof(attr);
+    attr.disabled = 1;
+    attr.exclude_kernel = 1;
+    attr.exclude_hv = 1;
+    attr.read_format = PERF_FORMAT_TOTAL_TIME_ENABLED | PERF_FORMAT_TOTAL_TIME_RUNNING;
+    switch (c) {
+    case PERF_TASK_CLOCK:
+        attr.type = PERF_TYPE_SOFTWARE;
+        attr.config = PERF_COUNT_SW_TASK_CLOCK;
+        break;
+    case PERF_CYCLES:
+        attr.type = PERF_TYPE_HARDWARE;
+        attr.config = PERF_COUNT_HW_CPU_CYCLES;
+        break;
+    case PERF_REF_CYCLES:
+        attr.type = PERF_TYPE_HARDWARE;
+        attr.config = PERF_COUNT_HW_REF_CPU_CYCLES;
+        break;
+    default:
+        // event 0x28 with umasks 0x07, 0x18 and 0x20 for levels 0, 1 and 2
+        static const uint64_t umasks[] = {0x07, 0x18, 0x20};
+        attr.type = PERF_TYPE_RAW;
+        attr.config = (umasks[c - PERF_LICENSE0] << 8) | 0x28;
+        break;
+    }
+    return attr;
+}
+
+}
+
+void perf_counters::open_target(pid_t pid, int cpu, unsigned long flags) {
+    std::array<int, PERF_COUNTER_COUNT> set;
+    for (int c = 0; c < PERF_COUNTER_COUNT; c++) {
+        set[c] = -1;
+        if (c >= PERF_LICENSE0 && !license_events_supported()) {
+            continue;
+        }
+        auto attr = make_attr((perf_counter)c);
+        set[c] = syscall(SYS_perf_event_open, &attr, pid, cpu, -1, flags);
+    }
+    fds.push_back(set);
+}
+
+perf_counters::~perf_counters() {
+    for (auto& set : fds) {
+        for (int fd : set) {
+            if (fd != -1) {
+                close(fd);
+            }
+        }
+    }
+}
+
+perf_counters perf_counters::for_thread(pid_t tid) {
+    perf_counters ret;
+    ret.open_target(tid, -1, 0);
+    return ret;
+}
+
+perf_counters perf_counters::for_cgroup(const std::string& path, const std::vector<int>& cpus) {
+    int cgroup_fd = open(path.c_str(), O_RDONLY | O_DIRECTORY);
+    if (cgroup_fd < 0) {
+        err(EXIT_FAILURE, "failed to open cgroup %s", path.c_str());
+    }
+    perf_counters ret;
+    for (int cpu : cpus) {
+        ret.open_target(cgroup_fd, cpu, PERF_FLAG_PID_CGROUP);
+    }
+    close(cgroup_fd);
+    return ret;
+}
+
+bool perf_counters::is_open(perf_counter c) const {
+    for (auto& set : fds) {
+        if (set[c] == -1) {
+            return false;
+        }
+    }
+    return !fds.empty();
+}
+
+void perf_counters::start() {
+    for (auto& set : fds) {
+        for (int fd : set) {
+            if (fd != -1) {
+                ioctl(fd, PERF_EVENT_IOC_RESET, 0);
+                ioctl(fd, PERF_EVENT_IOC_ENABLE, 0);
+            }
+        }
+    }
+}
+
+void perf_counters::stop() {
+    for (auto& set : fds) {
+        for (int fd : set) {
+            if (fd != -1) {
+                ioctl(fd, PERF_EVENT_IOC_DISABLE, 0);
+            }
+        }
+    }
+}
+
+perf_values perf_counters::read() const {
+    perf_values ret;
+    for (int c = 0; c < PERF_COUNTER_COUNT; c++) {
+        if (!is_open((perf_counter)c)) {
+            ret[c] = std::numeric_limits<double>::quiet_NaN();
+            continue;
+        }
+        ret[c] = 0;
+        for (auto& set : fds) {
+            uint64_t buf[3]; // value, time enabled, time running
+            if (::read(set[c], buf, sizeof(buf)) != sizeof(buf)) {
+                err(EXIT_FAILURE, "failed to read the %s counter", perf_counter_name((perf_counter)c));
+            }
+            if (buf[2]) {
+                ret[c] += (double)buf[0] * buf[1] / buf[2];
+            }
+        }
+    }
+    return ret;
+}
+
+std::vector<pid_t> list_threads(pid_t pid) {
+    std::vector<pid_t> ret;
+    std::string path = "/proc/" + std::to_string(pid) + "/task";
+    DIR* dir = opendir(path.c_str());
+    if (!dir) {
+        return ret;
+    }
+    while (dirent* d = readdir(dir)) {
+        if (d->d_name[0] != '.') {
+            ret.push_back(std::atoi(d->d_name));
+        }
+    }
+    closedir(dir);
+    std::sort(ret.begin(), ret.end());
+    return ret;
+}
+
+std::string thread_name(pid_t tid) {
+    std::ifstream in("/proc/" + std::to_string(tid) + "/comm");
+    std::string name;
+    std::getline(in, name);
+    return name;
+}
@@ -0,0 +1,80 @@
+/*
+ * perf-attach.hpp
+ *
+ * perf_event_open counters for measuring the frequency and license residency of threads we didn't
+ * start: existing threads of another process, or everything in a cgroup.
+ */
+
+#ifndef PERF_ATTACH_HPP_
+#define PERF_ATTACH_HPP_
+
+#include <array>
+#include <string>
+#include <vector>
+
+#include <sys/types.h>
+
+/*
+ * The counters, all counting user mode only so that they work for unprivileged users on their own
+ * processes. The license counters are the CORE_POWER.LVLn_TURBO_LICENSE events, which count the
+ * cycles spent at each license level and only exist on some models.
+ */
+enum perf_counter {
+    PERF_TASK_CLOCK,
+    PERF_CYCLES,
+    PERF_REF_CYCLES,
+    PERF_LICENSE0,
+    PERF_LICENSE1,
+    PERF_LICENSE2,
+    PERF_COUNTER_COUNT
+};
+
+const char* perf_counter_name(perf_counter c);
+
+/* counter values, scaled up for any multiplexing: NaN for counters which couldn't be opened */
+using perf_values = std::array<double, PERF_COUNTER_COUNT>;
+
+/** true if the license level events are known for this CPU model */
+bool license_events_supported();
+
+/**
+ * A set of counters on one or more targets, with read() summing over the targets. The counters are
+ * created disabled.
+ */
+class perf_counters {
+    std::vector<std::array<int, PERF_COUNTER_COUNT>> fds; // one set per target, -1 for counters which failed to open
+
+    void open_target(pid_t pid, int cpu, unsigned long flags);
+
+public:
+    perf_counters() = default;
+    perf_counters(perf_counters&& other) : fds(std::move(other.fds)) { other.fds.clear(); }
+    perf_counters(const perf_counters&) = delete;
+    void operator=(const perf_counters&) = delete;
+    ~perf_counters();
+
+    /** count the thread tid, on any cpu */
+    static perf_counters for_thread(pid_t tid);
+
+    /** count everything in the cgroup at the given cgroupfs path, on the given cpus */
+    static perf_counters for_cgroup(const std::string& path, const std::vector<int>& cpus);
+
+    /** true if counter c could be opened on every target */
+    bool is_open(perf_counter c) const;
+
+    /** reset and enable all the counters */
+    void start();
+
+    /** disable all the counters */
+    void stop();
+
+    perf_values read() const;
+};
+
+/** the thread ids of the process pid, from /proc */
+std::vector<pid_t> list_threads(pid_t pid);
+
+/** the name (comm) of thread tid, or "" if it can't be read */
+std::string thread_name(pid_t tid);
+
+#endif /* PERF_ATTACH_HPP_ */
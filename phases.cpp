@@ -0,0 +1,266 @@
+/*
+ * phases.cpp
+ */
+
+#include "phases.hpp"
+#include "csv.hpp"
+#include "stats.hpp"
+
+#include <algorithm>
+#include <atomic>
+#include <cmath>
+#include <istream>
+#include <limits>
+#include <numeric>
+#include <stdexcept>
+#include <thread>
+
+const char* phase_name(phase_class c) {
+    switch (c) {
+    case PHASE_STEADY:     return "steady";
+    case PHASE_DOWNCLOCK:  return "downclock";
+    case PHASE_RELAXATION: return "relaxation";
+    case PHASE_HALT:       return "halt";
+    case PHASE_DRIFT:      return "drift";
+    default:               return "unknown";
+    }
+}
+
+double noise_variance(const std::vector<double>& x) {
+    if (x.size() < 2) {
+        return 0;
+    }
+    std::vector<double> diffs;
+    for (size_t i = 1; i < x.size(); i++) {
+        diffs.push_back(std::fabs(x[i] - x[i - 1]));
+    }
+    // the MAD scale for a normal, and the difference of two samples has twice the variance
+    double sigma = 1.4826 * Stats::median_in_place(diffs.begin(), diffs.end()) / std::sqrt(2.0);
+    return sigma * sigma;
+}
+
+std::vector<size_t> change_points(const std::vector<double>& x, double penalty, size_t min_len) {
+    size_t n = x.size();
+    min_len = std::max(min_len, (size_t)1);
+    if (n < 2 * min_len) {
+        return {n};
+    }
+    std::vector<double> sum(n + 1), sum_sq(n + 1);
+    for (size_t i = 0; i < n; i++) {
+        sum[i + 1] = sum[i] + x[i];
+        sum_sq[i + 1] = sum_sq[i] + x[i] * x[i];
+    }
+    auto cost = [&](size_t s, size_t t) {
+        double s1 = sum[t] - sum[s];
+        return std::max(sum_sq[t] - sum_sq[s] - s1 * s1 / (t - s), 0.0);
+    };
+
+    const double inf = std::numeric_limits<double>::infinity();
+    std::vector<double> best(n + 1, inf);
+    std::vector<size_t> prev(n + 1, 0);
+    std::vector<size_t> candidates{0}, kept;
+    best[0] = -penalty;
+    for (size_t t = min_len; t <= n; t++) {
+        for (size_t s : candidates) {
+            if (t - s >= min_len) {
+                double v = best[s] + cost(s, t) + penalty;
+                if (v < best[t]) {
+                    best[t] = v;
+                    prev[t] = s;
+                }
+            }
+        }
+        // prune the starts which can never be optimal again, then offer the next start
+        kept.clear();
+        for (size_t s : candidates) {
+            if (t - s < min_len || best[s] + cost(s, t) <= best[t]) {
+                kept.push_back(s);
+            }
+        }
+        candidates.swap(kept);
+        if (t + min_len <= n) {
+            candidates.push_back(t);
+        }
+    }
+
+    std::vector<size_t> ends;
+    for (size_t t = n; t > 0; t = prev[t]) {
+        ends.push_back(t);
+    }
+    std::reverse(ends.begin(), ends.end());
+    return ends;
+}
+
+namespace {
+
+/* a least squares line through the samples [first, last) of a trace, with time in ms from the first */
+struct line_fit {
+    double mean, slope, slope_se, residual_var;
+
+    line_fit(const std::vector<trace_point>& trace, size_t first, size_t last, double noise_var) {
+        double st = 0, sm = 0, stt = 0, stm = 0, smm = 0;
+        size_t count = last - first;
+        for (size_t i = first; i < last; i++) {
+            double t = (trace[i].us - trace[first].us) / 1000, m = trace[i].mhz;
+            st += t;
+            sm += m;
+            stt += t * t;
+            stm += t * m;
+            smm += m * m;
+        }
+        mean = sm / count;
+        double denom = count * stt - st * st;
+        slope = denom > 0 ? (count * stm - st * sm) / denom : 0;
+        // the standard error of the slope, so short noisy segments aren't taken for drift
+        slope_se = denom > 0 ? std::sqrt(noise_var * count / denom) : std::numeric_limits<double>::infinity();
+        double intercept = (sm - slope * st) / count;
+        double sse = smm - intercept * sm - slope * stm;
+        residual_var = std::max(sse / count, 0.0);
+    }
+};
+
+}
+
+std::vector<phase_segment> segment_trace(const std::vector<trace_point>& trace, double penalty_scale) {
+    std::vector<phase_segment> ret;
+    size_t n = trace.size();
+    if (n == 0) {
+        return ret;
+    }
+    std::vector<double> mhz;
+    for (auto& p : trace) {
+        mhz.push_back(p.mhz);
+    }
+    double var = std::max(noise_variance(mhz), 1e-9);
+    std::vector<size_t> ends;
+    if (n <= PHASE_MAX_PELT_SAMPLES) {
+        double penalty = penalty_scale * 2 * var * std::log((double)std::max(n, (size_t)2));
+        ends = change_points(mhz, penalty);
+    } else {
+        // search the block means, whose own noise sets the penalty, then map the ends back to samples
+        size_t block = (n + PHASE_MAX_PELT_SAMPLES - 1) / PHASE_MAX_PELT_SAMPLES;
+        std::vector<double> means;
+        for (size_t i = 0; i < n; i += block) {
+            size_t end = std::min(i + block, n);
+            means.push_back(std::accumulate(mhz.begin() + i, mhz.begin() + end, 0.0) / (end - i));
+        }
+        double block_var = std::max(noise_variance(means), 1e-9);
+        double penalty = penalty_scale * 2 * block_var * std::log((double)means.size());
+        size_t min_len = (PHASE_MIN_SAMPLES + block - 1) / block;
+        for (size_t e : change_points(means, penalty, min_len)) {
+            ends.push_back(std::min(e * block, n));
+        }
+    }
+
+    // the mean-change model splits a ramp into steps: merge neighbours which one line fits to within the noise
+    std::vector<size_t> merged;
+    size_t run_first = 0;
+    for (size_t i = 0; i < ends.size(); i++) {
+        if (i + 1 < ends.size() && line_fit(trace, run_first, ends[i + 1], var).residual_var <= PHASE_MERGE_VARIANCE * var) {
+            continue;
+        }
+        merged.push_back(ends[i]);
+        run_first = ends[i];
+    }
+
+    std::vector<double> copy = mhz;
+    double median = Stats::median_in_place(copy.begin(), copy.end());
+    std::vector<double> dts;
+    for (size_t i = 1; i < n; i++) {
+        dts.push_back(trace[i].us - trace[i - 1].us);
+    }
+    double period = dts.empty() ? 0 : Stats::median_in_place(dts.begin(), dts.end());
+
+    size_t first = 0;
+    double level = 0; // the mean of the last segment which wasn't a halt
+    for (size_t end : merged) {
+        line_fit fit(trace, first, end, var);
+        phase_segment seg{first, end, trace[first].us, 0, fit.mean, fit.slope, PHASE_STEADY};
+        double end_us = end < n ? trace[end].us : trace[n - 1].us + period;
+        seg.duration_us = end_us - seg.start_us;
+
+        if (seg.mean_mhz < PHASE_HALT_FRACTION * median) {
+            seg.kind = PHASE_HALT;
+        } else if (std::fabs(seg.slope) > PHASE_DRIFT_SIGNIFICANCE * fit.slope_se
+                && std::fabs(seg.slope * seg.duration_us / 1000) > PHASE_DRIFT_CHANGE * seg.mean_mhz) {
+            seg.kind = PHASE_DRIFT;
+        } else if (level && seg.mean_mhz < level * (1 - PHASE_LEVEL_CHANGE)) {
+            seg.kind = PHASE_DOWNCLOCK;
+        } else if (level && seg.mean_mhz > level * (1 + PHASE_LEVEL_CHANGE)) {
+            seg.kind = PHASE_RELAXATION;
+        }
+        ret.push_back(seg);
+        if (seg.kind != PHASE_HALT) {
+            level = seg.mean_mhz;
+        }
+        first = end;
+    }
+    return ret;
+}
+
+std::map<int, std::vector<trace_point>> read_trace(std::istream& in) {
+    std::map<int, std::vector<trace_point>> ret;
+    std::string line;
+    size_t cpu_col = -1, time_col = -1, mhz_col = -1;
+    bool header = true;
+    while (std::getline(in, line)) {
+        if (line.empty() || line[0] == '#') {
+            continue;
+        }
+        auto fields = parse_csv_line(line);
+        if (header) {
+            for (size_t i = 0; i < fields.size(); i++) {
+                if (fields[i] == "cpu")     cpu_col = i;
+                if (fields[i] == "time_us") time_col = i;
+                if (fields[i] == "mhz")     mhz_col = i;
+            }
+            if (cpu_col == (size_t)-1 || time_col == (size_t)-1 || mhz_col == (size_t)-1) {
+                throw std::runtime_error("trace needs cpu, time_us and mhz columns");
+            }
+            header = false;
+            continue;
+        }
+        if (fields.size() <= std::max({cpu_col, time_col, mhz_col})) {
+            throw std::runtime_error("short row: " + line);
+        }
+        if (fields[mhz_col].empty() || fields[mhz_col] == "nan" || fields[mhz_col] == "-nan") {
+            continue;
+        }
+        try {
+            ret[std::stoi(fields[cpu_col])].push_back({std::stod(fields[time_col]), std::stod(fields[mhz_col])});
+        } catch (const std::invalid_argument&) {
+            throw std::runtime_error("bad number in row: " + line);
+        } catch (const std::out_of_range&) {
+            throw std::runtime_error("number out of range in row: " + line);
+        }
+    }
+    return ret;
+}
+
+std::map<int, std::vector<phase_segment>> segment_traces(const std::map<int, std::vector<trace_point>>& traces,
+        size_t threads, double penalty_scale) {
+    std::vector<const std::pair<const int, std::vector<trace_point>>*> work;
+    for (auto& t : traces) {
+        work.push_back(&t);
+    }
+    std::vector<std::vector<phase_segment>> results(work.size());
+    std::atomic<size_t> next{0};
+    auto worker = [&]{
+        for (size_t i; (i = next++) < work.size();) {
+            results[i] = segment_trace(work[i]->second, penalty_scale);
+        }
+    };
+    std::vector<std::thread> pool;
+    for (size_t t = 1; t < std::min(threads, work.size()); t++) {
+        pool.emplace_back(worker);
+    }
+    worker();
+    for (auto& t : pool) {
+        t.join();
+    }
+    std::map<int, std::vector<phase_segment>> ret;
+    for (size_t i = 0; i < work.size(); i++) {
+        ret[work[i]->first] = std::move(results[i]);
+    }
+    return ret;
+}
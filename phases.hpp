@@ -0,0 +1,91 @@
+/*
+ * phases.hpp
+ *
+ * Splitting a frequency trace into phases (steady state, downclocks, halts, relaxation back up and
+ * thermal drift) with PELT change-point detection, so that a raw trace from the frequency meter (or
+ * anything else written in the same CSV form) turns into transition durations and levels.
+ */
+
+#ifndef PHASES_HPP_
+#define PHASES_HPP_
+
+#include <cstddef>
+#include <iosfwd>
+#include <map>
+#include <vector>
+
+/* the shortest segment PELT may produce, in samples */
+constexpr size_t PHASE_MIN_SAMPLES = 5;
+
+/*
+ * PELT can't prune on a trace without change points, where it takes quadratic time: longer traces are averaged in
+ * blocks down to at most this many points for the change-point search, so boundaries are found to within a block
+ */
+constexpr size_t PHASE_MAX_PELT_SAMPLES = 10000;
+
+/* neighbouring segments are merged if a single line fits them with at most this times the noise variance */
+constexpr double PHASE_MERGE_VARIANCE = 2;
+
+/* a segment whose mean is below this fraction of the median of the whole trace is a halt */
+constexpr double PHASE_HALT_FRACTION = 0.5;
+
+/* the relative change in mean from the previous segment that makes a downclock or relaxation */
+constexpr double PHASE_LEVEL_CHANGE = 0.01;
+
+/* the relative change over a segment's length, by its fitted slope, that makes it drift */
+constexpr double PHASE_DRIFT_CHANGE = 0.01;
+
+/* and the number of standard errors the slope must be away from zero */
+constexpr double PHASE_DRIFT_SIGNIFICANCE = 4;
+
+enum phase_class { PHASE_STEADY, PHASE_DOWNCLOCK, PHASE_RELAXATION, PHASE_HALT, PHASE_DRIFT };
+
+/** steady, downclock, relaxation, halt or drift */
+const char* phase_name(phase_class c);
+
+struct trace_point {
+    double us;  // time since the start of the trace
+    double mhz;
+};
+
+struct phase_segment {
+    size_t first, last;       // the samples in the segment are [first, last)
+    double start_us, duration_us;
+    double mean_mhz;
+    double slope;             // least squares slope in MHz per ms
+    phase_class kind;
+};
+
+/**
+ * The noise variance of x, estimated robustly from the median absolute first difference, so that level
+ * shifts don't inflate it.
+ */
+double noise_variance(const std::vector<double>& x);
+
+/**
+ * PELT (pruned exact linear time) change-point detection for changes in mean: minimizes the total within-segment
+ * squared error plus penalty per segment, with segments of at least min_len samples. Returns the end index of each
+ * segment, the last being x.size().
+ */
+std::vector<size_t> change_points(const std::vector<double>& x, double penalty, size_t min_len = PHASE_MIN_SAMPLES);
+
+/**
+ * Segment one trace (samples in time order, without NaNs) and classify each segment. The PELT penalty is
+ * penalty_scale times the BIC-like 2 * variance * ln(n), so larger scales give fewer segments. Since PELT
+ * fits constant levels, neighbouring segments which together lie on one line are then merged, so that a
+ * ramp comes out as one drifting segment rather than a staircase. Traces longer than PHASE_MAX_PELT_SAMPLES are
+ * searched for change points in block averages.
+ */
+std::vector<phase_segment> segment_trace(const std::vector<trace_point>& trace, double penalty_scale = 1);
+
+/**
+ * Read a trace CSV with cpu, time_us and mhz columns (as written by --freq-trace) into one trace per cpu,
+ * skipping samples without a frequency. Throws std::runtime_error if a column is missing.
+ */
+std::map<int, std::vector<trace_point>> read_trace(std::istream& in);
+
+/** segment_trace for every cpu's trace, spread over up to threads threads */
+std::map<int, std::vector<phase_segment>> segment_traces(const std::map<int, std::vector<trace_point>>& traces,
+        size_t threads, double penalty_scale = 1);
+
+#endif /* PHASES_HPP_ */
@@ -0,0 +1,95 @@
+/*
+ * prefetch.cpp
+ */
+
+#include "prefetch.hpp"
+#include "cleanup.hpp"
+
+#include <cstring>
+#include <mutex>
+#include <stdexcept>
+
+struct prefetch_control::saved {
+    std::vector<int> cpus;
+    std::vector<uint64_t> originals;
+    writer write;
+    size_t cleanup_id;
+    /* the cleanup (from the signal thread) and the owning thread both write the msrs */
+    std::mutex mutex;
+    bool restored = true;
+    /* set by the cleanup, so that the owner can't apply a config again while we're exiting */
+    bool closed = false;
+
+    void restore() {
+        if (!restored) {
+            for (size_t i = 0; i < cpus.size(); i++) {
+                write(cpus[i], originals[i]);
+            }
+            restored = true;
+        }
+    }
+};
+
+const std::vector<prefetch_config>& prefetch_configs() {
+    static const std::vector<prefetch_config> configs = {
+        { "all on",               0 },
+        { "L2 streamer off",      PREFETCH_L2_STREAMER },
+        { "L2 adjacent line off", PREFETCH_L2_ADJACENT },
+        { "DCU off",              PREFETCH_DCU_STREAMER | PREFETCH_DCU_IP },
+        { "all off",              PREFETCH_ALL },
+    };
+    return configs;
+}
+
+/* the message for a read_msr or write_msr style error */
+static std::string msr_error(int cpu, int e) {
+    return "CPU " + std::to_string(cpu) + ": " + strerror(e < 0 ? -e : e);
+}
+
+prefetch_control::prefetch_control(const std::vector<int>& cpus, reader read, writer write) : state{std::make_shared<saved>()} {
+    state->cpus = cpus;
+    state->write = write;
+    for (int cpu : cpus) {
+        uint64_t value;
+        if (int e = read(cpu, &value)) {
+            throw std::runtime_error("failed to read MSR 0x1a4 on " + msr_error(cpu, e));
+        }
+        state->originals.push_back(value);
+    }
+    auto s = state;
+    state->cleanup_id = register_cleanup([s]{
+        std::lock_guard<std::mutex> lock(s->mutex);
+        s->restore();
+        s->closed = true;
+    });
+}
+
+prefetch_control::~prefetch_control() {
+    unregister_cleanup(state->cleanup_id);
+    restore();
+}
+
+std::string prefetch_control::apply(const prefetch_config& config) {
+    std::lock_guard<std::mutex> lock(state->mutex);
+    if (state->closed) {
+        return "exiting";
+    }
+    state->restored = false;
+    for (size_t i = 0; i < state->cpus.size(); i++) {
+        int cpu = state->cpus[i];
+        if (int e = state->write(cpu, prefetch_value(state->originals[i], config.disable))) {
+            state->restore();
+            return "failed to write MSR 0x1a4 on " + msr_error(cpu, e);
+        }
+    }
+    return "";
+}
+
+void prefetch_control::restore() {
+    std::lock_guard<std::mutex> lock(state->mutex);
+    state->restore();
+}
+
+uint64_t prefetch_control::original(size_t i) const {
+    return state->originals.at(i);
+}
@@ -0,0 +1,76 @@
+/*
+ * prefetch.hpp
+ *
+ * Toggling the core's hardware prefetchers through MISC_FEATURE_CONTROL (MSR 0x1A4), with the
+ * original value of each cpu saved first and restored when done, or at exit if we're killed.
+ */
+
+#ifndef PREFETCH_HPP_
+#define PREFETCH_HPP_
+
+#include <cinttypes>
+#include <functional>
+#include <memory>
+#include <string>
+#include <vector>
+
+#define MSR_MISC_FEATURE_CONTROL 0x000001a4
+
+/* a set bit in MISC_FEATURE_CONTROL disables the prefetcher */
+#define PREFETCH_L2_STREAMER  (1u << 0)
+#define PREFETCH_L2_ADJACENT  (1u << 1)
+#define PREFETCH_DCU_STREAMER (1u << 2)
+#define PREFETCH_DCU_IP       (1u << 3)
+#define PREFETCH_ALL          0xfu
+
+struct prefetch_config {
+    const char* name;
+    /* the PREFETCH_ bits to set, i.e., the prefetchers to disable */
+    uint64_t disable;
+};
+
+/** the configurations swept by --prefetch-sweep, starting with everything enabled */
+const std::vector<prefetch_config>& prefetch_configs();
+
+/** original with the prefetcher bits replaced by disable, leaving the other bits alone */
+static inline uint64_t prefetch_value(uint64_t original, uint64_t disable) {
+    return (original & ~(uint64_t)PREFETCH_ALL) | (disable & PREFETCH_ALL);
+}
+
+/**
+ * Owns the prefetcher setting of a set of cpus. The constructor reads the current MISC_FEATURE_CONTROL of
+ * each cpu, throwing std::runtime_error if any can't be read, and registers a cleanup which writes them
+ * back if we're killed (from the cleanup thread, not signal context) and refuses any later apply(). The
+ * originals are also restored by restore() and on destruction, which unregisters the cleanup. The reader
+ * and writer have the signatures of read_msr and write_msr, less the msr index.
+ */
+class prefetch_control {
+public:
+    using reader = std::function<int(int cpu, uint64_t* value)>;
+    using writer = std::function<int(int cpu, uint64_t value)>;
+
+    prefetch_control(const std::vector<int>& cpus, reader read, writer write);
+
+    prefetch_control(const prefetch_control&) = delete;
+    void operator=(const prefetch_control&) = delete;
+
+    ~prefetch_control();
+
+    /**
+     * Apply the config to every cpu, returning "" or a description of the first failure (after which
+     * the originals are restored).
+     */
+    std::string apply(const prefetch_config& config);
+
+    /** write back the original values */
+    void restore();
+
+    /** the original value of the i-th cpu */
+    uint64_t original(size_t i) const;
+
+private:
+    struct saved;
+    std::shared_ptr<saved> state;
+};
+
+#endif /* PREFETCH_HPP_ */
@@ -0,0 +1,193 @@
+/*
+ * resctrl.cpp
+ */
+
+#include "resctrl.hpp"
+#include "cleanup.hpp"
+#include "util.hpp"
+
+#include <cerrno>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <mutex>
+#include <sstream>
+#include <stdexcept>
+#include <vector>
+
+#include <sys/stat.h>
+#include <unistd.h>
+
+namespace {
+
+std::string trim(const std::string& s) {
+    size_t first = s.find_first_not_of(" \t\n"), last = s.find_last_not_of(" \t\n");
+    return first == std::string::npos ? "" : s.substr(first, last - first + 1);
+}
+
+bool contiguous(uint64_t mask) {
+    if (!mask) {
+        return false;
+    }
+    uint64_t run = mask >> __builtin_ctzll(mask);
+    return (run & (run + 1)) == 0;
+}
+
+std::string hex(uint64_t v) {
+    char buf[32];
+    snprintf(buf, sizeof(buf), "%" PRIx64, v);
+    return buf;
+}
+
+}
+
+std::string resctrl_alloc::to_string() const {
+    std::string ret;
+    if (l3_mask) {
+        ret += "l3=0x" + hex(l3_mask);
+    }
+    if (mb_percent) {
+        ret += std::string(ret.empty() ? "" : ",") + "mb=" + std::to_string(mb_percent);
+    }
+    return ret;
+}
+
+resctrl_alloc parse_resctrl_alloc(const std::string& s) {
+    resctrl_alloc ret;
+    for (auto& part : split(s, ",")) {
+        auto kv = split(part, "=");
+        char* end = nullptr;
+        unsigned long long v = kv.size() == 2 && !kv[1].empty() ? strtoull(kv[1].c_str(), &end, kv[0] == "l3" ? 16 : 10) : 0;
+        if (!end || *end) {
+            throw std::runtime_error("bad resctrl allocation part '" + part + "', expected l3=MASK or mb=PERCENT");
+        }
+        if (kv[0] == "l3") {
+            if (!contiguous(v)) {
+                throw std::runtime_error("the L3 mask " + kv[1] + " isn't a non-empty contiguous run of bits");
+            }
+            ret.l3_mask = v;
+        } else if (kv[0] == "mb") {
+            if (v < 1 || v > 100) {
+                throw std::runtime_error("the memory bandwidth percentage " + kv[1] + " isn't in 1-100");
+            }
+            ret.mb_percent = v;
+        } else {
+            throw std::runtime_error("unknown resctrl resource '" + kv[0] + "', expected l3 or mb");
+        }
+    }
+    if (!ret.l3_mask && !ret.mb_percent) {
+        throw std::runtime_error("empty resctrl allocation '" + s + "'");
+    }
+    return ret;
+}
+
+std::string resctrl_schemata(const std::string& root_schemata, const resctrl_alloc& alloc) {
+    std::string ret;
+    bool has_l3 = false, has_mb = false;
+    std::istringstream in(root_schemata);
+    std::string line;
+    while (std::getline(in, line)) {
+        line = trim(line);
+        auto colon = line.find(':');
+        if (colon == std::string::npos) {
+            continue;
+        }
+        std::string resource = line.substr(0, colon), value;
+        if (alloc.l3_mask && resource.compare(0, 2, "L3") == 0) {
+            has_l3 = true;
+            value = hex(alloc.l3_mask);
+        } else if (alloc.mb_percent && resource == "MB") {
+            has_mb = true;
+            value = std::to_string(alloc.mb_percent);
+        } else {
+            continue;
+        }
+        std::string domains;
+        for (auto& d : split(line.substr(colon + 1), ";")) {
+            domains += (domains.empty() ? "" : ";") + d.substr(0, d.find('=')) + "=" + value;
+        }
+        ret += resource + ":" + domains + "\n";
+    }
+    if (alloc.l3_mask && !has_l3) {
+        throw std::runtime_error("resctrl doesn't support L3 cache allocation here");
+    }
+    if (alloc.mb_percent && !has_mb) {
+        throw std::runtime_error("resctrl doesn't support memory bandwidth allocation here");
+    }
+    return ret;
+}
+
+struct resctrl_group::state {
+    std::string path;
+    size_t cleanup_id;
+    /* the cleanup (from the signal thread) and the owning thread can both remove the group */
+    std::mutex mutex;
+    bool removed = false;
+
+    void remove() {
+        std::lock_guard<std::mutex> lock(mutex);
+        if (removed) {
+            return;
+        }
+        // the kernel removes a group's files with it, and moves its tasks back to the parent, but a plain
+        // directory (e.g., in tests) has to be emptied first
+        if (rmdir(path.c_str())) {
+            unlink((path + "/schemata").c_str());
+            unlink((path + "/tasks").c_str());
+            rmdir(path.c_str());
+        }
+        removed = true;
+    }
+};
+
+resctrl_group::resctrl_group(const std::string& root, const std::string& name, const resctrl_alloc& alloc) : s{std::make_shared<state>()} {
+    std::ifstream root_in(root + "/schemata");
+    if (!root_in) {
+        throw std::runtime_error("resctrl isn't mounted at " + root + " (mount -t resctrl resctrl " + root + ")");
+    }
+    std::stringstream root_schemata;
+    root_schemata << root_in.rdbuf();
+    std::string schemata = resctrl_schemata(root_schemata.str(), alloc);
+
+    std::string cbm = read_line(root + "/info/L3/cbm_mask"), min_bits = read_line(root + "/info/L3/min_cbm_bits"),
+            min_bw = read_line(root + "/info/MB/min_bandwidth");
+    if (alloc.l3_mask && !cbm.empty() && (alloc.l3_mask & ~strtoull(cbm.c_str(), nullptr, 16))) {
+        throw std::runtime_error("the L3 mask 0x" + hex(alloc.l3_mask) + " has bits outside the cache's mask 0x" + cbm);
+    }
+    if (alloc.l3_mask && !min_bits.empty() && __builtin_popcountll(alloc.l3_mask) < atoi(min_bits.c_str())) {
+        throw std::runtime_error("the L3 mask 0x" + hex(alloc.l3_mask) + " has fewer than the minimum " + min_bits + " bits");
+    }
+    if (alloc.mb_percent && !min_bw.empty() && alloc.mb_percent < (unsigned)atoi(min_bw.c_str())) {
+        throw std::runtime_error("the bandwidth " + std::to_string(alloc.mb_percent) + "% is below the minimum " + min_bw + "%");
+    }
+
+    s->path = root + "/" + name;
+    if (mkdir(s->path.c_str(), 0755)) {
+        std::string why = errno == ENOSPC ? "no free CLOSIDs" : strerror(errno);
+        s->removed = true;
+        throw std::runtime_error("failed to create resctrl group " + s->path + ": " + why);
+    }
+    auto cleanup_state = s;
+    s->cleanup_id = register_cleanup([cleanup_state]{ cleanup_state->remove(); });
+
+    if (int e = write_value(s->path + "/schemata", schemata)) {
+        std::string status = read_line(root + "/info/last_cmd_status");
+        unregister_cleanup(s->cleanup_id);
+        s->remove();
+        throw std::runtime_error("failed to write the schemata of " + s->path + ": " + (status.empty() ? strerror(e) : status));
+    }
+}
+
+resctrl_group::~resctrl_group() {
+    unregister_cleanup(s->cleanup_id);
+    s->remove();
+}
+
+int resctrl_group::add_task(pid_t tid) {
+    // the kernel takes one id per write
+    return write_value(s->path + "/tasks", std::to_string(tid) + "\n", std::ios::out | std::ios::app);
+}
+
+const std::string& resctrl_group::path() const {
+    return s->path;
+}
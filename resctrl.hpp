@@ -0,0 +1,70 @@
+/*
+ * resctrl.hpp
+ *
+ * Temporary resctrl groups for Cache Allocation (CAT) and Memory Bandwidth Allocation (MBA) experiments:
+ * a group is created with an L3 way mask and/or a bandwidth percentage, the benchmark threads are moved
+ * into it, and it is removed afterwards, which returns them to the default group. The mount point is a
+ * parameter (normally /sys/fs/resctrl) so that the logic can run against a plain directory.
+ */
+
+#ifndef RESCTRL_HPP_
+#define RESCTRL_HPP_
+
+#include <cinttypes>
+#include <memory>
+#include <string>
+
+#include <sys/types.h>
+
+#define RESCTRL_ROOT "/sys/fs/resctrl"
+
+struct resctrl_alloc {
+    /* the L3 capacity bitmask (the same for every cache domain), or 0 to leave it as is */
+    uint64_t l3_mask = 0;
+    /* the memory bandwidth percentage (for every domain), or 0 to leave it as is */
+    unsigned mb_percent = 0;
+
+    /* as accepted by parse_resctrl_alloc */
+    std::string to_string() const;
+};
+
+/**
+ * Parse an allocation like "l3=0xff,mb=50" (either part may be left out). Throws std::runtime_error if
+ * it's malformed, or the mask isn't a non-empty contiguous run of bits (which CAT requires), or the
+ * percentage isn't in 1-100.
+ */
+resctrl_alloc parse_resctrl_alloc(const std::string& s);
+
+/**
+ * The lines to write to a group's schemata file to apply alloc, given the root group's schemata (which
+ * names the resources and their domains). With CDP enabled the mask applies to both L3CODE and L3DATA.
+ * Throws std::runtime_error if alloc needs a resource which root_schemata doesn't list.
+ */
+std::string resctrl_schemata(const std::string& root_schemata, const resctrl_alloc& alloc);
+
+/**
+ * A resctrl group which exists for the lifetime of the object. The constructor validates alloc against
+ * the info directory (where present), creates the group directory under root and writes its schemata,
+ * throwing std::runtime_error on failure. The group is removed on destruction, which also unregisters
+ * the cleanup that removes it at exit if we're killed first.
+ */
+class resctrl_group {
+public:
+    resctrl_group(const std::string& root, const std::string& name, const resctrl_alloc& alloc);
+
+    resctrl_group(const resctrl_group&) = delete;
+    void operator=(const resctrl_group&) = delete;
+
+    ~resctrl_group();
+
+    /** move thread tid into the group, returning 0 or an errno value */
+    int add_task(pid_t tid);
+
+    const std::string& path() const;
+
+private:
+    struct state;
+    std::shared_ptr<state> s;
+};
+
+#endif /* RESCTRL_HPP_ */
@@ -0,0 +1,169 @@
+/*
+ * roofline.cpp
+ */
+
+#include "roofline.hpp"
+
+#include <algorithm>
+#include <cmath>
+#include <cstdio>
+#include <limits>
+
+const char* mem_level_name(mem_level level) {
+    switch (level) {
+    case MEM_L1:   return "L1";
+    case MEM_L2:   return "L2";
+    case MEM_L3:   return "L3";
+    case MEM_DRAM: return "DRAM";
+    default:       return "unknown";
+    }
+}
+
+double attainable_gflops(const roofline& r, mem_level level, double intensity) {
+    return std::min(r.gflops, r.gbps[level] * intensity);
+}
+
+double ridge_point(const roofline& r, mem_level level) {
+    return r.gflops / r.gbps[level];
+}
+
+namespace {
+
+/* the plotted intensity range, in FLOP/byte */
+constexpr double X_MIN = 1.0 / 16, X_MAX = 256;
+
+/* the plot area within the document */
+constexpr double WIDTH = 900, HEIGHT = 600, LEFT = 70, RIGHT = 170, TOP = 40, BOTTOM = 50;
+
+std::string fmt(const char* format, double d) {
+    char buf[64];
+    snprintf(buf, sizeof(buf), format, d);
+    return buf;
+}
+
+const char* width_color(int width) {
+    switch (width) {
+    case 128: return "#2ca02c";
+    case 256: return "#1f77b4";
+    case 512: return "#d62728";
+    default:  return "#7f7f7f";
+    }
+}
+
+const char* level_dash(mem_level level) {
+    switch (level) {
+    case MEM_L1:   return "none";
+    case MEM_L2:   return "8,4";
+    case MEM_L3:   return "3,3";
+    default:       return "12,4,3,4";
+    }
+}
+
+std::string escape(const std::string& s) {
+    std::string ret;
+    for (char c : s) {
+        switch (c) {
+        case '<': ret += "&lt;";  break;
+        case '>': ret += "&gt;";  break;
+        case '&': ret += "&amp;"; break;
+        default:  ret += c;
+        }
+    }
+    return ret;
+}
+
+}
+
+std::string roofline_svg(const std::vector<roofline>& lines, const std::string& title) {
+    // the y range covers every ceiling over the plotted intensities, rounded out to powers of 10
+    double y_min = std::numeric_limits<double>::infinity(), y_max = 0;
+    size_t max_cores = 1;
+    for (auto& r : lines) {
+        y_max = std::max(y_max, r.gflops);
+        max_cores = std::max(max_cores, r.cores);
+        for (int l = 0; l < MEM_LEVEL_COUNT; l++) {
+            if (std::isfinite(r.gbps[l]) && r.gbps[l] > 0) {
+                y_min = std::min(y_min, attainable_gflops(r, (mem_level)l, X_MIN));
+            }
+        }
+    }
+    if (!(y_max > 0)) {
+        y_max = 1;
+    }
+    y_min = std::isfinite(y_min) ? std::min(y_min, y_max) : y_max / 100;
+    double ly_min = std::floor(std::log10(y_min)), ly_max = std::ceil(std::log10(y_max) + 0.01);
+
+    double plot_w = WIDTH - LEFT - RIGHT, plot_h = HEIGHT - TOP - BOTTOM;
+    auto x_pos = [&](double x) { return LEFT + (std::log2(x) - std::log2(X_MIN)) / (std::log2(X_MAX) - std::log2(X_MIN)) * plot_w; };
+    auto y_pos = [&](double y) { return TOP + plot_h - (std::log10(y) - ly_min) / (ly_max - ly_min) * plot_h; };
+
+    std::string s;
+    s += "<svg xmlns=\"http://www.w3.org/2000/svg\" width=\"" + fmt("%.0f", WIDTH) + "\" height=\"" + fmt("%.0f", HEIGHT) + "\""
+            " font-family=\"sans-serif\" font-size=\"12\">\n";
+    s += "<rect width=\"100%\" height=\"100%\" fill=\"white\"/>\n";
+    s += "<text x=\"" + fmt("%.0f", LEFT) + "\" y=\"24\" font-size=\"16\">" + escape(title) + "</text>\n";
+
+    // grid and axes: powers of 2 for intensity, powers of 10 for GFLOP/s
+    for (double x = X_MIN; x <= X_MAX; x *= 2) {
+        std::string px = fmt("%.1f", x_pos(x));
+        s += "<line x1=\"" + px + "\" y1=\"" + fmt("%.1f", TOP) + "\" x2=\"" + px + "\" y2=\"" + fmt("%.1f", TOP + plot_h)
+                + "\" stroke=\"#e0e0e0\"/>\n";
+        s += "<text x=\"" + px + "\" y=\"" + fmt("%.1f", TOP + plot_h + 16) + "\" text-anchor=\"middle\">"
+                + (x < 1 ? "1/" + fmt("%.0f", 1 / x) : fmt("%.0f", x)) + "</text>\n";
+    }
+    for (double ly = ly_min; ly <= ly_max; ly++) {
+        std::string py = fmt("%.1f", y_pos(std::pow(10, ly)));
+        s += "<line x1=\"" + fmt("%.1f", LEFT) + "\" y1=\"" + py + "\" x2=\"" + fmt("%.1f", LEFT + plot_w) + "\" y2=\"" + py
+                + "\" stroke=\"#e0e0e0\"/>\n";
+        s += "<text x=\"" + fmt("%.1f", LEFT - 6) + "\" y=\"" + py + "\" text-anchor=\"end\" dominant-baseline=\"middle\">"
+                + fmt("%g", std::pow(10, ly)) + "</text>\n";
+    }
+    s += "<rect x=\"" + fmt("%.1f", LEFT) + "\" y=\"" + fmt("%.1f", TOP) + "\" width=\"" + fmt("%.1f", plot_w) + "\" height=\""
+            + fmt("%.1f", plot_h) + "\" fill=\"none\" stroke=\"black\"/>\n";
+    s += "<text x=\"" + fmt("%.1f", LEFT + plot_w / 2) + "\" y=\"" + fmt("%.1f", HEIGHT - 10)
+            + "\" text-anchor=\"middle\">Operational intensity (FLOP/byte)</text>\n";
+    s += "<text transform=\"translate(16," + fmt("%.1f", TOP + plot_h / 2) + ") rotate(-90)\" text-anchor=\"middle\">"
+            "Attainable GFLOP/s (DP)</text>\n";
+
+    // the roofs: attainable is min(peak, bw * x), which is straight in log-log on either side of the ridge
+    for (auto& r : lines) {
+        double opacity = 0.3 + 0.7 * r.cores / max_cores;
+        for (int l = 0; l < MEM_LEVEL_COUNT; l++) {
+            auto level = (mem_level)l;
+            if (!std::isfinite(r.gbps[l]) || r.gbps[l] <= 0) {
+                continue;
+            }
+            double ridge = std::min(std::max(ridge_point(r, level), X_MIN), X_MAX);
+            s += "<polyline fill=\"none\" stroke=\"" + std::string(width_color(r.width)) + "\" stroke-opacity=\""
+                    + fmt("%.2f", opacity) + "\" stroke-dasharray=\"" + level_dash(level) + "\" points=\"";
+            for (double x : {X_MIN, ridge, X_MAX}) {
+                s += fmt("%.1f", x_pos(x)) + "," + fmt("%.1f", y_pos(attainable_gflops(r, level, x))) + " ";
+            }
+            s += "\"><title>" + fmt("%.0f", r.width) + "-bit, " + std::to_string(r.cores) + " cores, " + mem_level_name(level)
+                    + ": " + fmt("%.1f", r.gflops) + " GFLOP/s, " + fmt("%.1f", r.gbps[l]) + " GB/s</title></polyline>\n";
+        }
+    }
+
+    // legend: widths by color, levels by dash
+    double lx = LEFT + plot_w + 15, ly = TOP + 10;
+    for (int width : {128, 256, 512}) {
+        if (std::none_of(lines.begin(), lines.end(), [=](const roofline& r){ return r.width == width; })) {
+            continue;
+        }
+        s += "<line x1=\"" + fmt("%.1f", lx) + "\" y1=\"" + fmt("%.1f", ly) + "\" x2=\"" + fmt("%.1f", lx + 30) + "\" y2=\""
+                + fmt("%.1f", ly) + "\" stroke=\"" + width_color(width) + "\" stroke-width=\"2\"/>\n";
+        s += "<text x=\"" + fmt("%.1f", lx + 36) + "\" y=\"" + fmt("%.1f", ly) + "\" dominant-baseline=\"middle\">"
+                + std::to_string(width) + "-bit FMA</text>\n";
+        ly += 20;
+    }
+    for (int l = 0; l < MEM_LEVEL_COUNT; l++) {
+        s += "<line x1=\"" + fmt("%.1f", lx) + "\" y1=\"" + fmt("%.1f", ly) + "\" x2=\"" + fmt("%.1f", lx + 30) + "\" y2=\""
+                + fmt("%.1f", ly) + "\" stroke=\"black\" stroke-dasharray=\"" + level_dash((mem_level)l) + "\"/>\n";
+        s += "<text x=\"" + fmt("%.1f", lx + 36) + "\" y=\"" + fmt("%.1f", ly) + "\" dominant-baseline=\"middle\">"
+                + mem_level_name((mem_level)l) + "</text>\n";
+        ly += 20;
+    }
+    s += "<text x=\"" + fmt("%.1f", lx) + "\" y=\"" + fmt("%.1f", ly + 10) + "\">fainter = fewer cores</text>\n";
+    s += "</svg>\n";
+    return s;
+}
@@ -0,0 +1,46 @@
+/*
+ * roofline.hpp
+ *
+ * Rooflines built from measured numbers: the peak FMA throughput at one vector width and active core
+ * count, and the load bandwidth from each level of the memory hierarchy at the same core count, along
+ * with an SVG rendering of a set of them.
+ */
+
+#ifndef ROOFLINE_HPP_
+#define ROOFLINE_HPP_
+
+#include <array>
+#include <cstddef>
+#include <string>
+#include <vector>
+
+/* the memory levels each roofline has a bandwidth ceiling for */
+enum mem_level { MEM_L1, MEM_L2, MEM_L3, MEM_DRAM, MEM_LEVEL_COUNT };
+
+/** L1, L2, L3 or DRAM */
+const char* mem_level_name(mem_level level);
+
+struct roofline {
+    int width;      // vector width in bits
+    size_t cores;   // active cores
+    double mhz;     // mean frequency of the FMA threads, NaN if unknown
+    double gflops;  // peak double precision GFLOP/s, over all the active cores
+    std::array<double, MEM_LEVEL_COUNT> gbps; // total load bandwidth from each level in GB/s, NaN if not measured
+};
+
+/** double precision FLOPs per FMA instruction of the given width: two per 64-bit lane */
+inline double flops_per_fma(int width) { return width / 64 * 2; }
+
+/** the attainable GFLOP/s at the given operational intensity (FLOP/byte) for data coming from level */
+double attainable_gflops(const roofline& r, mem_level level, double intensity);
+
+/** the operational intensity at which the bandwidth ceiling of level meets the compute peak */
+double ridge_point(const roofline& r, mem_level level);
+
+/**
+ * A log-log plot of the rooflines as a standalone SVG document: one color per vector width, fading
+ * with fewer active cores, and one dash pattern per memory level.
+ */
+std::string roofline_svg(const std::vector<roofline>& lines, const std::string& title);
+
+#endif /* ROOFLINE_HPP_ */
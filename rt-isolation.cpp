@@ -0,0 +1,129 @@
+/*
+ * rt-isolation.cpp
+ */
+
+#include "rt-isolation.hpp"
+#include "topology.hpp"
+
+#include <algorithm>
+#include <cerrno>
+#include <cstdio>
+
+#include <sched.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+/* how often the watchdog checks the deadlines */
+constexpr auto RT_WATCHDOG_PERIOD = std::chrono::milliseconds(10);
+
+int pick_housekeeping_cpu(const std::vector<int>& available, const std::vector<int>& used) {
+    for (int cpu : available) {
+        if (std::find(used.begin(), used.end(), cpu) == used.end()) {
+            return cpu;
+        }
+    }
+    return -1;
+}
+
+pid_t current_tid() {
+    return syscall(SYS_gettid);
+}
+
+int set_fifo(pid_t tid, int priority) {
+    sched_param param{};
+    param.sched_priority = priority;
+    return sched_setscheduler(tid, SCHED_FIFO, &param) ? errno : 0;
+}
+
+int set_normal(pid_t tid) {
+    sched_param param{};
+    return sched_setscheduler(tid, SCHED_OTHER, &param) ? errno : 0;
+}
+
+void prefault_stack(size_t bytes) {
+    // a VLA would be simpler but isn't standard C++: recurse through 4 KiB frames instead
+    volatile char page[4096];
+    for (size_t i = 0; i < sizeof(page); i += 64) {
+        page[i] = 0;
+    }
+    if (bytes > sizeof(page)) {
+        prefault_stack(bytes - sizeof(page));
+    }
+    // use the page after the call, so the recursion isn't turned into a loop reusing one frame
+    page[0] = page[64];
+}
+
+rt_watchdog::rt_watchdog(int cpu, std::chrono::milliseconds limit, int priority) :
+    limit{limit}, thread{&rt_watchdog::run, this, cpu, priority} {}
+
+rt_watchdog::~rt_watchdog() {
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        stopping = true;
+    }
+    cv.notify_all();
+    thread.join();
+}
+
+void rt_watchdog::run(int cpu, int priority) {
+    if (int e = set_cpu_affinity(cpu)) {
+        errno = e;
+        perror("rt_watchdog: couldn't pin to the housekeeping cpu");
+    }
+    if (int e = set_fifo(0, priority)) {
+        errno = e;
+        perror("rt_watchdog: couldn't make the watchdog SCHED_FIFO, it may not be able to preempt the test threads");
+    }
+
+    std::unique_lock<std::mutex> lock(mutex);
+    while (!cv.wait_for(lock, RT_WATCHDOG_PERIOD, [this]{ return stopping; })) {
+        auto now = clock::now();
+        for (auto i = deadlines.begin(); i != deadlines.end();) {
+            if (now > i->second) {
+                set_normal(i->first);
+                demoted.push_back(i->first);
+                i = deadlines.erase(i);
+            } else {
+                i++;
+            }
+        }
+    }
+}
+
+void rt_watchdog::add(pid_t tid) {
+    std::lock_guard<std::mutex> lock(mutex);
+    deadlines[tid] = clock::now() + limit;
+}
+
+void rt_watchdog::remove(pid_t tid) {
+    std::lock_guard<std::mutex> lock(mutex);
+    deadlines.erase(tid);
+}
+
+std::vector<pid_t> rt_watchdog::demotions() {
+    std::lock_guard<std::mutex> lock(mutex);
+    return demoted;
+}
+
+rt_thread_scope::rt_thread_scope(rt_watchdog* watchdog, int priority) : watchdog{watchdog} {
+    if (!watchdog) {
+        return;
+    }
+    prefault_stack();
+    tid = current_tid();
+    // register first, so the thread is never real-time without the watchdog knowing
+    watchdog->add(tid);
+    error = set_fifo(0, priority);
+}
+
+rt_thread_scope::~rt_thread_scope() {
+    if (!watchdog) {
+        return;
+    }
+    watchdog->remove(tid);
+    set_normal(0);
+}
+
+bool rt_thread_scope::demoted() const {
+    return watchdog && ok() && sched_getscheduler(0) != SCHED_FIFO;
+}
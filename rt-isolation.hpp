@@ -0,0 +1,101 @@
+/*
+ * rt-isolation.hpp
+ *
+ * Optional real-time isolation for the measurement threads: SCHED_FIFO scheduling, locked and
+ * prefaulted memory, and a watchdog on a housekeeping cpu which demotes any real-time thread that
+ * runs for too long.
+ */
+
+#ifndef RT_ISOLATION_HPP_
+#define RT_ISOLATION_HPP_
+
+#include <chrono>
+#include <condition_variable>
+#include <cstddef>
+#include <map>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+#include <sys/types.h>
+
+/* how much of each real-time thread's stack is prefaulted */
+constexpr size_t RT_STACK_PREFAULT = 256 * 1024;
+
+/**
+ * The first cpu in available which isn't in used, or -1 if there is none.
+ */
+int pick_housekeeping_cpu(const std::vector<int>& available, const std::vector<int>& used);
+
+/** the calling thread's id */
+pid_t current_tid();
+
+/** make thread tid (0 for the calling thread) SCHED_FIFO at priority, returning 0 or an errno value */
+int set_fifo(pid_t tid, int priority);
+
+/** return thread tid (0 for the calling thread) to SCHED_OTHER, returning 0 or an errno value */
+int set_normal(pid_t tid);
+
+/** touch the next bytes of the calling thread's stack so that it doesn't page fault later */
+void prefault_stack(size_t bytes = RT_STACK_PREFAULT);
+
+/**
+ * Watches the registered real-time threads from a thread pinned to the housekeeping cpu, and returns
+ * any which stays registered for longer than limit to SCHED_OTHER, so that a runaway measurement
+ * can't lock up its cpu.
+ */
+class rt_watchdog {
+    using clock = std::chrono::steady_clock;
+
+    std::chrono::milliseconds limit;
+    std::mutex mutex;
+    std::condition_variable cv;
+    std::map<pid_t, clock::time_point> deadlines;
+    std::vector<pid_t> demoted;
+    bool stopping = false;
+    std::thread thread;
+
+    void run(int cpu, int priority);
+
+public:
+    /* start the watchdog on cpu, at SCHED_FIFO priority (if possible) so it can preempt the threads it watches */
+    rt_watchdog(int cpu, std::chrono::milliseconds limit, int priority);
+
+    rt_watchdog(const rt_watchdog&) = delete;
+    void operator=(const rt_watchdog&) = delete;
+
+    ~rt_watchdog();
+
+    void add(pid_t tid);
+    void remove(pid_t tid);
+
+    /** the threads demoted so far */
+    std::vector<pid_t> demotions();
+};
+
+/**
+ * Makes the calling thread real-time for its lifetime: prefaults the stack, switches to SCHED_FIFO at
+ * priority and registers with the watchdog, undoing the last two on destruction. A null watchdog makes
+ * it a no-op. ok() is false if SCHED_FIFO couldn't be set.
+ */
+class rt_thread_scope {
+    rt_watchdog* watchdog;
+    pid_t tid = 0;
+    int error = 0;
+
+public:
+    rt_thread_scope(rt_watchdog* watchdog, int priority);
+
+    rt_thread_scope(const rt_thread_scope&) = delete;
+    void operator=(const rt_thread_scope&) = delete;
+
+    ~rt_thread_scope();
+
+    bool ok() const { return error == 0; }
+    int err() const { return error; }
+
+    /** true if the thread was made real-time but the watchdog has since demoted it */
+    bool demoted() const;
+};
+
+#endif /* RT_ISOLATION_HPP_ */
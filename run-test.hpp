@@ -0,0 +1,176 @@
+/*
+ * run-test.hpp
+ *
+ * The timed core of a test: the start/stop barrier, the outer timer interface and run_test itself,
+ * along with the per-thread result arena it writes into. Nothing here allocates once the arena is
+ * set up, so the timed path doesn't touch the heap.
+ */
+
+#ifndef RUN_TEST_HPP_
+#define RUN_TEST_HPP_
+
+#include "stats.hpp"
+
+#include <array>
+#include <atomic>
+#include <cassert>
+#include <cinttypes>
+#include <cstring>
+
+#include <err.h>
+#include <sys/mman.h>
+#include <unistd.h>
+
+typedef void (cal_f)(uint64_t iters);
+
+/* the default number of timed tries of the test function in run_test */
+constexpr size_t RUN_TEST_TRIES = 101;
+
+/**
+ * We pass an outer_clock to run_test which times outside the iteration of the innermost loop (i.e.,
+ * it times around the loop that runs TRIES times), start should reset the state unless you want to
+ * time warmup iterations.
+ */
+struct outer_timer {
+    virtual void start() = 0;
+    virtual void stop() = 0;
+    virtual ~outer_timer() {}
+};
+
+/*
+ * The result of the run_test method, with only the stuff
+ * that can be calculated from within that method.
+ */
+struct inner_result {
+    /* calculated Mops value */
+    double mops;
+    uint64_t ostart_ts, oend_ts;
+    uint64_t istart_ts, iend_ts; // start and end timestamps for the "critical" benchmark portion
+};
+
+struct hot_barrier {
+    size_t break_count;
+    std::atomic<size_t> current;
+    hot_barrier(size_t count) : break_count(count), current{0} {}
+
+    /* increment the arrived count of the barrier (do this once per thread generally) */
+    void increment() {
+        current++;
+    }
+
+    /* return true if all the threads have arrived, never blocks */
+    bool is_broken() {
+        return current.load() == break_count;
+    }
+
+    /* increment and hot spin on the waiter count until it hits the break point, returns the spin count in case you care */
+    long wait() {
+        increment();
+        long count = 0;
+        while (!is_broken()) {
+            count++;
+        }
+        return count;
+    }
+};
+
+/**
+ * Preallocated storage for the inner results and samples of each thread of a spec. Each thread's slot
+ * starts on its own page, so slots never share a cache line, and the memory isn't touched until the
+ * owning thread calls prepare() after pinning, so under the default first-touch policy each slot is
+ * local to its thread's NUMA node.
+ */
+class result_arena {
+    char* base;
+    size_t slot_bytes, slots, capacity;
+
+public:
+    struct slot {
+        inner_result* result;
+        uint64_t* samples;
+        size_t capacity;
+    };
+
+    /* an arena for the given number of threads, each with room for the given number of samples */
+    result_arena(size_t threads, size_t samples = RUN_TEST_TRIES) : slots{threads}, capacity{samples} {
+        size_t page = sysconf(_SC_PAGESIZE);
+        slot_bytes = (sizeof(inner_result) + 63) / 64 * 64 + samples * sizeof(uint64_t);
+        slot_bytes = (slot_bytes + page - 1) / page * page;
+        void* p = mmap(nullptr, slot_bytes * slots, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+        if (p == MAP_FAILED) {
+            err(EXIT_FAILURE, "failed to map the result arena");
+        }
+        base = static_cast<char*>(p);
+    }
+
+    result_arena(const result_arena&) = delete;
+    void operator=(const result_arena&) = delete;
+
+    ~result_arena() {
+        munmap(base, slot_bytes * slots);
+    }
+
+    size_t size() const { return slots; }
+
+    /* the slot for thread i */
+    slot get(size_t i) const {
+        assert(i < slots);
+        char* p = base + i * slot_bytes;
+        return {reinterpret_cast<inner_result*>(p), reinterpret_cast<uint64_t*>(p + (sizeof(inner_result) + 63) / 64 * 64), capacity};
+    }
+
+    /* fault in the slot for thread i: call it from that thread, after pinning */
+    slot prepare(size_t i) {
+        slot s = get(i);
+        memset(s.result, 0, slot_bytes);
+        return s;
+    }
+};
+
+/**
+ * Time func, writing the inner result and the per-try samples into out. The samples are in CLOCK
+ * ticks and are left reordered by the median calculation.
+ */
+template <typename CLOCK, size_t TRIES = RUN_TEST_TRIES, size_t WARMUP = 3>
+void run_test(cal_f* func, size_t iters, outer_timer& outer, hot_barrier *barrier, result_arena::slot out) {
+    assert(iters % 100 == 0);
+    assert(out.capacity >= TRIES);
+
+    uint64_t* results = out.samples;
+    inner_result& result = *out.result;
+
+    result.ostart_ts = CLOCK::now();
+    for (size_t w = 0; w < WARMUP + 1; w++) {
+        result.istart_ts = CLOCK::now();
+        outer.start();
+        for (size_t r = 0; r < TRIES; r++) {
+            auto t0 = CLOCK::now();
+            func(iters);
+            auto t1 = CLOCK::now();
+            func(iters * 2);
+            auto t2 = CLOCK::now();
+            results[r] = (t2 - t1) - (t1 - t0);
+        }
+        outer.stop();
+        result.iend_ts = CLOCK::now();
+    }
+
+    for (barrier->increment(); !barrier->is_broken();) {
+        func(iters);
+    }
+    result.oend_ts = CLOCK::now();
+
+    // to_nanos is monotonic, so converting the median gives the median of the converted samples
+    result.mops = ((double)iters / CLOCK::to_nanos(Stats::median_in_place(results, results + TRIES)));
+}
+
+/** as above, but for a single caller which doesn't need the samples: returns the result */
+template <typename CLOCK, size_t TRIES = RUN_TEST_TRIES, size_t WARMUP = 3>
+inner_result run_test(cal_f* func, size_t iters, outer_timer& outer, hot_barrier *barrier) {
+    std::array<uint64_t, TRIES> samples;
+    inner_result result;
+    run_test<CLOCK, TRIES, WARMUP>(func, iters, outer, barrier, {&result, samples.data(), TRIES});
+    return result;
+}
+
+#endif /* RUN_TEST_HPP_ */
@@ -11,6 +11,7 @@
 #include <iomanip>
 #include <sstream>
 #include <algorithm>
+#include <cmath>
 #include <limits>
 #include <iterator>
 #include <functional>
@@ -98,6 +99,25 @@ typename std::iterator_traits<iter_type>::value_type median(iter_type first, ite
 }
 
 
+/**
+ * The median of the range, like median() above, but found in place with nth_element rather than by sorting a copy,
+ * so that it never allocates. The range is reordered.
+ */
+template <typename iter_type>
+typename std::iterator_traits<iter_type>::value_type median_in_place(iter_type first, iter_type last) {
+    if (first == last) {
+        throw std::logic_error("can't get median of empty range");
+    }
+    size_t sz = std::distance(first, last), half_sz = sz / 2;
+    iter_type mid = first + half_sz;
+    std::nth_element(first, mid, last);
+    if (sz % 2) {
+        return *mid;
+    }
+    // the other middle element is the largest of the lower half
+    return (*std::max_element(first, mid) + *mid) / 2;
+}
+
 template <typename iter_type>
 DescriptiveStats get_stats(iter_type first, iter_type last) {
 	using dlimits = std::numeric_limits<double>;
@@ -117,6 +137,27 @@ DescriptiveStats get_stats(iter_type first, iter_type last) {
 
 
 
+/**
+ * The coefficient of variation of the range: the (population) standard deviation divided by the mean, or 0 if
+ * the range is empty or its mean is zero.
+ */
+template <typename iter_type>
+double coeff_of_variation(iter_type first, iter_type last) {
+    double total = 0, total_sq = 0;
+    size_t count = 0;
+    for (iter_type itr = first; itr != last; itr++) {
+        double vald = *itr;
+        total += vald;
+        total_sq += vald * vald;
+        count++;
+    }
+    if (count == 0 || total == 0) {
+        return 0;
+    }
+    double mean = total / count, var = std::max(total_sq / count - mean * mean, 0.0);
+    return std::sqrt(var) / std::abs(mean);
+}
+
 inline std::ostream& operator<<(std::ostream &os, const DescriptiveStats &stats) {
 	os << "min=" << stats.getMin() << ", median=" << stats.getMedian() << ", avg=" << stats.getAvg()
 			<< ", max=" << stats.getMax() << ", n=" << stats.getCount();
@@ -0,0 +1,65 @@
+/*
+ * counting-new.cpp
+ *
+ * Replaces the whole operator new/delete family, in its own translation unit so the compiler doesn't
+ * see (and warn about) malloc and free behind inlined new and delete expressions.
+ */
+
+#include "counting-new.hpp"
+
+#include <cstdlib>
+#include <new>
+
+std::atomic<size_t> allocation_count{0};
+
+namespace {
+
+void* counted_malloc(size_t size) noexcept {
+    allocation_count++;
+    return malloc(size ? size : 1);
+}
+
+}
+
+void* operator new(size_t size) {
+    if (void* p = counted_malloc(size)) {
+        return p;
+    }
+    throw std::bad_alloc();
+}
+
+void* operator new[](size_t size) {
+    return operator new(size);
+}
+
+void* operator new(size_t size, const std::nothrow_t&) noexcept {
+    return counted_malloc(size);
+}
+
+void* operator new[](size_t size, const std::nothrow_t&) noexcept {
+    return counted_malloc(size);
+}
+
+void operator delete(void* p) noexcept {
+    free(p);
+}
+
+void operator delete[](void* p) noexcept {
+    free(p);
+}
+
+void operator delete(void* p, size_t) noexcept {
+    free(p);
+}
+
+void operator delete[](void* p, size_t) noexcept {
+    free(p);
+}
+
+void operator delete(void* p, const std::nothrow_t&) noexcept {
+    free(p);
+}
+
+void operator delete[](void* p, const std::nothrow_t&) noexcept {
+    free(p);
+}
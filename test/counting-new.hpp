@@ -0,0 +1,17 @@
+/*
+ * counting-new.hpp
+ *
+ * The unit tests replace the global allocation functions (in counting-new.cpp) to count every heap
+ * allocation, so tests can check that some code doesn't allocate.
+ */
+
+#ifndef COUNTING_NEW_HPP_
+#define COUNTING_NEW_HPP_
+
+#include <atomic>
+#include <cstddef>
+
+/* the number of calls to any form of operator new so far */
+extern std::atomic<size_t> allocation_count;
+
+#endif /* COUNTING_NEW_HPP_ */
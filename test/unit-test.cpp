@@ -6,13 +6,43 @@
 
 
 #include "catch.hpp"
+#include "counting-new.hpp"
 
 #include "../util.hpp"
+#include "../agent.hpp"
+#include "../bimodal.hpp"
+#include "../cleanup.hpp"
 #include "../cpuid.hpp"
+#include "../csv.hpp"
+#include "../env-audit.hpp"
+#include "../freq-model.hpp"
+#include "../topology.hpp"
+#include "../vcore.hpp"
+#include "../noise.hpp"
+#include "../perf-attach.hpp"
+#include "../phases.hpp"
+#include "../prefetch.hpp"
+#include "../resctrl.hpp"
+#include "../roofline.hpp"
+#include "../rt-isolation.hpp"
+#include "../run-test.hpp"
 
 #include <array>
+#include <atomic>
+#include <new>
 #include <utility>
+#include <chrono>
 #include <cmath>
+#include <thread>
+#include <fstream>
+#include <sstream>
+
+#include <ftw.h>
+#include <stdlib.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/wait.h>
+#include <unistd.h>
 
 using ipvec = std::vector<std::pair<int,int>>;
 
@@ -134,8 +164,701 @@ TEST_CASE( "get_bits" ) {
     REQUIRE(get_bits(0xFFFFFFFF,0,30) == 0x7FFFFFFF);
 }
 
+TEST_CASE( "parse_interrupts_for_cpu" ) {
+    const char* text =
+            "           CPU0       CPU1       CPU2\n"
+            "  0:         20          0          5   IO-APIC   2-edge      timer\n"
+            "  8:          0          1          0   IO-APIC   8-edge      rtc0\n"
+            "NMI:          3          4          5   Non-maskable interrupts\n"
+            "LOC:       1000       2000       3000   Local timer interrupts\n"
+            "ERR:          7\n"
+            "MIS:          0\n";
+
+    auto parse = [&](int cpu) {
+        std::istringstream in(text);
+        return parse_interrupts_for_cpu(in, cpu);
+    };
+
+    REQUIRE(parse(0) == 1023);
+    REQUIRE(parse(1) == 2005);
+    REQUIRE(parse(2) == 3010);
+    REQUIRE(parse(3) == -1);
+}
+
+TEST_CASE( "noise_counts difference" ) {
+    noise_counts before, after;
+    before.irqs = 10;
+    after.irqs = 15;
+    before.smis = 0xfffffffe; // MSR_SMI_COUNT is 32 bits and wraps
+    after.smis = 1;
+    auto d = after - before;
+    REQUIRE(d.irqs == 5);
+    REQUIRE(d.smis == 3);
+    REQUIRE(d.vol_csw == -1);
+    REQUIRE(d.total() == 8);
+}
+
+TEST_CASE( "csv" ) {
+    REQUIRE(csv_escape("abc") == "abc");
+    REQUIRE(csv_escape("a,b") == "\"a,b\"");
+    REQUIRE(csv_escape("say \"hi\"") == "\"say \"\"hi\"\"\"");
+
+    std::vector<std::string> fields{"avx256_fma/1,scalar_iadd/3", "", "x\"y", "2.5"};
+    REQUIRE(parse_csv_line(csv_line(fields)) == fields);
+    REQUIRE(parse_csv_line("a,,b") == v(std::string("a"), std::string(""), std::string("b")));
+}
+
+TEST_CASE( "parse_cpu_list" ) {
+    REQUIRE(parse_cpu_list("").empty());
+    REQUIRE(parse_cpu_list("3") == v(3));
+    REQUIRE(parse_cpu_list("0-3,8,10-11") == v(0, 1, 2, 3, 8, 10, 11));
+    REQUIRE(parse_cpu_list("1-2\n") == v(1, 2));
+}
 
+TEST_CASE( "selected_choice" ) {
+    REQUIRE(selected_choice("always [madvise] never") == "madvise");
+    REQUIRE(selected_choice("performance") == "performance");
+}
 
+/* create the file (and any missing parent directories) under root with the given contents */
+static void make_file(const std::string& root, const std::string& rel, const std::string& contents) {
+    auto parts = split(rel, "/");
+    std::string path = root;
+    for (size_t i = 0; i + 1 < parts.size(); i++) {
+        path += parts[i] + "/";
+        mkdir(path.c_str(), 0755);
+    }
+    std::ofstream(root + rel) << contents;
+}
+
+static int remove_entry(const char* path, const struct stat*, int, struct FTW*) {
+    return remove(path);
+}
 
+/* a fresh directory under /tmp for a fake sysfs or resctrl tree, removed with everything in it at the end of the test */
+struct temp_dir {
+    std::string path;
 
+    temp_dir(const std::string& name) {
+        std::string tmpl = "/tmp/avx-turbo-" + name + "-XXXXXX";
+        REQUIRE(mkdtemp(&tmpl[0]));
+        path = tmpl;
+    }
+
+    temp_dir(const temp_dir&) = delete;
+    void operator=(const temp_dir&) = delete;
+
+    ~temp_dir() {
+        nftw(path.c_str(), remove_entry, 16, FTW_DEPTH | FTW_PHYS);
+    }
+};
+
+static std::string read_file(const std::string& path) {
+    std::string line;
+    std::getline(std::ifstream(path), line);
+    return line;
+}
+
+TEST_CASE( "register_cleanup" ) {
+    std::vector<int> ran;
+    register_cleanup([&]{ ran.push_back(1); });
+    size_t two = register_cleanup([&]{ ran.push_back(2); });
+    register_cleanup([&]{ ran.push_back(3); });
+    unregister_cleanup(two);
+    run_cleanups();
+    REQUIRE(ran == std::vector<int>({3, 1}));
+    run_cleanups();
+    REQUIRE(ran.size() == 2);
+}
+
+TEST_CASE( "env_audit" ) {
+    temp_dir dir("sysfs");
+    std::string root = dir.path + "/";
+    make_file(root, "sys/devices/system/cpu/cpu0/cpufreq/scaling_governor", "powersave\n");
+    make_file(root, "sys/devices/system/cpu/cpu1/cpufreq/scaling_governor", "performance\n");
+    make_file(root, "sys/devices/system/cpu/intel_pstate/no_turbo", "1\n");
+    make_file(root, "sys/devices/system/cpu/isolated", "1-3\n");
+    make_file(root, "sys/kernel/mm/transparent_hugepage/enabled", "always [madvise] never\n");
+
+    auto find = [](const env_audit& audit, const std::string& name) {
+        for (auto& i : audit.items) {
+            if (i.name == name) return i;
+        }
+        FAIL("no audit item " << name);
+        return env_audit::item{};
+    };
+
+    auto audit = audit_environment(root, {0, 1}, 0);
+    REQUIRE(find(audit, "cpufreq governor").value == "performance (cpus 1), powersave (cpus 0)");
+    REQUIRE(!find(audit, "cpufreq governor").warning.empty());
+    REQUIRE(find(audit, "intel_pstate no_turbo").value == "1");
+    REQUIRE(!find(audit, "intel_pstate no_turbo").warning.empty());
+    REQUIRE(find(audit, "isolated").value == "1,2,3");
+    REQUIRE(find(audit, "isolated").warning == "selected cpus 0 are not in the isolated list");
+    REQUIRE(find(audit, "transparent hugepages").value == "madvise");
+    REQUIRE(find(audit, "cpufreq boost").value == "n/a");
+
+    auto changes = mitigate_environment(root, {0, 1});
+    REQUIRE(changes.size() == 2); // cpu0 governor and no_turbo, cpu1 is already fine
+    REQUIRE(read_file(root + "sys/devices/system/cpu/cpu0/cpufreq/scaling_governor") == "performance");
+    REQUIRE(read_file(root + "sys/devices/system/cpu/intel_pstate/no_turbo") == "0");
+    REQUIRE(find(audit_environment(root, {0, 1}, 0), "cpufreq governor").warning.empty());
+
+    restore_environment();
+    REQUIRE(read_file(root + "sys/devices/system/cpu/cpu0/cpufreq/scaling_governor") == "powersave");
+    REQUIRE(read_file(root + "sys/devices/system/cpu/cpu1/cpufreq/scaling_governor") == "performance");
+    REQUIRE(read_file(root + "sys/devices/system/cpu/intel_pstate/no_turbo") == "1");
+}
+
+TEST_CASE( "cpus_by_package" ) {
+    temp_dir dir("sysfs");
+    std::string root = dir.path + "/";
+    make_file(root, "sys/devices/system/cpu/cpu0/topology/physical_package_id", "0\n");
+    make_file(root, "sys/devices/system/cpu/cpu1/topology/physical_package_id", "1\n");
+    make_file(root, "sys/devices/system/cpu/cpu2/topology/physical_package_id", "0\n");
+
+    auto packages = cpus_by_package(root, {0, 1, 2, 3});
+    REQUIRE(packages.size() == 2);
+    REQUIRE(packages[0] == v(0, 2, 3)); // cpu 3 is unknown so goes in package 0
+    REQUIRE(packages[1] == v(1));
+}
 
+TEST_CASE( "first_smt_siblings" ) {
+    temp_dir dir("sysfs");
+    std::string root = dir.path + "/";
+    make_file(root, "sys/devices/system/cpu/cpu0/topology/thread_siblings_list", "0,2\n");
+    make_file(root, "sys/devices/system/cpu/cpu1/topology/thread_siblings_list", "1,3\n");
+    make_file(root, "sys/devices/system/cpu/cpu2/topology/thread_siblings_list", "0,2\n");
+    make_file(root, "sys/devices/system/cpu/cpu3/topology/thread_siblings_list", "1,3\n");
+    make_file(root, "sys/devices/system/cpu/cpu4/topology/thread_siblings_list", "4-5\n");
+
+    REQUIRE(first_smt_siblings(root, {0, 1, 2, 3, 4}) == v(0, 1, 4));
+    REQUIRE(first_smt_siblings(root, {3, 2}) == v(3, 2));
+    REQUIRE(first_smt_siblings(root, {0, 5}).empty()); // cpu 5 can't be read
+    REQUIRE(smt_siblings(root, 4) == v(4, 5));
+    REQUIRE(smt_siblings(root, 5).empty());
+}
+
+TEST_CASE( "affinity and parallel probing" ) {
+    auto cpus = get_cpus();
+    REQUIRE(!cpus.empty());
+    REQUIRE(std::is_sorted(cpus.begin(), cpus.end()));
+    REQUIRE(probe_x2apic_ids(cpus).size() == cpus.size());
+    // the probers don't change our own affinity
+    REQUIRE(get_cpus() == cpus);
+    REQUIRE(set_cpu_affinity(-1) == EINVAL);
+}
+
+TEST_CASE( "last_level_cache_bytes" ) {
+    temp_dir dir("sysfs");
+    std::string root = dir.path + "/";
+    std::string cache = "sys/devices/system/cpu/cpu0/cache/";
+    make_file(root, cache + "index0/level", "1\n");
+    make_file(root, cache + "index0/size", "48K\n");
+    make_file(root, cache + "index1/level", "2\n");
+    make_file(root, cache + "index1/size", "2048K\n");
+    make_file(root, cache + "index2/level", "3\n");
+    make_file(root, cache + "index2/size", "107520K\n");
+    REQUIRE(last_level_cache_bytes(root, 0) == 107520 * 1024);
+    REQUIRE(last_level_cache_bytes(root, 1) == 0);
+}
+
+TEST_CASE( "cache_bytes" ) {
+    temp_dir dir("sysfs");
+    std::string root = dir.path + "/";
+    std::string cache = "sys/devices/system/cpu/cpu0/cache/";
+    make_file(root, cache + "index0/level", "1\n");
+    make_file(root, cache + "index0/type", "Data\n");
+    make_file(root, cache + "index0/size", "48K\n");
+    make_file(root, cache + "index1/level", "1\n");
+    make_file(root, cache + "index1/type", "Instruction\n");
+    make_file(root, cache + "index1/size", "32K\n");
+    make_file(root, cache + "index2/level", "2\n");
+    make_file(root, cache + "index2/type", "Unified\n");
+    make_file(root, cache + "index2/size", "2048K\n");
+    REQUIRE(cache_bytes(root, 0, 1) == 48 * 1024);
+    REQUIRE(cache_bytes(root, 0, 2) == 2048 * 1024);
+    REQUIRE(cache_bytes(root, 0, 3) == 0);
+    REQUIRE(cache_bytes(root, 1, 1) == 0);
+}
+
+TEST_CASE( "independent_packages" ) {
+    // package 1 interferes with 0 (in one direction only), 2 and 3 don't interfere with anything
+    auto indep = [](int a, int b){ return !(a == 0 && b == 1); };
+    REQUIRE(independent_packages(v(0, 1, 2, 3), indep) == v(0, 2, 3));
+    REQUIRE(independent_packages(v(1, 2), indep) == v(1, 2));
+    REQUIRE(independent_packages(v(5), indep) == v(5));
+}
+
+TEST_CASE( "frame_decoder" ) {
+    std::string stream = encode_frame("run spec=a/2") + encode_frame("") + encode_frame("quit");
+    REQUIRE(stream.size() == 4 + 12 + 4 + 4 + 4);
+    REQUIRE(stream.substr(0, 4) == std::string("\0\0\0\x0c", 4));
+
+    // feed a byte at a time, to exercise partial frames
+    frame_decoder decoder;
+    std::vector<std::string> frames;
+    std::string payload;
+    for (char c : stream) {
+        decoder.feed(&c, 1);
+        while (decoder.next(payload)) {
+            frames.push_back(payload);
+        }
+    }
+    REQUIRE(frames == v(std::string("run spec=a/2"), std::string(""), std::string("quit")));
+    REQUIRE(!decoder.partial());
+
+    frame_decoder bad;
+    bad.feed("\xff\xff\xff\xff", 4);
+    REQUIRE_THROWS(bad.next(payload));
+}
+
+TEST_CASE( "parse_agent_request" ) {
+    auto req = parse_agent_request("run  spec=avx512_fma_t/2,scalar_iadd iters=1000");
+    REQUIRE(req.command == "run");
+    REQUIRE(req.get("spec") == "avx512_fma_t/2,scalar_iadd");
+    REQUIRE(req.get("iters") == "1000");
+    REQUIRE(req.get("warmup-ms", "100") == "100");
+
+    REQUIRE(parse_agent_request("quit").args.empty());
+    REQUIRE_THROWS(parse_agent_request(""));
+    REQUIRE_THROWS(parse_agent_request("run iters"));
+    REQUIRE_THROWS(parse_agent_request("run =5"));
+}
+
+TEST_CASE( "agent frames over a socket" ) {
+    int fds[2];
+    REQUIRE(socketpair(AF_UNIX, SOCK_STREAM, 0, fds) == 0);
+    REQUIRE(write_frame(fds[0], "info"));
+    REQUIRE(write_frame(fds[0], std::string(100000, 'x')));
+    close(fds[0]);
+
+    frame_decoder decoder;
+    std::string payload;
+    REQUIRE(read_frame(fds[1], decoder, payload));
+    REQUIRE(payload == "info");
+    REQUIRE(read_frame(fds[1], decoder, payload));
+    REQUIRE(payload.size() == 100000);
+    REQUIRE(!read_frame(fds[1], decoder, payload));
+    close(fds[1]);
+}
+
+TEST_CASE( "freq_model" ) {
+    REQUIRE(license_of("avx512_fma_t") == LICENSE_AVX512);
+    REQUIRE(license_of("avx256_fma_t") == LICENSE_AVX2);
+    REQUIRE(license_of("avx128_fma_t") == LICENSE_SCALAR);
+    REQUIRE(license_of("scalar_iadd") == LICENSE_SCALAR);
+
+    std::istringstream results(
+            "# info,brand,test\n"
+            "spec,cores,thread,test,mops,am_ratio,mhz,mt_ratio,irqs,vol_csw,invol_csw,smis,noisy\n"
+            "scalar_iadd,1,0,scalar_iadd,1000,1.5,3000,1,0,0,0,0,0\n"
+            "avx512_fma_t,1,0,avx512_fma_t,1000,1.2,2400,1,0,0,0,0,0\n"
+            "avx512_fma_t/3,3,0,avx512_fma_t,1000,1.0,2000,1,0,0,0,0,0\n"
+            "avx512_fma_t/3,3,1,avx512_fma_t,1000,1.0,2010,1,0,0,0,0,0\n"
+            "avx512_fma_t/3,3,2,avx512_fma_t,1000,1.0,1990,1,0,0,0,0,0\n"
+            "\"avx512_fma_t,scalar_iadd\",2,0,avx512_fma_t,1000,1.1,2200,1,0,0,0,0,0\n"
+            "\"avx512_fma_t,scalar_iadd\",2,1,scalar_iadd,1000,1.4,2800,1,0,0,0,0,0\n"
+            "avx256_fma_t,1,0,avx256_fma_t,1000,,,,0,0,0,0,0\n");
+    auto samples = read_result_samples(results);
+    REQUIRE(samples.size() == 7); // the last row has no frequency
+    REQUIRE(samples[2].counts[LICENSE_AVX512] == 3);
+    REQUIRE(samples[5].own == LICENSE_AVX512);
+    REQUIRE(samples[6].own == LICENSE_SCALAR);
+    REQUIRE(samples[6].counts[LICENSE_AVX512] == 1);
+
+    auto model = freq_model::fit(samples);
+    REQUIRE(model.table.size() == 5);
+    license_counts three512{};
+    three512[LICENSE_AVX512] = 3;
+    auto e = model.table.at({LICENSE_AVX512, three512});
+    REQUIRE(e.mhz == Approx(2000));
+    REQUIRE(e.samples == 3);
+    REQUIRE(e.rms_residual == Approx(std::sqrt(200.0 / 3)));
+
+    // exact, interpolated and clamped
+    REQUIRE(model.predict(1, 0, 0)[LICENSE_AVX512] == Approx(2400));
+    REQUIRE(model.predict(2, 0, 0)[LICENSE_AVX512] == Approx(2200));
+    REQUIRE(model.predict(8, 0, 0)[LICENSE_AVX512] == Approx(2000));
+    auto mixed = model.predict(1, 0, 1);
+    REQUIRE(mixed[LICENSE_SCALAR] == Approx(2800));
+    REQUIRE(mixed[LICENSE_AVX512] == Approx(2200));
+    REQUIRE(std::isnan(mixed[LICENSE_AVX2]));
+    REQUIRE(std::isnan(model.predict(0, 1, 0)[LICENSE_AVX2])); // nothing measured
+
+    // the mix matters, not just the highest class and the total: 1 AVX-512 + 3 scalar clamps to the 1 + 1 mix (the
+    // 1 + 0 mix has no scalar core, so it isn't on the same line), while 4 AVX-512 clamps the 1, 3 AVX-512 line
+    REQUIRE(model.predict(1, 0, 3)[LICENSE_AVX512] == Approx(2200));
+    REQUIRE(model.predict(4, 0, 0)[LICENSE_AVX512] == Approx(2000));
+    // with a 1 + 3 mix measured too, 1 + 2 interpolates between it and 1 + 1
+    auto wider = model;
+    license_counts one_three{};
+    one_three[LICENSE_AVX512] = 1;
+    one_three[LICENSE_SCALAR] = 3;
+    wider.table[{LICENSE_AVX512, one_three}] = {2000, 1, 0};
+    REQUIRE(wider.predict(1, 0, 2)[LICENSE_AVX512] == Approx(2100));
+    REQUIRE(wider.predict(1, 0, 3)[LICENSE_AVX512] == Approx(2000));
+    // no mix differs in one class from 2 + 2, so this falls back to the total for (scalar, avx512)
+    REQUIRE(model.predict(2, 0, 2)[LICENSE_SCALAR] == Approx(2800));
+
+    std::stringstream table;
+    model.write(table);
+    auto reread = freq_model::read(table);
+    REQUIRE(reread.table.size() == model.table.size());
+    REQUIRE(reread.predict(2, 0, 0)[LICENSE_AVX512] == Approx(2200));
+}
+
+TEST_CASE( "breakeven_fraction" ) {
+    vector_freqs f{3000, 2400, 2400};
+    vector_workload w{4.0, 0.5, 0, 10};
+    // time is 0.5 * 1.25 + 0.5 * 0.3125
+    REQUIRE(net_speedup(f, w) == Approx(1 / 0.78125));
+    double be = breakeven_fraction(f, w);
+    REQUIRE(be == Approx(0.25 / 0.9375));
+    w.vector_fraction = be;
+    REQUIRE(net_speedup(f, w) == Approx(1.0));
+
+    // transition halts of 10% raise the break-even point
+    w.transitions_per_sec = 10000;
+    REQUIRE(breakeven_fraction(f, w) > be);
+    REQUIRE(net_speedup(f, w) == Approx(0.9));
+
+    // no frequency penalty: always helps, while a tiny speedup never pays for the penalty
+    REQUIRE(breakeven_fraction({3000, 3000, 3000}, {2.0, 0.5, 0, 10}) == 0);
+    REQUIRE(std::isinf(breakeven_fraction(f, {1.1, 0.5, 0, 10})));
+}
+
+extern "C" void scalar_iadd(uint64_t iters);
+
+TEST_CASE( "perf_counters attached to a child" ) {
+    pid_t child = fork();
+    REQUIRE(child >= 0);
+    if (child == 0) {
+        // run one of the built-in kernels until killed
+        while (true) {
+            scalar_iadd(1000000);
+        }
+    }
+
+    auto tids = list_threads(child);
+    REQUIRE(tids == std::vector<pid_t>{child});
+
+    auto counters = perf_counters::for_thread(child);
+    if (!counters.is_open(PERF_TASK_CLOCK)) {
+        WARN("perf_event_open isn't available, skipping");
+    } else {
+        counters.start();
+        std::this_thread::sleep_for(std::chrono::milliseconds(200));
+        counters.stop();
+        auto values = counters.read();
+        // the child is always running, but may share a cpu with us
+        REQUIRE(values[PERF_TASK_CLOCK] > 20e6);
+        if (counters.is_open(PERF_CYCLES)) {
+            REQUIRE(values[PERF_CYCLES] > 0);
+        }
+    }
+
+    kill(child, SIGKILL);
+    waitpid(child, nullptr, 0);
+}
+
+struct test_clock {
+    static uint64_t now() { return __builtin_ia32_rdtsc(); }
+    static uint64_t to_nanos(uint64_t ticks) { return ticks; }
+};
+
+struct count_outer : outer_timer {
+    int starts = 0, stops = 0;
+    void start() override { starts++; }
+    void stop() override { stops++; }
+};
+
+TEST_CASE( "median_in_place" ) {
+    std::vector<int> odd{5, 1, 4, 2, 3}, even{4, 1, 3, 2};
+    REQUIRE(Stats::median_in_place(odd.begin(), odd.end()) == 3);
+    REQUIRE(Stats::median_in_place(even.begin(), even.end()) == 2); // (2 + 3) / 2 in integers
+    std::vector<double> evend{4, 1, 3, 2};
+    REQUIRE(Stats::median_in_place(evend.begin(), evend.end()) == 2.5);
+}
+
+TEST_CASE( "coeff_of_variation" ) {
+    std::vector<double> same{5, 5, 5}, spread{1, 3}, none;
+    REQUIRE(Stats::coeff_of_variation(same.begin(), same.end()) == 0);
+    REQUIRE(Stats::coeff_of_variation(spread.begin(), spread.end()) == Approx(0.5)); // stddev 1, mean 2
+    REQUIRE(Stats::coeff_of_variation(none.begin(), none.end()) == 0);
+}
+
+TEST_CASE( "run_test doesn't allocate" ) {
+    result_arena arena{2};
+    auto slot0 = arena.prepare(0), slot1 = arena.prepare(1);
+    REQUIRE(slot0.capacity == RUN_TEST_TRIES);
+    // slots are at least a cache line apart and aligned
+    REQUIRE((uintptr_t)slot0.result % 64 == 0);
+    REQUIRE((uintptr_t)slot0.samples % 64 == 0);
+    REQUIRE((char*)slot1.result - (char*)(slot0.samples + slot0.capacity) >= 0);
+
+    hot_barrier barrier{1};
+    count_outer outer;
+    size_t before = allocation_count.load();
+    run_test<test_clock>(scalar_iadd, 1000, outer, &barrier, slot0);
+    size_t after = allocation_count.load();
+    REQUIRE(after == before);
+
+    REQUIRE(outer.starts == 4);
+    REQUIRE(outer.stops == 4);
+    REQUIRE(slot0.result->mops > 0);
+    REQUIRE(slot0.result->ostart_ts <= slot0.result->istart_ts);
+    REQUIRE(slot0.result->iend_ts <= slot0.result->oend_ts);
+}
+
+TEST_CASE( "pick_housekeeping_cpu" ) {
+    REQUIRE(pick_housekeeping_cpu({0, 1, 2, 3}, {0, 1}) == 2);
+    REQUIRE(pick_housekeeping_cpu({4, 0, 1}, {0, 1}) == 4);
+    REQUIRE(pick_housekeeping_cpu({0, 1}, {0, 1}) == -1);
+    REQUIRE(pick_housekeeping_cpu({}, {}) == -1);
+}
+
+TEST_CASE( "rt_watchdog demotes a runaway thread" ) {
+    rt_watchdog watchdog{0, std::chrono::milliseconds(50), 2};
+    bool demoted = false;
+    int error = 0;
+    std::thread t([&]{
+        rt_thread_scope rt{&watchdog, 1};
+        error = rt.err();
+        if (!rt.ok()) {
+            return;
+        }
+        // spin, yielding so the watchdog gets the cpu even if it couldn't go real-time itself
+        auto deadline = std::chrono::steady_clock::now() + std::chrono::seconds(2);
+        while (!rt.demoted() && std::chrono::steady_clock::now() < deadline) {
+            sched_yield();
+        }
+        demoted = rt.demoted();
+    });
+    t.join();
+    if (error) {
+        WARN("skipping: couldn't set SCHED_FIFO: " << strerror(error));
+        return;
+    }
+    REQUIRE(demoted);
+    REQUIRE(watchdog.demotions().size() == 1);
+}
+
+TEST_CASE( "roofline" ) {
+    double nan = std::numeric_limits<double>::quiet_NaN();
+    roofline r{512, 2, 2000, 128, {{512, 256, 64, 16}}};
+    REQUIRE(flops_per_fma(512) == 16);
+    REQUIRE(flops_per_fma(128) == 4);
+    REQUIRE(ridge_point(r, MEM_DRAM) == 8);
+    REQUIRE(ridge_point(r, MEM_L1) == 0.25);
+    REQUIRE(attainable_gflops(r, MEM_DRAM, 1) == 16);
+    REQUIRE(attainable_gflops(r, MEM_DRAM, 100) == 128);
+
+    roofline partial{256, 1, nan, 32, {{128, 64, nan, 8}}};
+    std::string svg = roofline_svg({r, partial}, "a <test> host");
+    REQUIRE(svg.compare(0, 4, "<svg") == 0);
+    REQUIRE(svg.find("</svg>") != std::string::npos);
+    REQUIRE(svg.find("a &lt;test&gt; host") != std::string::npos);
+    // one roof per measured level, none for the unmeasured L3 of the second line
+    size_t roofs = 0;
+    for (size_t pos = 0; (pos = svg.find("<polyline", pos)) != std::string::npos; pos++) {
+        roofs++;
+    }
+    REQUIRE(roofs == 7);
+}
+
+TEST_CASE( "perf_status_volts" ) {
+    // 0x2000 in bits 47:32 is 1 V, and the ratio in the low bits is ignored
+    REQUIRE(perf_status_volts(0x0000200000002a00ull) == 1.0);
+    REQUIRE(perf_status_volts(0x0000170000000000ull) == Approx(0.71875));
+    REQUIRE(std::isnan(perf_status_volts(0x2a00)));
+}
+
+TEST_CASE( "fit_two_modes" ) {
+    // 70 tries at ~2000 Mops and 30 at ~3000, interleaved with a little spread
+    std::vector<double> flapping;
+    for (int i = 0; i < 100; i++) {
+        flapping.push_back((i % 10 < 7 ? 2000 : 3000) + (i % 5) * 5);
+    }
+    auto fit = fit_two_modes(flapping.data(), flapping.size());
+    REQUIRE(fit.bimodal);
+    REQUIRE(fit.low == Approx(2010).epsilon(0.01));
+    REQUIRE(fit.high == Approx(3010).epsilon(0.01));
+    // the slow tries take 1.5x as long as the fast ones, so 70 of them are 70 * 1.5 / (70 * 1.5 + 30) of the time
+    REQUIRE(fit.low_time == Approx(105.0 / 135).epsilon(0.01));
+
+    // one spread-out mode
+    std::vector<double> spread;
+    for (int i = 0; i < 100; i++) {
+        spread.push_back(2000 + i * 2);
+    }
+    REQUIRE(!fit_two_modes(spread.data(), spread.size()).bimodal);
+
+    // distinct but too close together to matter
+    std::vector<double> close;
+    for (int i = 0; i < 100; i++) {
+        close.push_back(i % 2 ? 2000 : 2010);
+    }
+    REQUIRE(!fit_two_modes(close.data(), close.size()).bimodal);
+
+    // a few outliers aren't a mode
+    std::vector<double> outliers(100, 3000);
+    outliers[3] = outliers[50] = 1000;
+    REQUIRE(!fit_two_modes(outliers.data(), outliers.size()).bimodal);
+
+    std::vector<double> few{1000, 3000};
+    REQUIRE(!fit_two_modes(few.data(), few.size()).bimodal);
+}
+
+/* a trace with one sample per 10 us and a small deterministic wiggle */
+static std::vector<trace_point> make_trace(const std::vector<std::pair<size_t, double>>& levels, double ramp = 0) {
+    std::vector<trace_point> ret;
+    for (auto& l : levels) {
+        for (size_t i = 0; i < l.first; i++) {
+            double us = ret.size() * 10.0;
+            ret.push_back({us, l.second + ((ret.size() * 7) % 5) - 2 + ramp * us / 1000});
+        }
+    }
+    return ret;
+}
+
+TEST_CASE( "change_points" ) {
+    std::vector<double> x;
+    for (int i = 0; i < 300; i++) {
+        x.push_back((i < 100 ? 3000 : i < 200 ? 2600 : 3000) + (i % 3));
+    }
+    REQUIRE(change_points(x, 1000) == std::vector<size_t>{100, 200, 300});
+    // a huge penalty leaves one segment, and short input can't be split
+    REQUIRE(change_points(x, 1e12) == std::vector<size_t>{300});
+    REQUIRE(change_points({1, 2, 3}, 1) == std::vector<size_t>{3});
+}
+
+TEST_CASE( "segment_trace" ) {
+    auto trace = make_trace({{200, 3000}, {200, 2600}, {20, 100}, {200, 3000}});
+    auto phases = segment_trace(trace);
+    REQUIRE(phases.size() == 4);
+    REQUIRE(phases[0].kind == PHASE_STEADY);
+    REQUIRE(phases[1].kind == PHASE_DOWNCLOCK);
+    REQUIRE(phases[1].first == 200);
+    REQUIRE(phases[1].mean_mhz == Approx(2600).epsilon(0.01));
+    REQUIRE(phases[2].kind == PHASE_HALT);
+    REQUIRE(phases[2].duration_us == Approx(200));
+    REQUIRE(phases[3].kind == PHASE_RELAXATION);
+    REQUIRE(phases[3].duration_us == Approx(2000));
+
+    // 3000 falling by 100 MHz per ms over 5 ms
+    auto drift = segment_trace(make_trace({{500, 3000}}, -100));
+    REQUIRE(!drift.empty());
+    REQUIRE(drift[0].kind == PHASE_DRIFT);
+    REQUIRE(drift[0].slope == Approx(-100).epsilon(0.05));
+}
+
+TEST_CASE( "segment_trace on a long trace" ) {
+    // too long for PELT on every sample: the change points come from block means, to within a block
+    auto steps = segment_trace(make_trace({{60000, 3000}, {60000, 2600}}));
+    REQUIRE(steps.size() == 2);
+    REQUIRE(steps[0].last >= 60000 - 12);
+    REQUIRE(steps[0].last <= 60000 + 12);
+    REQUIRE(steps[1].kind == PHASE_DOWNCLOCK);
+    REQUIRE(segment_trace(make_trace({{100000, 3000}})).size() == 1);
+}
+
+TEST_CASE( "read_trace and segment_traces" ) {
+    std::stringstream in("cpu,time_us,mhz\n0,0.0,3000\n1,0.0,2000\n0,10.0,nan\n0,20.0,3001\n");
+    auto traces = read_trace(in);
+    REQUIRE(traces.size() == 2);
+    REQUIRE(traces[0].size() == 2);
+    REQUIRE(traces[0][1].us == 20.0);
+    REQUIRE(traces[1][0].mhz == 2000);
+
+    std::stringstream bad("time_us,mhz\n0,1\n");
+    REQUIRE_THROWS_AS(read_trace(bad), std::runtime_error);
+    std::stringstream garbage("cpu,time_us,mhz\nzero,0.0,3000\n");
+    REQUIRE_THROWS_AS(read_trace(garbage), std::runtime_error);
+    std::stringstream huge("cpu,time_us,mhz\n99999999999,0.0,3000\n");
+    REQUIRE_THROWS_AS(read_trace(huge), std::runtime_error);
+
+    std::map<int, std::vector<trace_point>> many;
+    for (int cpu = 0; cpu < 8; cpu++) {
+        many[cpu] = make_trace({{100, 3000}, {100 + cpu * 10, 2500}});
+    }
+    auto parallel = segment_traces(many, 4), serial = segment_traces(many, 1);
+    REQUIRE(parallel.size() == 8);
+    for (int cpu = 0; cpu < 8; cpu++) {
+        REQUIRE(parallel[cpu].size() == serial[cpu].size());
+        REQUIRE(parallel[cpu].size() == 2);
+        REQUIRE(parallel[cpu][1].last == 200 + cpu * 10);
+    }
+}
+
+TEST_CASE( "prefetch_control" ) {
+    REQUIRE(prefetch_value(0x1234f, 0) == 0x12340);
+    REQUIRE(prefetch_value(0x12340, PREFETCH_L2_ADJACENT) == 0x12342);
+    REQUIRE(prefetch_configs().front().disable == 0);
+
+    std::map<int, uint64_t> msrs = {{0, 0x100}, {2, 0x105}};
+    auto read = [&](int cpu, uint64_t* v){ if (!msrs.count(cpu)) return -ENOENT; *v = msrs[cpu]; return 0; };
+    auto write = [&](int cpu, uint64_t v){ if (v & PREFETCH_DCU_IP) return EIO; msrs[cpu] = v; return 0; };
+    {
+        prefetch_control control({0, 2}, read, write);
+        REQUIRE(control.apply(prefetch_configs()[1]) == "");
+        REQUIRE(msrs[0] == 0x101);
+        REQUIRE(msrs[2] == 0x101);
+        // a failed write restores the originals
+        REQUIRE(control.apply({"all off", PREFETCH_ALL}) != "");
+        REQUIRE(msrs[0] == 0x100);
+        REQUIRE(msrs[2] == 0x105);
+        REQUIRE(control.apply({"no adjacent", PREFETCH_L2_ADJACENT}) == "");
+    }
+    REQUIRE(msrs[0] == 0x100);
+    REQUIRE(msrs[2] == 0x105);
+    // the destructor unregistered the cleanup
+    msrs[0] = 0x999;
+    run_cleanups();
+    REQUIRE(msrs[0] == 0x999);
+
+    REQUIRE_THROWS_AS(prefetch_control({0, 1}, read, write), std::runtime_error);
+}
+
+TEST_CASE( "parse_resctrl_alloc" ) {
+    auto a = parse_resctrl_alloc("l3=0xf0,mb=50");
+    REQUIRE(a.l3_mask == 0xf0);
+    REQUIRE(a.mb_percent == 50);
+    REQUIRE(a.to_string() == "l3=0xf0,mb=50");
+    REQUIRE(parse_resctrl_alloc("mb=10").l3_mask == 0);
+    REQUIRE_THROWS_AS(parse_resctrl_alloc("l3=0x5"), std::runtime_error); // not contiguous
+    REQUIRE_THROWS_AS(parse_resctrl_alloc("mb=0"), std::runtime_error);
+    REQUIRE_THROWS_AS(parse_resctrl_alloc("l2=0x3"), std::runtime_error);
+    REQUIRE_THROWS_AS(parse_resctrl_alloc(""), std::runtime_error);
+
+    std::string root = "    L3:0=7ff;1=7ff\n    MB:0=100;1=100\n";
+    REQUIRE(resctrl_schemata(root, a) == "L3:0=f0;1=f0\nMB:0=50;1=50\n");
+    REQUIRE(resctrl_schemata("L3CODE:0=ff\nL3DATA:0=ff\n", parse_resctrl_alloc("l3=3")) == "L3CODE:0=3\nL3DATA:0=3\n");
+    REQUIRE_THROWS_AS(resctrl_schemata("L3:0=ff\n", parse_resctrl_alloc("mb=20")), std::runtime_error);
+}
+
+TEST_CASE( "resctrl_group" ) {
+    temp_dir dir("resctrl");
+    std::string root = dir.path;
+    REQUIRE_THROWS_AS(resctrl_group(root, "g", parse_resctrl_alloc("mb=50")), std::runtime_error); // not mounted
+
+    make_file(root, "/schemata", "L3:0=7ff\nMB:0=100\n");
+    make_file(root, "/info/L3/cbm_mask", "7ff\n");
+    make_file(root, "/info/MB/min_bandwidth", "10\n");
+    REQUIRE_THROWS_AS(resctrl_group(root, "g", parse_resctrl_alloc("l3=0xf00")), std::runtime_error);
+    REQUIRE_THROWS_AS(resctrl_group(root, "g", parse_resctrl_alloc("mb=5")), std::runtime_error);
+    {
+        resctrl_group group(root, "g", parse_resctrl_alloc("l3=0x3f,mb=20"));
+        REQUIRE(group.path() == root + "/g");
+        REQUIRE(read_file(root + "/g/schemata") == "L3:0=3f");
+        REQUIRE(group.add_task(123) == 0);
+        REQUIRE(group.add_task(456) == 0);
+        std::ifstream tasks(root + "/g/tasks");
+        int a, b;
+        tasks >> a >> b;
+        REQUIRE((a == 123 && b == 456));
+        REQUIRE_THROWS_AS(resctrl_group(root, "g", parse_resctrl_alloc("mb=50")), std::runtime_error); // exists
+    }
+    struct stat st;
+    REQUIRE(stat((root + "/g").c_str(), &st) == -1);
+}
@@ -0,0 +1,175 @@
+/*
+ * topology.cpp
+ */
+
+#include "topology.hpp"
+#include "cpuid.hpp"
+#include "env-audit.hpp"
+
+#include <cerrno>
+#include <cstdlib>
+#include <fstream>
+#include <set>
+#include <thread>
+
+#include <err.h>
+#include <sched.h>
+#include <unistd.h>
+
+namespace {
+
+/* a CPU_ALLOC'd set, big enough for any cpu number below count */
+struct dyn_cpu_set {
+    size_t count, bytes;
+    cpu_set_t* set;
+
+    dyn_cpu_set(size_t count) : count{count}, bytes{CPU_ALLOC_SIZE(count)}, set{CPU_ALLOC(count)} {
+        if (!set) {
+            err(EXIT_FAILURE, "CPU_ALLOC failed");
+        }
+        CPU_ZERO_S(bytes, set);
+    }
+
+    dyn_cpu_set(const dyn_cpu_set&) = delete;
+    void operator=(const dyn_cpu_set&) = delete;
+
+    ~dyn_cpu_set() { CPU_FREE(set); }
+};
+
+/* the size in bytes of a sysfs cache size file, which look like "32768K", or 0 if it can't be read */
+size_t read_cache_size(const std::string& path) {
+    std::ifstream in(path);
+    size_t size;
+    std::string unit;
+    if (!(in >> size)) {
+        return 0;
+    }
+    in >> unit;
+    return size * (unit == "K" ? 1024 : unit == "M" ? 1024 * 1024 : 1);
+}
+
+}
+
+std::vector<int> get_cpus() {
+    // the kernel's mask can be bigger than the configured cpu count suggests: grow until it fits
+    for (size_t count = std::max(sysconf(_SC_NPROCESSORS_CONF), 1L); ; count *= 2) {
+        dyn_cpu_set cpu_set{count};
+        if (sched_getaffinity(0, cpu_set.bytes, cpu_set.set)) {
+            if (errno == EINVAL && count < (1u << 20)) {
+                continue;
+            }
+            err(EXIT_FAILURE, "failed while getting cpu affinity");
+        }
+        std::vector<int> ret;
+        for (size_t cpu = 0; cpu < cpu_set.bytes * 8; cpu++) {
+            if (CPU_ISSET_S(cpu, cpu_set.bytes, cpu_set.set)) {
+                ret.push_back(cpu);
+            }
+        }
+        return ret;
+    }
+}
+
+int set_cpu_affinity(int cpu) {
+    if (cpu < 0) {
+        return EINVAL;
+    }
+    dyn_cpu_set cpu_set{(size_t)cpu + 1};
+    CPU_SET_S(cpu, cpu_set.bytes, cpu_set.set);
+    return sched_setaffinity(0, cpu_set.bytes, cpu_set.set) ? errno : 0;
+}
+
+std::vector<int> smt_siblings(const std::string& root, int cpu) {
+    std::ifstream in(root + "sys/devices/system/cpu/cpu" + std::to_string(cpu) + "/topology/thread_siblings_list");
+    std::string list;
+    if (!std::getline(in, list) || list.empty()) {
+        return {};
+    }
+    return parse_cpu_list(list);
+}
+
+std::vector<int> first_smt_siblings(const std::string& root, const std::vector<int>& cpus) {
+    std::vector<int> ret;
+    std::set<std::vector<int>> seen;
+    for (int cpu : cpus) {
+        auto siblings = smt_siblings(root, cpu);
+        if (siblings.empty()) {
+            return {};
+        }
+        if (seen.insert(siblings).second) {
+            ret.push_back(cpu);
+        }
+    }
+    return ret;
+}
+
+std::vector<uint32_t> probe_x2apic_ids(const std::vector<int>& cpus) {
+    std::vector<uint32_t> ret(cpus.size());
+    std::vector<int> errors(cpus.size());
+    std::vector<std::thread> probers;
+    probers.reserve(cpus.size());
+    for (size_t i = 0; i < cpus.size(); i++) {
+        probers.emplace_back([&, i]{
+            errors[i] = set_cpu_affinity(cpus[i]);
+            ret[i] = cpuid(0xb).edx;
+        });
+    }
+    for (auto& t : probers) {
+        t.join();
+    }
+    for (size_t i = 0; i < cpus.size(); i++) {
+        if (errors[i]) {
+            errno = errors[i];
+            err(EXIT_FAILURE, "failed to pin the topology prober to cpu %d", cpus[i]);
+        }
+    }
+    return ret;
+}
+
+std::map<int, std::vector<int>> cpus_by_package(const std::string& root, const std::vector<int>& cpus) {
+    std::map<int, std::vector<int>> ret;
+    for (int cpu : cpus) {
+        std::ifstream in(root + "sys/devices/system/cpu/cpu" + std::to_string(cpu) + "/topology/physical_package_id");
+        int package = 0;
+        if (!(in >> package)) {
+            package = 0;
+        }
+        ret[package].push_back(cpu);
+    }
+    return ret;
+}
+
+size_t last_level_cache_bytes(const std::string& root, int cpu) {
+    size_t ret = 0;
+    int best_level = 0;
+    std::string base = root + "sys/devices/system/cpu/cpu" + std::to_string(cpu) + "/cache/index";
+    for (int index = 0; ; index++) {
+        std::ifstream level_in(base + std::to_string(index) + "/level");
+        int level;
+        if (!(level_in >> level)) {
+            break;
+        }
+        size_t size;
+        if (level > best_level && (size = read_cache_size(base + std::to_string(index) + "/size"))) {
+            ret = size;
+            best_level = level;
+        }
+    }
+    return ret;
+}
+
+size_t cache_bytes(const std::string& root, int cpu, int level) {
+    std::string base = root + "sys/devices/system/cpu/cpu" + std::to_string(cpu) + "/cache/index";
+    for (int index = 0; ; index++) {
+        std::ifstream level_in(base + std::to_string(index) + "/level"), type_in(base + std::to_string(index) + "/type");
+        int l;
+        if (!(level_in >> l)) {
+            return 0;
+        }
+        std::string type;
+        size_t size;
+        if (l == level && type_in >> type && type != "Instruction" && (size = read_cache_size(base + std::to_string(index) + "/size"))) {
+            return size;
+        }
+    }
+}
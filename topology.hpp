@@ -0,0 +1,80 @@
+/*
+ * topology.hpp
+ *
+ * CPU topology (which package each cpu belongs to) read from sysfs, and helpers for deciding which
+ * packages can run experiments concurrently. The affinity helpers use dynamically sized cpu sets, so
+ * they work on hosts with more than CPU_SETSIZE cpus.
+ */
+
+#ifndef TOPOLOGY_HPP_
+#define TOPOLOGY_HPP_
+
+#include <cstddef>
+#include <cstdint>
+#include <map>
+#include <string>
+#include <vector>
+
+/** the cpus in the calling thread's affinity mask, in increasing order */
+std::vector<int> get_cpus();
+
+/** restrict the calling thread to cpu, returning 0 or an errno value */
+int set_cpu_affinity(int cpu);
+
+/**
+ * The cpus sharing a core with cpu (including cpu itself), from
+ * sys/devices/system/cpu/cpuN/topology/thread_siblings_list relative to root, or empty if it can't be read.
+ */
+std::vector<int> smt_siblings(const std::string& root, int cpu);
+
+/**
+ * Filter cpus to the first (in the given order) of each set of SMT siblings, using
+ * sys/devices/system/cpu/cpuN/topology/thread_siblings_list relative to root. Returns an empty vector
+ * if the siblings of any cpu can't be read.
+ */
+std::vector<int> first_smt_siblings(const std::string& root, const std::vector<int>& cpus);
+
+/**
+ * The x2APIC id of each of the given cpus (CPUID leaf 0xb EDX), read by one short-lived thread pinned
+ * to each cpu, all running concurrently.
+ */
+std::vector<uint32_t> probe_x2apic_ids(const std::vector<int>& cpus);
+
+/**
+ * Group the given cpus by physical package id, as read from sys/devices/system/cpu/cpuN/topology/physical_package_id
+ * relative to root ("/" normally). Cpus whose package can't be read are put in package 0.
+ */
+std::map<int, std::vector<int>> cpus_by_package(const std::string& root, const std::vector<int>& cpus);
+
+/**
+ * The size in bytes of the L3 (or more generally the highest level) cache of cpu, from sys/devices/system/cpu/cpuN/cache
+ * relative to root, or 0 if it can't be read.
+ */
+size_t last_level_cache_bytes(const std::string& root, int cpu);
+
+/**
+ * The size in bytes of the data or unified cache at the given level (1 for L1 and so on) of cpu, from
+ * sys/devices/system/cpu/cpuN/cache relative to root, or 0 if it can't be read.
+ */
+size_t cache_bytes(const std::string& root, int cpu, int level);
+
+/**
+ * Greedily pick a set of mutually independent packages: each package (in order) is added if independent(a, b)
+ * and independent(b, a) are true for every package a already picked. The first package is always picked.
+ */
+template <typename F>
+std::vector<int> independent_packages(const std::vector<int>& packages, F independent) {
+    std::vector<int> ret;
+    for (int p : packages) {
+        bool ok = true;
+        for (int q : ret) {
+            ok = ok && independent(p, q) && independent(q, p);
+        }
+        if (ok) {
+            ret.push_back(p);
+        }
+    }
+    return ret;
+}
+
+#endif /* TOPOLOGY_HPP_ */
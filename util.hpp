@@ -9,6 +9,10 @@
 #include <iterator>
 #include <algorithm>
 #include <cassert>
+#include <cerrno>
+#include <fstream>
+#include <string>
+#include <vector>
 
 /*
  * Split a string delimited by sep.
@@ -235,5 +239,23 @@ static inline double nconc_ratio(Itr starto, Itr stopo, Itr starti, Itr stopi) {
     return remap(raw_ratio, 1, ocount, 0.0, 1.0);
 }
 
+/* the first line of the file, without the trailing newline, or "" if it can't be read */
+static inline std::string read_line(const std::string& path) {
+    std::ifstream in(path);
+    std::string line;
+    std::getline(in, line);
+    return line;
+}
+
+/* write value to the file (e.g., a sysfs setting), returning 0 on success or an errno value */
+static inline int write_value(const std::string& path, const std::string& value, std::ios::openmode mode = std::ios::out) {
+    errno = 0;
+    std::ofstream out(path, mode);
+    if (!out) {
+        return errno ? errno : EIO;
+    }
+    out << value << std::flush;
+    return out ? 0 : (errno ? errno : EIO);
+}
 
 #endif /* UTIL_HPP_ */
@@ -0,0 +1,36 @@
+/*
+ * vcore.hpp
+ *
+ * Reading the core voltage from IA32_PERF_STATUS, which many Intel parts report alongside the current
+ * ratio. The voltage is a point sample, not an accumulated counter like APERF and MPERF.
+ */
+
+#ifndef VCORE_HPP_
+#define VCORE_HPP_
+
+#include "msr-access.h"
+
+#include <cinttypes>
+#include <limits>
+
+#define MSR_IA32_PERF_STATUS 0x00000198
+
+/**
+ * The core voltage in bits 47:32 of an IA32_PERF_STATUS value, in units of 1/8192 V, or NaN if the
+ * field is zero, as it is on parts which don't report it.
+ */
+static inline double perf_status_volts(uint64_t value) {
+    uint64_t raw = (value >> 32) & 0xffff;
+    return raw ? raw / 8192.0 : std::numeric_limits<double>::quiet_NaN();
+}
+
+/** the current voltage of the cpu we are running on, or NaN if it can't be read */
+static inline double read_vcore() {
+    uint64_t value;
+    if (read_msr_cur_cpu(MSR_IA32_PERF_STATUS, &value)) {
+        return std::numeric_limits<double>::quiet_NaN();
+    }
+    return perf_status_volts(value);
+}
+
+#endif /* VCORE_HPP_ */